@@ -2,6 +2,8 @@
 #include "common/connection.h"
 #include "common/debugging.h"
 #include "common/defaults.h"
+#include "common/giga_index.h"
+#include "common/options.h"
 
 #include "operations.h"
 
@@ -9,16 +11,22 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <utime.h>
 #include <unistd.h>
 
 const char* phase = "";
 
+struct LevelDB *ldb_shards;
+int ldb_num_shards;
+
 #define CheckNoError(err)                                               \
   if ((err) != NULL) {                                                  \
     fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, phase, (err)); \
@@ -38,40 +46,569 @@ static void Free(char** ptr) {
   }
 }
 
-int leveldb_init(struct LevelDB ldb, const char *ldb_name)
+// Keys of directory entries are binary, with fixed-width big-endian fields:
+//
+//   parent_dir_id (4 bytes), partition_id (4), hash of obj_name (8), obj_name
+//
+// so all entries of a partition are next to each other, and share the 
+// KEY_PREFIX_SIZE bytes of (parent_dir_id, partition_id); in a partition, 
+// entries are in the order of their hash. The hash is the same for every 
+// directory (it only orders the keys, it does not place the entries).
+//
+// As the placement hash of a directory (giga_get_index_for_file()) is not
+// known here, the entries that move in a split are not a key range: 
+// split_bucket() reads the whole partition and hashes every name to pick 
+// them, and as the partition is part of the key, each moved entry is 
+// written again under its new key (and deleted under the old one).
+//
+#define KEY_PREFIX_SIZE     8
+#define KEY_HEADER_SIZE     16
+#define KEY_HASH            GIGA_HASH_MURMUR64
+
+#define MAX_KEY_SIZE        (KEY_HEADER_SIZE + MAX_LEN)
+
+static char* put_u32(char *buf, uint32_t val)
+{
+    unsigned char *p = (unsigned char *)buf;
+
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+    return buf + 4;
+}
+
+static char* put_u64(char *buf, uint64_t val)
+{
+    buf = put_u32(buf, (uint32_t)(val >> 32));
+    return put_u32(buf, (uint32_t)val);
+}
+
+static const char* get_u32(const char *buf, uint32_t *val)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    *val = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+    return buf + 4;
+}
+
+static const char* get_u64(const char *buf, uint64_t *val)
+{
+    uint32_t hi, lo;
+
+    buf = get_u32(buf, &hi);
+    buf = get_u32(buf, &lo);
+    *val = ((uint64_t)hi << 32) | lo;
+    return buf;
+}
+
+static size_t make_prefix(char *key, int parent_dir_id, int partition_id)
+{
+    key = put_u32(key, parent_dir_id);
+    put_u32(key, partition_id);
+    return KEY_PREFIX_SIZE;
+}
+
+// "key" has MAX_KEY_SIZE bytes; names longer than MAX_LEN are cut short.
+//
+static size_t make_key(char *key, int parent_dir_id, int partition_id, 
+                       const char *obj_name)
+{
+    size_t name_len = strnlen(obj_name, MAX_LEN);
+    uint64_t hash = giga_hash_value(KEY_HASH, obj_name);
+    char *p = key + make_prefix(key, parent_dir_id, partition_id);
+
+    p = put_u64(p, hash);
+    memcpy(p, obj_name, name_len);
+
+    return KEY_HEADER_SIZE + name_len;
+}
+
+// The value of an entry is its inode record, with fixed-width big-endian 
+// fields (times are seconds and nanoseconds):
+//
+//   version (4 bytes), mode (4), uid (4), gid (4), size (8), 
+//   atime (8+4), mtime (8+4), ctime (8+4), object id (8), 
+//   link_len (4), link target (link_len bytes, no NUL)
+//
+// Entries without an object id (files, until their data object is created)
+// store -1.
+//
+#define INODE_VERSION       1
+#define INODE_HEADER_SIZE   72
+
+static char* put_time(char *buf, const struct timespec *ts)
+{
+    buf = put_u64(buf, ts->tv_sec);
+    return put_u32(buf, ts->tv_nsec);
+}
+
+static const char* get_time(const char *buf, struct timespec *ts)
+{
+    uint64_t sec;
+    uint32_t nsec;
+
+    buf = get_u64(buf, &sec);
+    buf = get_u32(buf, &nsec);
+    ts->tv_sec = sec;
+    ts->tv_nsec = nsec;
+    return buf;
+}
+
+// Encode the record in "val" (of INODE_HEADER_SIZE+MAX_LEN bytes), and 
+// return its length.
+//
+static size_t make_inode(char *val, mode_t mode, int obj_id, const char *link)
+{
+    size_t link_len = (link != NULL) ? strnlen(link, MAX_LEN) : 0;
+    struct timespec now;
+    char *p = val;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    p = put_u32(p, INODE_VERSION);
+    p = put_u32(p, mode);
+    p = put_u32(p, geteuid());
+    p = put_u32(p, getegid());
+    p = put_u64(p, link_len);       // the size of a symlink is its target's
+    p = put_time(p, &now);
+    p = put_time(p, &now);
+    p = put_time(p, &now);
+    p = put_u64(p, (int64_t)obj_id);
+    p = put_u32(p, link_len);
+    if (link_len > 0)
+        memcpy(p, link, link_len);
+
+    return INODE_HEADER_SIZE + link_len;
+}
+
+// Decode the record in "val" into "stbuf"; returns -EIO if it is not valid.
+//
+static int read_inode(const char *val, size_t val_len, struct stat *stbuf)
+{
+    uint32_t version, mode, uid, gid, link_len;
+    uint64_t size, obj_id;
+
+    if (val_len < INODE_HEADER_SIZE)
+        return -EIO;
+    val = get_u32(val, &version);
+    if (version != INODE_VERSION)
+        return -EIO;
+
+    memset(stbuf, 0, sizeof(struct stat));
+    val = get_u32(val, &mode);
+    val = get_u32(val, &uid);
+    val = get_u32(val, &gid);
+    val = get_u64(val, &size);
+    val = get_time(val, &stbuf->st_atim);
+    val = get_time(val, &stbuf->st_mtim);
+    val = get_time(val, &stbuf->st_ctim);
+    val = get_u64(val, &obj_id);
+    val = get_u32(val, &link_len);
+    if (link_len != val_len - INODE_HEADER_SIZE)
+        return -EIO;
+
+    stbuf->st_mode = mode;
+    stbuf->st_nlink = S_ISDIR(mode) ? 2 : 1;
+    stbuf->st_uid = uid;
+    stbuf->st_gid = gid;
+    stbuf->st_size = size;
+    stbuf->st_blksize = 4096;
+    stbuf->st_blocks = (size + 511) / 512;
+    if ((int64_t)obj_id >= 0)
+        stbuf->st_ino = obj_id;
+
+    return 0;
+}
+
+// Group commit (see operations.h): a mutation waits in the queue until it is
+// done, or until it is at the head of the queue; the head is the leader, it
+// writes its group and hands the head over to the next mutation.
+//
+#define WRITE_PUT       0       // add (or replace) the entries
+#define WRITE_CREATE    1       // add the entries, -EEXIST if one is there
+#define WRITE_DELETE    2       // delete the entries
+
+struct commit_req {
+    int parent_dir_id;
+    int partition_id;
+    struct ldb_entry *entries;
+    int num_entries;
+    int op;                             // WRITE_*
+
+    int done;
+    int status;
+    pthread_cond_t cond;
+    struct commit_req *next;
+};
+
+struct ldb_commit_queue {
+    pthread_mutex_t mtx;
+    struct commit_req *head, *tail;
+    int queued;                         // entries in the queue
+    struct ldb_commit_stats stats;
+};
+
+static int hist_bucket(unsigned long val)
+{
+    int bucket = (val == 0) ? 0 : 64 - __builtin_clzl(val);
+
+    return (bucket < LDB_HIST_BUCKETS) ? bucket : LDB_HIST_BUCKETS - 1;
+}
+
+static unsigned long usecs_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)*1000000UL + 
+           (now.tv_nsec - start->tv_nsec)/1000;
+}
+
+// The keys written by the batch of a group that has a WRITE_CREATE, so 
+// that a create also sees the entries put or deleted earlier in the batch.
+// It is an open addressing table, indexed by the hash of the keys.
+//
+struct batch_key {
+    uint64_t hash;
+    struct commit_req *req;             // NULL if the slot is free
+    struct ldb_entry *entry;
+    int present;                        // put (1) or deleted (0)
+};
+
+struct batch_keys {
+    struct batch_key *slots;
+    size_t mask;
+};
+
+static uint64_t batch_key_hash(const char *key)
+{
+    uint32_t dir_id, partition_id;
+    uint64_t hash;
+
+    get_u64(get_u32(get_u32(key, &dir_id), &partition_id), &hash);
+    return hash ^ ((((uint64_t)dir_id << 32) | partition_id) * 
+                   0x9e3779b97f4a7c15ULL);
+}
+
+// Find the slot of the entry "e" of "req" (with key "key"), or the free slot
+// where it goes.
+//
+static struct batch_key* find_batch_key(struct batch_keys *keys, 
+                                        const char *key, 
+                                        struct commit_req *req, 
+                                        struct ldb_entry *e)
+{
+    uint64_t hash = batch_key_hash(key);
+    size_t i = hash & keys->mask;
+
+    while (keys->slots[i].req != NULL) {
+        struct batch_key *k = &keys->slots[i];
+        if ((k->hash == hash) && 
+            (k->req->parent_dir_id == req->parent_dir_id) &&
+            (k->req->partition_id == req->partition_id) &&
+            (strncmp(k->entry->name, e->name, MAX_LEN) == 0))
+            break;
+        i = (i + 1) & keys->mask;
+    }
+    keys->slots[i].hash = hash;
+
+    return &keys->slots[i];
+}
+
+// Return 0 if the entries of the WRITE_CREATE "req" are neither stored nor
+// put earlier in the batch, -EEXIST if one is, or -EIO.
+//
+static int check_create(struct LevelDB ldb, struct batch_keys *keys,
+                        struct commit_req *req)
+{
+    char *err = NULL;
+    char key[MAX_KEY_SIZE];
+    size_t key_len, val_len;
+    int i;
+
+    for (i = 0; i < req->num_entries; i++) {
+        key_len = make_key(key, req->parent_dir_id, req->partition_id, 
+                           req->entries[i].name);
+        struct batch_key *k = find_batch_key(keys, key, req, 
+                                             &req->entries[i]);
+        if (k->req != NULL) {
+            if (k->present)
+                return -EEXIST;
+            continue;
+        }
+
+        char *val = leveldb_get(ldb.db, ldb.roptions, key, key_len, 
+                                &val_len, &err);
+        int found = (val != NULL);
+        Free(&val);
+        if (err != NULL) {
+            logMessage(LOG_ERR, __func__, "get(%d:%d:%s) failed: %s", 
+                       req->parent_dir_id, req->partition_id, 
+                       req->entries[i].name, err);
+            Free(&err);
+            return -EIO;
+        }
+        if (found)
+            return -EEXIST;
+    }
+
+    return 0;
+}
+
+// Write (or delete) the entries of the mutations from "first" to "last" 
+// in a single batch. A WRITE_CREATE whose entry is stored, or put earlier in
+// the batch, gets -EEXIST (in its status) and writes nothing; the leader 
+// checks this while it is at the head of the queue, so no other mutation 
+// of the shard gets in between.
+//
+static int write_group(struct LevelDB ldb, 
+                       struct commit_req *first, struct commit_req *last)
+{
+    char *err = NULL;
+    char key[MAX_KEY_SIZE];
+    size_t key_len;
+    struct commit_req *req;
+    struct batch_keys keys = { NULL, 0 };
+    int i, n = 0, creates = 0;
+
+    for (req = first; ; req = req->next) {
+        n += req->num_entries;
+        creates |= (req->op == WRITE_CREATE);
+        if (req == last)
+            break;
+    }
+    if (creates) {
+        for (keys.mask = 1; keys.mask < 2*(size_t)n; keys.mask <<= 1)
+            ;
+        if ((keys.slots = calloc(keys.mask, sizeof(*keys.slots))) == NULL) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        keys.mask--;
+    }
+
+    leveldb_writebatch_t *batch = leveldb_writebatch_create();
+    for (req = first; ; req = req->next) {
+        if (req->op == WRITE_CREATE)
+            req->status = check_create(ldb, &keys, req);
+        for (i = 0; (i < req->num_entries) && (req->status == 0); i++) {
+            struct ldb_entry *e = &req->entries[i];
+
+            key_len = make_key(key, req->parent_dir_id, req->partition_id, 
+                               e->name);
+            if (req->op == WRITE_DELETE)
+                leveldb_writebatch_delete(batch, key, key_len);
+            else
+                leveldb_writebatch_put(batch, key, key_len, 
+                                       e->val, e->val_len);
+            if (creates) {
+                struct batch_key *k = find_batch_key(&keys, key, req, e);
+                k->req = req;
+                k->entry = e;
+                k->present = (req->op != WRITE_DELETE);
+            }
+        }
+        if (req == last)
+            break;
+    }
+    free(keys.slots);
+    leveldb_write(ldb.db, ldb.woptions, batch, &err);
+    leveldb_writebatch_destroy(batch);
+
+    if (err != NULL) {
+        logMessage(LOG_ERR, __func__, "write(%d:%d) failed: %s", 
+                   first->parent_dir_id, first->partition_id, err);
+        Free(&err);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+// Write (or delete, per "op") the entries of a partition in a single batch,
+// with the mutations queued alongside.
+//
+static int write_entries(struct LevelDB ldb, 
+                         int parent_dir_id, int partition_id,
+                         struct ldb_entry *entries, int num_entries, 
+                         int op)
+{
+    struct ldb_commit_queue *q = ldb.queue;
+    struct commit_req req, *last, *r, *next;
+    struct timespec start;
+    int group_max = giga_options_t.ldb_group_max;
+    int n;
+
+    if (num_entries == 0)
+        return 0;
+
+    req.parent_dir_id = parent_dir_id;
+    req.partition_id = partition_id;
+    req.entries = entries;
+    req.num_entries = num_entries;
+    req.op = op;
+    req.done = 0;
+    req.status = 0;
+    req.next = NULL;
+    pthread_cond_init(&req.cond, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&q->mtx);
+    if (q->tail != NULL)
+        q->tail->next = &req;
+    else
+        q->head = &req;
+    q->tail = &req;
+    q->queued += num_entries;
+    if ((q->head != &req) && (q->queued >= group_max))
+        pthread_cond_signal(&q->head->cond);     // the group is full
+
+    while (!req.done && (q->head != &req))
+        pthread_cond_wait(&req.cond, &q->mtx);
+
+    if (!req.done) {
+        // the leader: wait (a bit) for the group to grow, and write it
+        if ((giga_options_t.ldb_group_delay > 0) && 
+            (giga_options_t.ldb_durability != LDB_DURABILITY_SYNC)) {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += giga_options_t.ldb_group_delay*1000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while ((q->queued < group_max) &&
+                   (pthread_cond_timedwait(&req.cond, &q->mtx, 
+                                           &deadline) == 0))
+                ;
+        }
+
+        last = &req;
+        n = num_entries;
+        if (giga_options_t.ldb_durability != LDB_DURABILITY_SYNC) {
+            while ((last->next != NULL) && 
+                   (n + last->next->num_entries <= group_max)) {
+                last = last->next;
+                n += last->num_entries;
+            }
+        }
+        pthread_mutex_unlock(&q->mtx);
+
+        int status = write_group(ldb, &req, last);
+
+        pthread_mutex_lock(&q->mtx);
+        q->stats.writes++;
+        q->stats.group_size[hist_bucket(n)]++;
+        q->queued -= n;
+        q->head = last->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+        else
+            pthread_cond_signal(&q->head->cond);   // the next leader
+        for (r = &req; r != NULL; r = next) {
+            next = (r == last) ? NULL : r->next;
+            if (status < 0)
+                r->status = status;
+            r->done = 1;
+            if (r != &req)
+                pthread_cond_signal(&r->cond);
+        }
+    }
+
+    q->stats.commits++;
+    q->stats.latency[hist_bucket(usecs_since(&start))]++;
+    pthread_mutex_unlock(&q->mtx);
+
+    pthread_cond_destroy(&req.cond);
+
+    return req.status;
+}
+
+void leveldb_get_commit_stats(struct LevelDB ldb, 
+                              struct ldb_commit_stats *stats)
+{
+    pthread_mutex_lock(&ldb.queue->mtx);
+    *stats = ldb.queue->stats;
+    pthread_mutex_unlock(&ldb.queue->mtx);
+}
+
+// The block cache and the bloom filter policy are shared by all the LevelDB
+// handles of the server (so the cache size bounds all of them), and set up
+// by the first leveldb_init() from the tuning settings (see options.h).
+//
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static leveldb_cache_t *shared_cache;
+static leveldb_filterpolicy_t *shared_filter;
+
+static void init_shared()
+{
+    if (giga_options_t.ldb_cache_size > 0)
+        shared_cache = leveldb_cache_create_lru(giga_options_t.ldb_cache_size);
+    if (giga_options_t.ldb_bloom_bits > 0)
+        shared_filter = 
+            leveldb_filterpolicy_create_bloom(giga_options_t.ldb_bloom_bits);
+}
+
+int leveldb_init(struct LevelDB *ldb, const char *ldb_name)
 {
     int ret_val = 0;
     char *err = NULL;
 
-    ldb.env = leveldb_create_default_env();
-    ldb.cache = leveldb_cache_create_lru(100000);
+    if ((ldb->queue = calloc(1, sizeof(struct ldb_commit_queue))) == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    pthread_mutex_init(&ldb->queue->mtx, NULL);
+
+    pthread_once(&shared_once, init_shared);
+
+    ldb->env = leveldb_create_default_env();
+    ldb->cache = shared_cache;
+    ldb->filter = shared_filter;
 
     // Create and initialize the "options" object for a levelDB table
-    ldb.options = leveldb_options_create();
-    //leveldb_options_set_comparator(ldb.options, cmp);     //XXX: need it?
-    leveldb_options_set_error_if_exists(ldb.options, 1);
-    leveldb_options_set_cache(ldb.options, ldb.cache);
-    leveldb_options_set_env(ldb.options, ldb.env);
-    leveldb_options_set_info_log(ldb.options, NULL);
-    leveldb_options_set_write_buffer_size(ldb.options, 4000000);
-    leveldb_options_set_paranoid_checks(ldb.options, 1);
-    leveldb_options_set_max_open_files(ldb.options, 1000);
-    leveldb_options_set_block_size(ldb.options, 4096);
-    leveldb_options_set_block_restart_interval(ldb.options, 16);
-    leveldb_options_set_compression(ldb.options, leveldb_no_compression);
+    ldb->options = leveldb_options_create();
+    //leveldb_options_set_comparator(ldb->options, cmp);     //XXX: need it?
+    leveldb_options_set_error_if_exists(ldb->options, 0);  // reopen on restart
+    if (ldb->cache != NULL)
+        leveldb_options_set_cache(ldb->options, ldb->cache);
+    if (ldb->filter != NULL)
+        leveldb_options_set_filter_policy(ldb->options, ldb->filter);
+    leveldb_options_set_env(ldb->options, ldb->env);
+    leveldb_options_set_info_log(ldb->options, NULL);
+    leveldb_options_set_write_buffer_size(ldb->options, 
+                                          giga_options_t.ldb_write_buffer);
+    leveldb_options_set_paranoid_checks(ldb->options, 
+                                        giga_options_t.ldb_paranoid_checks);
+    leveldb_options_set_max_open_files(ldb->options, 
+                                       giga_options_t.ldb_max_open_files);
+    leveldb_options_set_block_size(ldb->options, 
+                                   giga_options_t.ldb_block_size);
+    leveldb_options_set_block_restart_interval(ldb->options, 16);
+    leveldb_options_set_compression(ldb->options, 
+            (giga_options_t.ldb_compression == LDB_COMPRESSION_SNAPPY) ?
+            leveldb_snappy_compression : leveldb_no_compression);
 
     // Create and initialize options that control real operations
-    ldb.roptions = leveldb_readoptions_create();
-    leveldb_readoptions_set_verify_checksums(ldb.roptions, 0);
-    leveldb_readoptions_set_fill_cache(ldb.roptions, 0);
+    ldb->roptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_verify_checksums(ldb->roptions, 0);
+    leveldb_readoptions_set_fill_cache(ldb->roptions, 1);
+
+    // partition scans (of splits) read each entry once: they don't fill
+    // the cache, so they don't evict the entries being looked up
+    ldb->scan_roptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_verify_checksums(ldb->scan_roptions, 0);
+    leveldb_readoptions_set_fill_cache(ldb->scan_roptions, 0);
 
     // Create and initialize options that control write operations
-    ldb.woptions = leveldb_writeoptions_create();
-    leveldb_writeoptions_set_sync(ldb.woptions, 0);
+    ldb->woptions = leveldb_writeoptions_create();
+    leveldb_writeoptions_set_sync(ldb->woptions, 
+                   giga_options_t.ldb_durability != LDB_DURABILITY_ASYNC);
     
-    leveldb_options_set_create_if_missing(ldb.options, 1);
-    ldb.db = leveldb_open(ldb.options, ldb_name, &err);
-    if (err == NULL) {
+    leveldb_options_set_create_if_missing(ldb->options, 1);
+    ldb->db = leveldb_open(ldb->options, ldb_name, &err);
+    if (err != NULL) {
         fprintf(stdout, "%s:%d: ERROR=[%s]\n", __FILE__, __LINE__, err); \
         ret_val = -1;
     }
@@ -80,49 +617,107 @@ int leveldb_init(struct LevelDB ldb, const char *ldb_name)
     return ret_val;
 }
 
+// The number of shards is kept in shard 0, as metadata of a directory id
+// that no directory has.
+//
+#define SHARDS_DIR_ID   -1
+#define SHARDS_META     "shards"
+
+int leveldb_init_shards(const char *ldb_prefix, int num_shards)
+{
+    char ldb_name[MAX_LEN];
+    char stored[sizeof(uint32_t)];
+    char *val;
+    size_t val_len;
+    uint32_t num;
+    int i, ret;
+
+    ldb_shards = calloc(num_shards, sizeof(struct LevelDB));
+    if (ldb_shards == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    for (i = 0; i < num_shards; i++) {
+        snprintf(ldb_name, sizeof(ldb_name), "%s-%d", ldb_prefix, i);
+        if (leveldb_init(&ldb_shards[i], ldb_name) < 0)
+            return -1;
+    }
+    ldb_num_shards = num_shards;
+
+    ret = leveldb_get_dir_meta(ldb_shards[0], SHARDS_DIR_ID, SHARDS_META,
+                               &val, &val_len);
+    if (ret == -ENOENT) {
+        put_u32(stored, num_shards);
+        return leveldb_put_dir_meta(ldb_shards[0], SHARDS_DIR_ID, 
+                                    SHARDS_META, stored, sizeof(stored));
+    }
+    if (ret < 0)
+        return ret;
+
+    if (val_len != sizeof(uint32_t))
+        ret = -EIO;
+    else {
+        get_u32(val, &num);
+        if (num != (uint32_t)num_shards) {
+            logMessage(LOG_ERR, __func__, "%s has %u shards, not %d.", 
+                       ldb_prefix, num, num_shards);
+            ret = -EINVAL;
+        }
+    }
+    Free(&val);
+
+    return ret;
+}
+
+// Route a partition to a shard by a hash of (dir_id, partition_id), so the
+// partitions of a directory are spread over all the shards.
+//
+struct LevelDB* leveldb_shard(int dir_id, int partition_id)
+{
+    uint64_t h = ((uint64_t)(uint32_t)dir_id << 32) | (uint32_t)partition_id;
+
+    // the 64-bit finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return &ldb_shards[h % ldb_num_shards];
+}
+
 /*
- * entry_type = {file, dir}
+ * entry_type = {file, dir, symlink}; the type bits of "mode" come from it.
  */
 int leveldb_create(struct LevelDB ldb, 
                    const int parent_dir_id, const int partition_id,
-                   ldb_obj_type_t obj_type, 
-                   const int obj_id, const char *obj_name, const char *real_path)
+                   ldb_obj_type_t obj_type, const int obj_id, 
+                   const char *obj_name, mode_t mode, const char *link)
 {
-    int ret_val = 0;
-    char *err = NULL;
-
-    char key[MAX_LEN] = {0};
-    char val[MAX_SIZE] = {0}; 
-    size_t key_len, val_len;
-
-    //FIXME: replace "obj_name" with hash(obj_name)
-    snprintf(key, strlen(key), 
-             "%d:%d:%s", parent_dir_id, partition_id, obj_name);
-    key_len = strlen(key);
+    char val[INODE_HEADER_SIZE + MAX_LEN]; 
+    struct ldb_entry entry;
 
+    mode &= ~S_IFMT;
     switch (obj_type) {
         case OBJ_DIR:
-            // FIXME: check for duplicates???
             assert(obj_id != -1);   // only dirs have an object id.
-            // FIXME: what is the correct "val"? statbuf? giga+?
-            snprintf(val, strlen(val), "%d:%s", obj_id, real_path);
-            val_len = strlen(val);
+            mode |= S_IFDIR;
             break;
-        case OBJ_FILE:
-            assert(obj_id == -1);
-            snprintf(val, strlen(val), "%s", real_path);
-            val_len = strlen(val);
+        case OBJ_SLINK:
+            assert(link != NULL);
+            mode |= S_IFLNK;
             break;
         default:
+            mode |= S_IFREG;
             break;
     }
-    
-    leveldb_put(ldb.db, ldb.woptions, key, key_len, val, val_len, &err);
-    CheckNoError(err);
-    
-    //XXX: create the file in the underlying file system using "val"
+    entry.name = (char*)obj_name;
+    entry.val = val;
+    entry.val_len = make_inode(val, mode, obj_id, 
+                               (obj_type == OBJ_SLINK) ? link : NULL);
 
-    return ret_val;
+    return write_entries(ldb, parent_dir_id, partition_id, &entry, 1, 
+                         WRITE_CREATE);
 }
 
 
@@ -133,31 +728,157 @@ int leveldb_lookup(struct LevelDB ldb,
     int ret_val = 0;
     char *err = NULL;
 
-    char key[MAX_LEN] = {0};
-    void *val; 
+    char key[MAX_KEY_SIZE];
+    char *val; 
     size_t key_len, val_len;
 
-    //FIXME: replace "obj_name" with hash(obj_name)
-    snprintf(key, strlen(key), 
-             "%d:%d:%s", parent_dir_id, partition_id, obj_name);
-    key_len = strlen(key);
+    key_len = make_key(key, parent_dir_id, partition_id, obj_name);
 
-    if ((val = (void *)malloc(MAX_SIZE)) == NULL) {
-        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
-        exit(1);
-    }
     val = leveldb_get(ldb.db, ldb.roptions, key, key_len, &val_len, &err);
-    CheckNoError(err);
+    if (err != NULL) {
+        logMessage(LOG_ERR, __func__, "get(%d:%d:%s) failed: %s", 
+                   parent_dir_id, partition_id, obj_name, err);
+        Free(&err);
+        return -EIO;
+    }
 
-    //TODO: put "val" in statbuf
-    stbuf = (struct stat*) val;
+    if (val == NULL)
+        ret_val = -ENOENT;
+    else if ((stbuf != NULL) && (read_inode(val, val_len, stbuf) < 0)) {
+        logMessage(LOG_ERR, __func__, "bad inode record for %d:%d:%s", 
+                   parent_dir_id, partition_id, obj_name);
+        ret_val = -EIO;
+    }
     
-    Free(val);
+    Free(&val);
 
     return ret_val;
 
 }
 
+// Read all the entries of a partition, using a prefix scan over its keys.
+//
+int leveldb_get_partition(struct LevelDB ldb, 
+                          const int parent_dir_id, const int partition_id,
+                          struct ldb_entry **entries, int *num_entries)
+{
+    char *err = NULL;
+    char prefix[KEY_PREFIX_SIZE];
+    size_t prefix_len;
+    struct ldb_entry *e = NULL;
+    int n = 0, len = 0;
+
+    prefix_len = make_prefix(prefix, parent_dir_id, partition_id);
+
+    leveldb_iterator_t *iter = leveldb_create_iterator(ldb.db, 
+                                                       ldb.scan_roptions);
+    for (leveldb_iter_seek(iter, prefix, prefix_len); 
+         leveldb_iter_valid(iter); leveldb_iter_next(iter)) {
+        size_t key_len, val_len;
+        const char *key = leveldb_iter_key(iter, &key_len);
+        if ((key_len < KEY_HEADER_SIZE) || 
+            (memcmp(key, prefix, prefix_len) != 0))
+            break;
+        const char *val = leveldb_iter_value(iter, &val_len);
+
+        if (n == len) {
+            len = (len > 0) ? len*2 : 64;
+            if ((e = realloc(e, len*sizeof(struct ldb_entry))) == NULL) {
+                logMessage(LOG_FATAL, __func__, 
+                           "malloc_err: %s", strerror(errno));
+                exit(1);
+            }
+        }
+        e[n].name = strndup(key+KEY_HEADER_SIZE, key_len-KEY_HEADER_SIZE);
+        e[n].val = malloc(val_len > 0 ? val_len : 1);
+        if ((e[n].name == NULL) || (e[n].val == NULL)) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        memcpy(e[n].val, val, val_len);
+        e[n].val_len = val_len;
+        n++;
+    }
+    leveldb_iter_get_error(iter, &err);
+    leveldb_iter_destroy(iter);
+
+    if (err != NULL) {
+        logMessage(LOG_ERR, __func__, "scan(%d:%d) failed: %s", 
+                   parent_dir_id, partition_id, err);
+        Free(&err);
+        leveldb_free_entries(e, n);
+        return -EIO;
+    }
+
+    *entries = e;
+    *num_entries = n;
+
+    return 0;
+}
+
+int leveldb_insert_entries(struct LevelDB ldb,
+                           const int parent_dir_id, const int partition_id,
+                           struct ldb_entry *entries, int num_entries)
+{
+    return write_entries(ldb, parent_dir_id, partition_id, 
+                         entries, num_entries, WRITE_PUT);
+}
+
+int leveldb_remove_entries(struct LevelDB ldb,
+                           const int parent_dir_id, const int partition_id,
+                           struct ldb_entry *entries, int num_entries)
+{
+    return write_entries(ldb, parent_dir_id, partition_id, 
+                         entries, num_entries, WRITE_DELETE);
+}
+
+void leveldb_free_entries(struct ldb_entry *entries, int num_entries)
+{
+    int i;
+
+    for (i = 0; i < num_entries; i++) {
+        free(entries[i].name);
+        free(entries[i].val);
+    }
+    free(entries);
+}
+
+int leveldb_put_dir_meta(struct LevelDB ldb, const int dir_id, 
+                         const char *name, const char *val, size_t val_len)
+{
+    struct ldb_entry entry;
+
+    entry.name = (char*)name;
+    entry.val = (char*)val;
+    entry.val_len = val_len;
+
+    return write_entries(ldb, dir_id, DIR_META_PARTITION, &entry, 1, 
+                         WRITE_PUT);
+}
+
+// Read the metadata "name" of "dir_id" into "*val" (free it with free()), or
+// return -ENOENT if it is not stored.
+//
+int leveldb_get_dir_meta(struct LevelDB ldb, const int dir_id, 
+                         const char *name, char **val, size_t *val_len)
+{
+    char *err = NULL;
+    char key[MAX_KEY_SIZE];
+    size_t key_len;
+
+    key_len = make_key(key, dir_id, DIR_META_PARTITION, name);
+
+    *val = leveldb_get(ldb.db, ldb.roptions, key, key_len, val_len, &err);
+    if (err != NULL) {
+        logMessage(LOG_ERR, __func__, "get(%d:%s) failed: %s", 
+                   dir_id, name, err);
+        Free(&err);
+        return -EIO;
+    }
+
+    return (*val == NULL) ? -ENOENT : 0;
+}
+
 /*
 void leveldb_mkdir(struct LevelDB ldb, int if_exists_flag)
 {
@@ -174,3 +895,123 @@ void leveldb_mkdir(struct LevelDB ldb, int if_exists_flag)
 }
 */
 
+
+#ifdef LEVELDB_BENCH
+
+// Throughput of the LevelDB backend with the tuning settings (and shards) of
+// the default conf file: "num_threads" threads create "num_ops" entries 
+// (create-heavy), then look all of them up (stat-heavy), and look up as many
+// names that don't exist. The shards are kept in "dir-<shard>"; start with 
+// new ones.
+//
+// Build (from backends/, after building common/):
+//   gcc -O2 -DLEVELDB_BENCH -iquote .. -o leveldb_bench
+//       leveldb_backend.c ../common.a ./leveldb/libleveldb.a -lpthread -lstdc++
+//   ./leveldb_bench dir [num_ops [num_threads]]
+//
+#include <sys/time.h>
+
+#define BENCH_NUM_THREADS   8
+#define BENCH_NUM_DIRS      64      // entries spread over dirs and partitions
+#define BENCH_NAME_LEN      64
+
+struct giga_options giga_options_t;       // (defined by server.h otherwise)
+
+struct bench_thread {
+    pthread_t tid;
+    int id;
+    int num_ops;
+    char phase;         // 'c' create, 's' stat, 'm' stat missing names
+    int errors;
+};
+
+static void* bench_worker(void *arg)
+{
+    struct bench_thread *t = (struct bench_thread*)arg;
+    char name[BENCH_NAME_LEN];
+    struct stat stbuf;
+    int i, ret;
+
+    for (i = 0; i < t->num_ops; i++) {
+        int dir_id = i % BENCH_NUM_DIRS;
+        int partition = (i / BENCH_NUM_DIRS) % 16;
+        struct LevelDB *ldb = leveldb_shard(dir_id, partition);
+
+        snprintf(name, sizeof(name), "%s-%d-%d", 
+                 (t->phase == 'm') ? "missing" : "f", t->id, i);
+        switch (t->phase) {
+            case 'c':
+                ret = leveldb_create(*ldb, dir_id, partition, OBJ_FILE,
+                                     -1, name, 0644, NULL);
+                break;
+            case 's':
+                ret = leveldb_lookup(*ldb, dir_id, partition, name, &stbuf);
+                break;
+            default:
+                ret = (leveldb_lookup(*ldb, dir_id, partition, name, 
+                                      &stbuf) == -ENOENT) ? 0 : -1;
+                break;
+        }
+        t->errors += (ret != 0);
+    }
+
+    return NULL;
+}
+
+static void bench_run(const char *what, char phase, 
+                      int num_ops, int num_threads)
+{
+    struct bench_thread threads[num_threads];
+    struct timeval start, end;
+    int i, errors = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < num_threads; i++) {
+        threads[i].id = i;
+        threads[i].num_ops = num_ops/num_threads;
+        threads[i].phase = phase;
+        threads[i].errors = 0;
+        pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        errors += threads[i].errors;
+    }
+    gettimeofday(&end, NULL);
+
+    double secs = (end.tv_sec - start.tv_sec) + 
+                  (end.tv_usec - start.tv_usec)/1e6;
+    printf("%-20s %8d ops %8.3f s %10.0f ops/sec (%d errors)\n", 
+           what, num_ops, secs, num_ops/secs, errors);
+}
+
+int main(int argc, char **argv)
+{
+    int num_ops = (argc > 2) ? atoi(argv[2]) : 1000000;
+    int num_threads = (argc > 3) ? atoi(argv[3]) : BENCH_NUM_THREADS;
+
+    if ((argc < 2) || (num_ops <= 0) || (num_threads <= 0)) {
+        fprintf(stderr, "usage: %s dir [num_ops [num_threads]]\n", argv[0]);
+        return 1;
+    }
+
+    logOpen(DEFAULT_LOG_FILE_LOCATIONs, LOG_ERR);
+    memset(&giga_options_t, 0, sizeof(struct giga_options));
+    initGIGAsetting(GIGA_SERVER, DEFAULT_CONF_FILE);
+
+    printf("%d threads, %d shards, bloom bits %d, cache %lu, "
+           "write buffer %lu, block size %d\n", num_threads, 
+           giga_options_t.ldb_shards, giga_options_t.ldb_bloom_bits, 
+           giga_options_t.ldb_cache_size, giga_options_t.ldb_write_buffer,
+           giga_options_t.ldb_block_size);
+    if (leveldb_init_shards(argv[1], giga_options_t.ldb_shards) < 0)
+        return 1;
+
+    bench_run("create", 'c', num_ops, num_threads);
+    bench_run("stat", 's', num_ops, num_threads);
+    bench_run("stat (missing)", 'm', num_ops, num_threads);
+
+    return 0;
+}
+
+#endif /* LEVELDB_BENCH */
@@ -5,6 +5,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "common/rpc_async.h"
+#include "common/rpc_giga.h"
+
 #include "./leveldb/include/leveldb/c.h"
 
 /*
@@ -24,20 +27,79 @@ int rpc_init();
 int rpc_getattr(int dir_id, const char *path, struct stat *statbuf);
 int rpc_mkdir(int dir_id, const char *path, mode_t mode);
 
+/*
+ * Asynchronous RPC operations: rpc_*_start() sends the call and returns, and
+ * rpc_op_finish() waits for the reply (re-sending the call if the client's 
+ * mapping was stale) and returns the result of the operation, so a thread 
+ * can have many operations in flight. "op", "path" and "stbuf" must stay 
+ * valid until rpc_op_finish() returns; if a start fails, it returns -errno 
+ * and "op" must not be finished.
+ */
+typedef enum rpc_op_type {
+    RPC_OP_GETATTR,
+    RPC_OP_MKDIR,
+    RPC_OP_CREATE               /* a regular file (only in batches) */
+} rpc_op_type_t;
+
+struct rpc_op {
+    rpc_op_type_t type;
+    struct giga_directory *dir;
+    const char *path;
+    mode_t mode;
+    struct stat *stbuf;
+    int retries;                /* -EAGAIN replies so far */
+    union {
+        giga_getattr_reply_t getattr;
+        giga_result_t mkdir;
+    } reply;
+    struct rpc_future future;
+};
+
+int rpc_getattr_start(struct rpc_op *op, 
+                      int dir_id, const char *path, struct stat *statbuf);
+int rpc_mkdir_start(struct rpc_op *op, 
+                    int dir_id, const char *path, mode_t mode);
+int rpc_op_finish(struct rpc_op *op);
+
+/*
+ * Batched operations on entries of one directory: rpc_batch() groups "ops"
+ * by the server of their entries, and sends each group in GIGA_RPC_BATCH 
+ * calls (all of them in flight at once); the operations that reached the 
+ * wrong server are grouped and sent again once the mapping is updated.
+ * Returns 0 once every operation has its result in "errnum" (and "stbuf",
+ * for a getattr), or -errno if the calls failed.
+ */
+struct rpc_batch_op {
+    rpc_op_type_t type;
+    const char *path;
+    mode_t mode;
+    struct stat *stbuf;
+    int errnum;
+};
+
+int rpc_batch(int dir_id, struct rpc_batch_op *ops, int num_ops);
+
 /*
  * LevelDB specific definitions
  */
 
+struct ldb_commit_queue;
+
 struct LevelDB {
     leveldb_t* db;              // DB instance
     leveldb_comparator_t* cmp;  // Compartor object that allows user-defined 
                                 // object comparions functions.
     leveldb_cache_t* cache;     // Cache object: If set, it enables caching of
-                                // individual blocks (of LDB files) using LRU.
+                                // individual blocks (of LDB files) using LRU;
+                                // shared by all the LevelDB handles.
+    leveldb_filterpolicy_t* filter; // Bloom filter of the keys (shared too),
+                                // so lookups of missing keys skip the disk.
     leveldb_env_t* env;
     leveldb_options_t* options;
     leveldb_readoptions_t* roptions;
+    leveldb_readoptions_t* scan_roptions;
     leveldb_writeoptions_t* woptions;
+    struct ldb_commit_queue* queue; // Group commit of concurrent mutations.
 };
 
 typedef enum LevelDB_obj_type {
@@ -47,16 +109,89 @@ typedef enum LevelDB_obj_type {
     OBJ_HLINK
 } ldb_obj_type_t;
 
-struct LevelDB ldb_mds;
+/* One entry of a directory partition (name and the value stored for it). */
+struct ldb_entry {
+    char *name;
+    char *val;
+    size_t val_len;
+};
+
+/* A server keeps its metadata in ldb_num_shards LevelDB instances (shards),
+ * opened by leveldb_init_shards() as "<ldb_prefix>-<shard>"; the entries of
+ * a partition (and the metadata of a directory, in DIR_META_PARTITION) are 
+ * all in the shard that leveldb_shard() routes the partition to. The number
+ * of shards is stored with them, and opening them with another number fails
+ * (with -EINVAL), since the partitions would be routed to other shards.
+ */
+extern struct LevelDB *ldb_shards;
+extern int ldb_num_shards;
+
+int leveldb_init_shards(const char *ldb_prefix, int num_shards);
+struct LevelDB* leveldb_shard(int dir_id, int partition_id);
 
-int leveldb_init(struct LevelDB level_db, const char *ldb_name);
+/* Each entry is stored with its inode record (mode, owner, size, times, 
+ * object id and symlink target): leveldb_create() writes it, with the 
+ * server's credentials and the current time, and leveldb_lookup() decodes 
+ * it into "stbuf" (if not NULL). "link" is the target of an OBJ_SLINK, and
+ * NULL otherwise; "obj_id" is -1 for entries without an object.
+ * leveldb_create() returns -EEXIST if the name is already in the partition,
+ * and both return -EIO if LevelDB fails.
+ */
+int leveldb_init(struct LevelDB *level_db, const char *ldb_name);
 int leveldb_lookup(struct LevelDB level_db, 
                    const int parent_dir_id, const int partition_id, 
                    const char *obj_name, struct stat *stbuf);
 int leveldb_create(struct LevelDB ldb, 
                    const int parent_dir_id, const int partition_id,
                    ldb_obj_type_t obj_type, const int obj_id, 
-                   const char *obj_name, const char *real_path);
+                   const char *obj_name, mode_t mode, const char *link);
+
+/* Partition-level operations, used to split partitions:
+ * - leveldb_get_partition() returns all entries of a partition (free them 
+ *   with leveldb_free_entries());
+ * - leveldb_insert_entries()/leveldb_remove_entries() add/remove entries of
+ *   a partition in one atomic write.
+ */
+int leveldb_get_partition(struct LevelDB ldb, 
+                          const int parent_dir_id, const int partition_id,
+                          struct ldb_entry **entries, int *num_entries);
+int leveldb_insert_entries(struct LevelDB ldb,
+                           const int parent_dir_id, const int partition_id,
+                           struct ldb_entry *entries, int num_entries);
+int leveldb_remove_entries(struct LevelDB ldb,
+                           const int parent_dir_id, const int partition_id,
+                           struct ldb_entry *entries, int num_entries);
+void leveldb_free_entries(struct ldb_entry *entries, int num_entries);
+
+/* Metadata of a directory (e.g., its GIGA+ mapping) is kept by name in 
+ * partition DIR_META_PARTITION, which no real partition uses; the partition
+ * operations above work on it too (e.g., to read all of it in one scan).
+ */
+#define DIR_META_PARTITION  -1
+
+int leveldb_put_dir_meta(struct LevelDB ldb, const int dir_id, 
+                         const char *name, const char *val, size_t val_len);
+int leveldb_get_dir_meta(struct LevelDB ldb, const int dir_id, 
+                         const char *name, char **val, size_t *val_len);
+
+/* Group commit: every mutation above is queued, and the first one in the
+ * queue (the leader) writes the mutations queued behind it in the same 
+ * write batch, up to ldb_group_max entries, while the others wait for it;
+ * mutations are synced per ldb_durability (see options.h). The stats count
+ * commits by log2 of their latency in usecs (bucket i has latencies below 
+ * 2^i, the last bucket the rest), and group writes by log2 of their entries.
+ */
+#define LDB_HIST_BUCKETS    24
+
+struct ldb_commit_stats {
+    unsigned long commits;                      /* mutations */
+    unsigned long writes;                       /* group writes */
+    unsigned long latency[LDB_HIST_BUCKETS];    /* commits, by usecs */
+    unsigned long group_size[LDB_HIST_BUCKETS]; /* writes, by entries */
+};
+
+void leveldb_get_commit_stats(struct LevelDB ldb, 
+                              struct ldb_commit_stats *stats);
 
 /*
 void leveldb_mkdir(struct LevelDB level_db, int if_exists_flag);
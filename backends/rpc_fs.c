@@ -6,6 +6,7 @@
 #include "common/options.h"
 #include "common/giga_index.h"
 #include "common/rpc_giga.h"
+#include "common/rpc_frame.h"
 
 #include "operations.h"
 
@@ -17,16 +18,49 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// Protocols (GIGA_PROTO_*) the servers serve to this client, as they told 
+// at rpc_init(): the asynchronous operations use binary frames if they can.
+//
+static int rpc_protocols = GIGA_PROTO_XDR;
+
 static 
 void update_client_mapping(struct giga_directory *dir, struct giga_mapping_t *map)
 {
+    pthread_mutex_lock(&dir->partition_mtx);
     giga_update_cache(&dir->mapping, map);
+    cache_publish_mapping(dir);
+    pthread_mutex_unlock(&dir->partition_mtx);
+}
+
+// A server answers -EAGAIN both to a stale mapping (fixed by the mapping in
+// its reply, so the first retry is immediate) and to a create in a partition 
+// that it is splitting (which takes a while), so later retries back off.
+//
+#define RETRY_BACKOFF_MIN   100         // usecs
+#define RETRY_BACKOFF_MAX   10000
+
+static
+void retry_backoff(int retries)
+{
+    if (retries > 0) {
+        int delay = RETRY_BACKOFF_MIN << ((retries < 8) ? retries-1 : 7);
+        usleep((delay < RETRY_BACKOFF_MAX) ? delay : RETRY_BACKOFF_MAX);
+    }
 }
 
 static 
 int get_server_for_file(struct giga_directory *dir, const char *name)
 {
-    return giga_get_server_for_file(&dir->mapping, name);
+    struct giga_mapping_t mapping;
+    unsigned int seq;
+    int server;
+
+    do {
+        seq = cache_read_begin(dir, &mapping);
+        server = giga_get_server_for_file(&mapping, name);
+    } while (cache_read_retry(dir, seq));
+
+    return server;
 }
 
 
@@ -36,18 +70,27 @@ int rpc_init()
     int server_id = 0;
 
     CLIENT *rpc_clnt = getConnection(server_id);
-    giga_result_t rpc_reply;
+    giga_init_reply_t rpc_reply;
     
+    if (rpc_clnt == NULL)
+        return -EIO;
+
     logMessage(LOG_TRACE, __func__, "RPC_init: start.");
 
-    if ((giga_rpc_init_1(giga_options_t.num_servers, &rpc_reply, rpc_clnt)) 
-         != RPC_SUCCESS) {
+    memset(&rpc_reply, 0, sizeof(rpc_reply));
+    if ((giga_rpc_init_4(giga_options_t.num_servers, 
+                         GIGA_PROTO_XDR | GIGA_PROTO_FRAMES, 
+                         &rpc_reply, rpc_clnt)) != RPC_SUCCESS) {
         logMessage(LOG_FATAL, __func__, "RPC_error: rpc_init failed."); 
         clnt_perror(rpc_clnt,"(rpc_init failed)");
         exit(1);//TODO: retry again?
     }
+    putConnection(server_id, rpc_clnt);
 
-    int errnum = rpc_reply.errnum;
+    // all servers run the same code as server-0
+    rpc_protocols = rpc_reply.protocols;
+
+    int errnum = rpc_reply.result.errnum;
     if (errnum == -EAGAIN) {
         int dir_id = 0; // update root server's bitmap
         struct giga_directory *dir = cache_fetch(&dir_id);
@@ -56,12 +99,15 @@ int rpc_init()
             ret = -EIO;
         }
         else {
-            update_client_mapping(dir, &rpc_reply.giga_result_t_u.bitmap); 
+            update_client_mapping(dir, 
+                                  &rpc_reply.result.giga_result_t_u.bitmap); 
+            cache_return(dir);
             ret = 0;
         }
     } else if (errnum < 0) {
         ret = errnum;
     }
+    xdr_free((xdrproc_t)xdr_giga_init_reply_t, (char *)&rpc_reply);
 
     logMessage(LOG_TRACE, __func__, "RPC_init: done.");
 
@@ -76,28 +122,37 @@ int rpc_getattr(int dir_ID, const char *path, struct stat *stbuf)
     struct giga_directory *dir = cache_fetch(&dir_id);
     if (dir == NULL) {
         logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
-        ret = -EIO;
+        return -EIO;
     }
     
     int server_id = 0;
+    int retries = 0;
     giga_getattr_reply_t rpc_reply;
 
 retry:
     server_id = get_server_for_file(dir, path);
     CLIENT *rpc_clnt = getConnection(server_id);
+    if (rpc_clnt == NULL) {
+        cache_return(dir);
+        return -EIO;
+    }
 
     logMessage(LOG_TRACE, __func__, "RPC_getattr: {%s->srv=%d}", path, server_id);
 
-    if (giga_rpc_getattr_1(dir_id, (char*)path, &rpc_reply, rpc_clnt) 
+    memset(&rpc_reply, 0, sizeof(rpc_reply));
+    if (giga_rpc_getattr_4(dir_id, (char*)path, &rpc_reply, rpc_clnt) 
         != RPC_SUCCESS) {
         logMessage(LOG_FATAL, __func__, "RPC_error: rpc_getattr failed."); 
         clnt_perror(rpc_clnt,"(rpc_getattr failed)");
         exit(1);//TODO: retry again?
     }
+    putConnection(server_id, rpc_clnt);
 
     int errnum = rpc_reply.result.errnum;
     if (errnum == -EAGAIN) {
         update_client_mapping(dir, &rpc_reply.result.giga_result_t_u.bitmap); 
+        xdr_free((xdrproc_t)xdr_giga_getattr_reply_t, (char *)&rpc_reply);
+        retry_backoff(retries++);
         goto retry;
     } else if (errnum < 0) {
         ret = errnum;
@@ -107,6 +162,8 @@ retry:
             logMessage(LOG_DEBUG, __func__, "getattr() stbuf is NULL!");
         ret = errnum;
     }
+    xdr_free((xdrproc_t)xdr_giga_getattr_reply_t, (char *)&rpc_reply);
+    cache_return(dir);
 
     logMessage(LOG_TRACE, __func__, "RPC_getattr: STATUS={%s}", strerror(ret));
     
@@ -121,34 +178,45 @@ int rpc_mkdir(int dir_ID, const char *path, mode_t mode)
     struct giga_directory *dir = cache_fetch(&dir_id);
     if (dir == NULL) {
         logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
-        ret = -EIO;
+        return -EIO;
     }
     
     int server_id = 0;
+    int retries = 0;
     giga_result_t rpc_reply;
 
 retry:
     server_id = get_server_for_file(dir, path);
     CLIENT *rpc_clnt = getConnection(server_id);
+    if (rpc_clnt == NULL) {
+        cache_return(dir);
+        return -EIO;
+    }
 
     logMessage(LOG_TRACE, __func__, "RPC_mkdir: {%s->srv=%d}", path, server_id);
 
-    if (giga_rpc_mkdir_1(dir_id, (char*)path, mode, &rpc_reply, rpc_clnt) 
+    memset(&rpc_reply, 0, sizeof(rpc_reply));
+    if (giga_rpc_mkdir_4(dir_id, (char*)path, mode, &rpc_reply, rpc_clnt) 
         != RPC_SUCCESS) {
         logMessage(LOG_FATAL, __func__, "RPC_error: rpc_mkdir failed."); 
         clnt_perror(rpc_clnt,"(rpc_getattr failed)");
         exit(1);//TODO: retry again?
     }
+    putConnection(server_id, rpc_clnt);
 
     int errnum = rpc_reply.errnum;
     if (errnum == -EAGAIN) {
         update_client_mapping(dir, &rpc_reply.giga_result_t_u.bitmap); 
+        xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&rpc_reply);
+        retry_backoff(retries++);
         goto retry;
     } else if (errnum < 0) {
         ret = errnum;
     } else {
         ret = 0;
     }
+    xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&rpc_reply);
+    cache_return(dir);
 
     logMessage(LOG_TRACE, __func__, "RPC_mkdir: {status=%s}", strerror(ret));
     
@@ -156,6 +224,367 @@ retry:
     
 }
 
+static 
+void free_op_reply(struct rpc_op *op)
+{
+    if (op->type == RPC_OP_GETATTR)
+        xdr_free((xdrproc_t)xdr_giga_getattr_reply_t, (char *)&op->reply.getattr);
+    else
+        xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&op->reply.mkdir);
+}
+
+// decode the reply frame of "op" into the same result as the XDR reply
+static 
+int decode_op_reply(void *arg, const char *buf, size_t len)
+{
+    struct rpc_op *op = (struct rpc_op*)arg;
+
+    if (op->type == RPC_OP_GETATTR)
+        return giga_frame_get_reply(buf, len, &op->reply.getattr.result,
+                                    &op->reply.getattr.statbuf);
+    else
+        return giga_frame_get_reply(buf, len, &op->reply.mkdir, NULL);
+}
+
+static 
+int send_op(struct rpc_op *op)
+{
+    int ret;
+    int server_id = get_server_for_file(op->dir, op->path);
+    struct rpc_async_conn *conn = getAsyncConnection(server_id);
+    if (conn == NULL)
+        return -EIO;
+
+    LOG_MSG(LOG_TRACE, "RPC_op(%d): {%s->srv=%d}", 
+            op->type, op->path, server_id);
+
+    memset(&op->reply, 0, sizeof(op->reply));
+    rpc_future_init(&op->future);
+
+    if (rpc_protocols & GIGA_PROTO_FRAMES) {
+        char frame[GIGA_FRAME_HDR_SIZE + GIGA_FRAME_CALL_SIZE + MAX_LEN];
+        size_t len = GIGA_FRAME_HDR_SIZE + giga_frame_call_size(op->path);
+
+        if (len > sizeof(frame)) {
+            ret = -ENAMETOOLONG;
+        }
+        else {
+            giga_frame_put_call(frame + GIGA_FRAME_HDR_SIZE,
+                                (op->type == RPC_OP_GETATTR) ? 
+                                GIGA_RPC_GETATTR : GIGA_RPC_MKDIR,
+                                op->dir->handle, op->path, op->mode);
+            ret = rpc_async_frame_call(conn, frame, len, decode_op_reply, op,
+                                       rpc_future_complete, &op->future);
+        }
+    }
+    else if (op->type == RPC_OP_GETATTR) {
+        giga_rpc_getattr_4_argument args;
+        args.arg1 = op->dir->handle;
+        args.arg2 = (char*)op->path;
+        ret = rpc_async_call(conn, GIGA_RPC_GETATTR,
+                             (xdrproc_t)xdr_giga_rpc_getattr_4_argument, &args,
+                             (xdrproc_t)xdr_giga_getattr_reply_t, 
+                             &op->reply.getattr,
+                             rpc_future_complete, &op->future);
+    }
+    else {
+        giga_rpc_mkdir_4_argument args;
+        args.arg1 = op->dir->handle;
+        args.arg2 = (char*)op->path;
+        args.arg3 = op->mode;
+        ret = rpc_async_call(conn, GIGA_RPC_MKDIR,
+                             (xdrproc_t)xdr_giga_rpc_mkdir_4_argument, &args,
+                             (xdrproc_t)xdr_giga_result_t, &op->reply.mkdir,
+                             rpc_future_complete, &op->future);
+    }
+    putAsyncConnection(conn);
+
+    if (ret < 0)
+        rpc_future_destroy(&op->future);
+
+    return ret;
+}
+
+static 
+int start_op(struct rpc_op *op, rpc_op_type_t type, int dir_ID, 
+             const char *path, mode_t mode, struct stat *stbuf)
+{
+    int dir_id = dir_ID;
+    struct giga_directory *dir = cache_fetch(&dir_id);
+    if (dir == NULL) {
+        logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
+        return -EIO;
+    }
+
+    op->type = type;
+    op->dir = dir;
+    op->path = path;
+    op->mode = mode;
+    op->stbuf = stbuf;
+    op->retries = 0;
+
+    int ret = send_op(op);
+    if (ret < 0)
+        cache_return(dir);
+
+    return ret;
+}
+
+int rpc_getattr_start(struct rpc_op *op, 
+                      int dir_id, const char *path, struct stat *stbuf)
+{
+    return start_op(op, RPC_OP_GETATTR, dir_id, path, 0, stbuf);
+}
+
+int rpc_mkdir_start(struct rpc_op *op, 
+                    int dir_id, const char *path, mode_t mode)
+{
+    return start_op(op, RPC_OP_MKDIR, dir_id, path, mode, NULL);
+}
+
+int rpc_op_finish(struct rpc_op *op)
+{
+    int ret;
+
+retry:
+    ret = rpc_future_wait(&op->future);
+    rpc_future_destroy(&op->future);
+    if (ret < 0) {
+        logMessage(LOG_ERR, __func__, "RPC_error: op(%d) on %s failed.", 
+                   op->type, op->path); 
+        free_op_reply(op);
+        cache_return(op->dir);
+        return ret;
+    }
+
+    giga_result_t *result = (op->type == RPC_OP_GETATTR) ? 
+                            &op->reply.getattr.result : &op->reply.mkdir;
+    int errnum = result->errnum;
+    if (errnum == -EAGAIN) {
+        update_client_mapping(op->dir, &result->giga_result_t_u.bitmap); 
+        free_op_reply(op);
+        // re-sent from the caller's thread, not from the connection's reader
+        retry_backoff(op->retries++);
+        if ((ret = send_op(op)) == 0)
+            goto retry;
+        cache_return(op->dir);
+        return ret;
+    } else if (errnum < 0) {
+        ret = errnum;
+    } else {
+        if (op->type == RPC_OP_GETATTR)
+            *op->stbuf = op->reply.getattr.statbuf;
+        ret = 0;
+    }
+    free_op_reply(op);
+    cache_return(op->dir);
+
+    LOG_MSG(LOG_TRACE, "RPC_op(%d): {status=%s}", op->type, strerror(ret));
+
+    return ret;
+}
+
+// One GIGA_RPC_BATCH call of rpc_batch(), with operations "idx[0..num)".
+//
+struct batch_call {
+    int server;
+    int *idx;
+    int num;
+    giga_batch_op_t *args;
+    giga_batch_reply_t reply;
+    struct rpc_future future;
+};
+
+static 
+int batch_op_code(rpc_op_type_t type)
+{
+    switch (type) {
+        case RPC_OP_GETATTR:
+            return GIGA_BATCH_GETATTR;
+        case RPC_OP_MKDIR:
+            return GIGA_BATCH_MKDIR;
+        default:
+            return GIGA_BATCH_CREATE;
+    }
+}
+
+static 
+int send_batch(struct giga_directory *dir, struct batch_call *call, 
+               struct rpc_batch_op *ops)
+{
+    giga_rpc_batch_4_argument args;
+    int i, ret;
+
+    struct rpc_async_conn *conn = getAsyncConnection(call->server);
+    if (conn == NULL)
+        return -EIO;
+
+    LOG_MSG(LOG_TRACE, "RPC_batch: {%d ops->srv=%d}", 
+            call->num, call->server);
+
+    for (i = 0; i < call->num; i++) {
+        struct rpc_batch_op *op = &ops[call->idx[i]];
+        call->args[i].op = batch_op_code(op->type);
+        call->args[i].path = (char*)op->path;
+        call->args[i].mode = op->mode;
+    }
+    args.arg1 = dir->handle;
+    args.arg2.giga_batch_ops_len = call->num;
+    args.arg2.giga_batch_ops_val = call->args;
+
+    memset(&call->reply, 0, sizeof(call->reply));
+    rpc_future_init(&call->future);
+    ret = rpc_async_call(conn, GIGA_RPC_BATCH,
+                         (xdrproc_t)xdr_giga_rpc_batch_4_argument, &args,
+                         (xdrproc_t)xdr_giga_batch_reply_t, &call->reply,
+                         rpc_future_complete, &call->future);
+    putAsyncConnection(conn);
+
+    if (ret < 0)
+        rpc_future_destroy(&call->future);
+
+    return ret;
+}
+
+// Wait for the reply of "call", and record the results of its operations;
+// the ones that reached the wrong server are added to "pending".
+//
+static 
+int finish_batch(struct giga_directory *dir, struct batch_call *call, 
+                 struct rpc_batch_op *ops, int *pending, int *num_pending)
+{
+    giga_batch_reply_t *reply = &call->reply;
+    int i, ret;
+
+    ret = rpc_future_wait(&call->future);
+    rpc_future_destroy(&call->future);
+    if ((ret == 0) && ((int)reply->results.results_len != call->num))
+        ret = -EIO;
+    if (ret < 0) {
+        logMessage(LOG_ERR, __func__, "RPC_error: batch to server-%d failed.",
+                   call->server);
+        xdr_free((xdrproc_t)xdr_giga_batch_reply_t, (char *)reply);
+        return ret;
+    }
+
+    for (i = 0; i < call->num; i++) {
+        struct rpc_batch_op *op = &ops[call->idx[i]];
+        giga_batch_result_t *result = &reply->results.results_val[i];
+
+        if (result->errnum == -EAGAIN) {
+            pending[(*num_pending)++] = call->idx[i];
+            continue;
+        }
+        op->errnum = result->errnum;
+        if ((op->type == RPC_OP_GETATTR) && (op->errnum == 0) && 
+            (result->statbuf != NULL))
+            *op->stbuf = *result->statbuf;
+    }
+    if (reply->bitmap != NULL)
+        update_client_mapping(dir, reply->bitmap);
+    xdr_free((xdrproc_t)xdr_giga_batch_reply_t, (char *)reply);
+
+    return 0;
+}
+
+static 
+void* batch_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    return ptr;
+}
+
+int rpc_batch(int dir_ID, struct rpc_batch_op *ops, int num_ops)
+{
+    int dir_id = dir_ID;
+    struct giga_directory *dir = cache_fetch(&dir_id);
+    if (dir == NULL) {
+        logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
+        return -EIO;
+    }
+
+    int num_servers = giga_options_t.num_servers;
+    int max_calls = num_servers + num_ops/GIGA_BATCH_MAX;
+    int *pending = batch_alloc(num_ops*sizeof(int));
+    int *sorted = batch_alloc(num_ops*sizeof(int));
+    int *servers = batch_alloc(num_ops*sizeof(int));
+    int *first = batch_alloc((num_servers+1)*sizeof(int));
+    giga_batch_op_t *args = batch_alloc(num_ops*sizeof(giga_batch_op_t));
+    struct batch_call *calls = batch_alloc(max_calls*sizeof(struct batch_call));
+    struct giga_mapping_t mapping;
+    unsigned int seq;
+    int num_pending = num_ops;
+    int retries = 0;
+    int ret = 0;
+    int i, s;
+
+    for (i = 0; i < num_ops; i++)
+        pending[i] = i;
+
+    while ((num_pending > 0) && (ret == 0)) {
+        // (1): find the servers of the pending operations, with one mapping
+        do {
+            seq = cache_read_begin(dir, &mapping);
+            for (i = 0; i < num_pending; i++)
+                servers[pending[i]] = 
+                    giga_get_server_for_file(&mapping, ops[pending[i]].path);
+        } while (cache_read_retry(dir, seq));
+
+        // (2): group them by server (keeping their order)
+        memset(first, 0, (num_servers+1)*sizeof(int));
+        for (i = 0; i < num_pending; i++)
+            first[servers[pending[i]] + 1]++;
+        for (s = 0; s < num_servers; s++)
+            first[s+1] += first[s];
+        for (i = 0; i < num_pending; i++)
+            sorted[first[servers[pending[i]]]++] = pending[i];
+
+        // (3): send a call per server (and per GIGA_BATCH_MAX operations),
+        // and collect the replies once all of them are in flight
+        int num_calls = 0, pos = 0;
+        while ((pos < num_pending) && (ret == 0)) {
+            struct batch_call *call = &calls[num_calls];
+            call->server = servers[sorted[pos]];
+            call->idx = &sorted[pos];
+            call->args = &args[pos];
+            call->num = 0;
+            while ((pos < num_pending) && (call->num < GIGA_BATCH_MAX) &&
+                   (servers[sorted[pos]] == call->server)) {
+                call->num++;
+                pos++;
+            }
+            if ((ret = send_batch(dir, call, ops)) == 0)
+                num_calls++;
+        }
+
+        num_pending = 0;
+        for (i = 0; i < num_calls; i++) {
+            int err = finish_batch(dir, &calls[i], ops, pending, &num_pending);
+            if (ret == 0)
+                ret = err;
+        }
+        if (num_pending > 0)
+            retry_backoff(retries++);
+    }
+
+    free(pending);
+    free(sorted);
+    free(servers);
+    free(first);
+    free(args);
+    free(calls);
+    cache_return(dir);
+
+    LOG_MSG(LOG_TRACE, "RPC_batch: {%d ops, status=%s}", 
+            num_ops, strerror(-ret));
+
+    return ret;
+}
+
 /*
 int local_symlink(const char *path, const char *link)
 {
@@ -242,3 +671,177 @@ int local_mknod(const char *path, mode_t mode, dev_t dev)
     return ret;
 }
 */
+
+#ifdef RPC_FS_BENCH
+
+// Throughput of metadata operations against running servers (listed in the
+// default conf file): "num_threads" threads create and then stat "num_ops" 
+// entries of the root directory, first one call at a time with the
+// synchronous operations, then with up to "window" asynchronous operations 
+// in flight per thread (sent in XDR, and then in binary frames if the 
+// servers serve them), and finally in batches of "window" operations.
+//
+// Build (from backends/, after building common/):
+//   gcc -O2 -DRPC_FS_BENCH -iquote .. -o rpc_fs_bench
+//       rpc_fs.c ../common.a -lpthread
+//   ./rpc_fs_bench [num_ops [num_threads [window]]]
+//
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#define BENCH_NUM_THREADS   4
+#define BENCH_WINDOW        256
+#define BENCH_NAME_LEN      64
+
+static int bench_num_threads = BENCH_NUM_THREADS;
+static int bench_window = BENCH_WINDOW;
+
+struct bench_thread {
+    pthread_t tid;
+    int id;
+    int num_ops;
+    char phase;         // 's' sync, 'a' async ('x' in XDR), 'b' batched
+    int mkdir;          // mkdir or getattr
+    int errors;
+};
+
+static int bench_op_start(struct bench_thread *t, struct rpc_op *op, 
+                          char *name, int i, struct stat *stbuf)
+{
+    snprintf(name, BENCH_NAME_LEN, "%c-%d-%d", t->phase, t->id, i);
+    if (t->mkdir)
+        return rpc_mkdir_start(op, 0, name, 0755);
+    else
+        return rpc_getattr_start(op, 0, name, stbuf);
+}
+
+static void* bench_worker(void *arg)
+{
+    struct bench_thread *t = (struct bench_thread*)arg;
+    struct rpc_op *ops = calloc(bench_window, sizeof(struct rpc_op));
+    struct rpc_batch_op *batch = 
+        calloc(bench_window, sizeof(struct rpc_batch_op));
+    char (*names)[BENCH_NAME_LEN] = malloc(bench_window*BENCH_NAME_LEN);
+    struct stat *stbufs = malloc(bench_window*sizeof(struct stat));
+    int *started = calloc(bench_window, sizeof(int));
+    int i, w;
+
+    if (!ops || !batch || !names || !stbufs || !started) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0; i < t->num_ops; i++) {
+        if (t->phase == 'b') {
+            w = i % bench_window;
+            snprintf(names[w], BENCH_NAME_LEN, "b-%d-%d", t->id, i);
+            batch[w].type = t->mkdir ? RPC_OP_MKDIR : RPC_OP_GETATTR;
+            batch[w].path = names[w];
+            batch[w].mode = 0755;
+            batch[w].stbuf = &stbufs[w];
+            if ((w < bench_window-1) && (i < t->num_ops-1))
+                continue;
+            if (rpc_batch(0, batch, w+1) < 0)
+                t->errors += w+1;
+            else
+                for (; w >= 0; w--)
+                    t->errors += (batch[w].errnum != 0);
+            continue;
+        }
+        if (t->phase == 's') {
+            snprintf(names[0], BENCH_NAME_LEN, "s-%d-%d", t->id, i);
+            if ((t->mkdir ? rpc_mkdir(0, names[0], 0755) :
+                            rpc_getattr(0, names[0], &stbufs[0])) != 0)
+                t->errors++;
+            continue;
+        }
+        w = i % bench_window;
+        if (started[w] && rpc_op_finish(&ops[w]) != 0)
+            t->errors++;
+        started[w] = (bench_op_start(t, &ops[w], names[w], i, &stbufs[w]) == 0);
+        if (!started[w])
+            t->errors++;
+    }
+    for (w = 0; w < bench_window; w++)
+        if (started[w] && rpc_op_finish(&ops[w]) != 0)
+            t->errors++;
+
+    free(ops);
+    free(batch);
+    free(names);
+    free(stbufs);
+    free(started);
+    return NULL;
+}
+
+static void bench_run(const char *what, char phase, int mkdir, int num_ops)
+{
+    struct bench_thread threads[bench_num_threads];
+    struct timeval start, end;
+    int i, errors = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < bench_num_threads; i++) {
+        threads[i].id = i;
+        threads[i].num_ops = num_ops/bench_num_threads;
+        threads[i].phase = phase;
+        threads[i].mkdir = mkdir;
+        threads[i].errors = 0;
+        pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+    }
+    for (i = 0; i < bench_num_threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        errors += threads[i].errors;
+    }
+    gettimeofday(&end, NULL);
+
+    double secs = (end.tv_sec - start.tv_sec) + 
+                  (end.tv_usec - start.tv_usec)/1e6;
+    printf("%-20s %8d ops %8.3f s %10.0f ops/sec (%d errors)\n", 
+           what, num_ops, secs, num_ops/secs, errors);
+}
+
+int main(int argc, char **argv)
+{
+    int num_ops = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    if (argc > 2)
+        bench_num_threads = atoi(argv[2]);
+    if (argc > 3)
+        bench_window = atoi(argv[3]);
+    if ((num_ops <= 0) || (bench_num_threads <= 0) || (bench_window <= 0)) {
+        fprintf(stderr, "usage: %s [num_ops [num_threads [window]]]\n", 
+                argv[0]);
+        return 1;
+    }
+    printf("%d threads, window of %d async operations per thread\n",
+           bench_num_threads, bench_window);
+
+    logOpen(DEFAULT_LOG_FILE_LOCATIONc, LOG_ERR);
+    memset(&giga_options_t, 0, sizeof(struct giga_options));
+    initGIGAsetting(GIGA_CLIENT, DEFAULT_CONF_FILE);
+
+    if (rpcConnect() < 0 || rpc_init() < 0) {
+        fprintf(stderr, "unable to connect to the servers\n");
+        return 1;
+    }
+
+    bench_run("sync mkdir", 's', 1, num_ops);
+    bench_run("sync getattr", 's', 0, num_ops);
+    if (rpc_protocols & GIGA_PROTO_FRAMES) {
+        rpc_protocols &= ~GIGA_PROTO_FRAMES;
+        bench_run("async mkdir (xdr)", 'x', 1, num_ops);
+        bench_run("async getattr (xdr)", 'x', 0, num_ops);
+        rpc_protocols |= GIGA_PROTO_FRAMES;
+    }
+    bench_run("async mkdir", 'a', 1, num_ops);
+    bench_run("async getattr", 'a', 0, num_ops);
+    bench_run("batch mkdir", 'b', 1, num_ops);
+    bench_run("batch getattr", 'b', 0, num_ops);
+
+    rpcDisconnect();
+    return 0;
+}
+
+#endif /* RPC_FS_BENCH */
@@ -64,7 +64,6 @@ int main(int argc, char *argv[])
     fuse_opt_insert_arg(&args, 1, "-omax_write=524288");
     if ( getpid() == 0 )
         fuse_opt_insert_arg( &args, 1, "-oallow_other" );
-    fuse_opt_insert_arg(&args, 1, "-s");
 
     ret = fuse_main(args.argc, args.argv, &giga_oper, NULL);
 
@@ -7,27 +7,90 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-/* FIXME: this file is not thread safe */
-static struct giga_directory *dircache = NULL;
+/* The cache is split into shards, each a hash table with its own lock, so
+ * lookups of different directories rarely contend.  Directories are found 
+ * under the shard lock, but the mapping itself is read without any lock 
+ * (see cache_read_begin()). */
+#define CACHE_SHARD_BITS    6
+#define CACHE_SHARDS        (1 << CACHE_SHARD_BITS)
 
-/*
-static 
-void fill_bitmap(struct giga_mapping_t *mapping, DIR_handle_t *handle)
+/* Each shard keeps (cache_size / CACHE_SHARDS) bytes of directories, and 
+ * evicts with CLOCK: the hand sweeps the shard's directories (in insertion
+ * order), skipping those in use and clearing the referenced bit of the 
+ * others, until it finds one that wasn't used since the last sweep. */
+struct cache_shard {
+    pthread_mutex_t lock;
+    struct giga_directory *dirs;
+    struct giga_directory *hand;    /* next directory the CLOCK looks at */
+    size_t bytes;                   /* atomic; memory of its directories */
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long loads;
+    unsigned long evictions;
+} __attribute__((aligned(64)));
+
+static struct cache_shard dircache[CACHE_SHARDS] = {
+    [0 ... CACHE_SHARDS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static struct cache_store dirstore;
+
+/* Bitmap of a published mapping.  Readers may still be using a bitmap after
+ * it is replaced by a larger one, so replaced bitmaps are chained from the 
+ * new one and freed with the directory; the bitmap only grows by doubling, 
+ * which bounds the chain to the size of the current bitmap. */
+struct cache_bmap {
+    struct cache_bmap *replaced;
+    unsigned int cap;
+    bitmap_t words[];
+};
+
+static
+struct cache_shard* get_shard(DIR_handle_t *handle)
 {
-    (void)mapping;
-    (void)handle;
+    unsigned int h = (unsigned int)*handle * 2654435761u;
+    return &dircache[h >> (32 - CACHE_SHARD_BITS)];
+}
 
-    if (handle == NULL)
-        printf("dosomething");
-        //TODO: get bitmap from disk
+/* Memory of a directory, with its bitmaps and split state. */
+static
+size_t directory_bytes(struct giga_directory *dir)
+{
+    size_t bytes = sizeof(*dir) + dir->mapping.bitmap_len*sizeof(bitmap_t) +
+                   dir->partition_size_len*sizeof(int);
+    struct cache_bmap *b;
 
+    for (b = dir->view_bmap; b != NULL; b = b->replaced)
+        bytes += sizeof(*b) + b->cap*sizeof(bitmap_t);
+
+    return bytes;
+}
+
+static
+void free_directory(struct giga_directory *dir)
+{
+    struct cache_bmap *b, *next;
+
+    for (b = dir->view_bmap; b != NULL; b = next) {
+        next = b->replaced;
+        free(b);
+    }
+    giga_free_mapping(&dir->mapping);
+    pthread_mutex_destroy(&dir->partition_mtx);
+    pthread_cond_destroy(&dir->split_cond);
+    free(dir->partition_size);
+    free(dir);
 }
-*/
 
 static 
-struct giga_directory* new_directory(DIR_handle_t *handle)
+struct giga_directory* new_directory(struct cache_shard *shard,
+                                     DIR_handle_t *handle)
 {
     struct giga_directory *dir = malloc(sizeof(struct giga_directory));
     if (!dir) {
@@ -37,45 +100,150 @@ struct giga_directory* new_directory(DIR_handle_t *handle)
 
     memcpy(&dir->handle, handle, sizeof(DIR_handle_t));
     
-    int zeroth_srv = 0; //FIXME: how do you get zeroth server info?
+    int zeroth_srv = giga_get_zeroth_server(*handle, 
+                                            giga_options_t.num_servers);
     
     // FIXME: what should flag be?
     giga_init_mapping(&dir->mapping, -1, zeroth_srv, giga_options_t.num_servers);
+    if (giga_hash_supported(giga_options_t.name_hash))
+        dir->mapping.hash_type = giga_options_t.name_hash;
+    if (giga_set_split_policy(&dir->mapping, giga_options_t.split_type, 
+                              giga_options_t.split_bound) < 0) {
+        giga_free_mapping(&dir->mapping);
+        free(dir);
+        return NULL;
+    }
     dir->refcount = 1;
+    dir->referenced = 0;
+    dir->dirty = 0;
+    dir->cache_bytes = 0;
 
-    HASH_ADD(hh, dircache, handle, sizeof(DIR_handle_t), dir);
+    dir->view_seq = 0;
+    memset(&dir->view, 0, sizeof(dir->view));
+    dir->view_bmap = NULL;
 
-    //TODO: get biubitmap from disk???
-    //fill_bitmap(&(dir->mapping), handle);
-   
-    logMessage(LOG_TRACE, __func__, "Cache_CREATE: dir(%d)", *handle);
+    pthread_mutex_init(&dir->partition_mtx, NULL);
+    pthread_cond_init(&dir->split_cond, NULL);
+    dir->split_index = -1;
+    dir->split_queued = 0;
+    dir->create_epoch = 0;
+    dir->creates[0] = dir->creates[1] = 0;
+    dir->partition_size = NULL;
+    dir->partition_size_len = 0;
+
+    // reload the directory if it was evicted (or the server restarted)
+    int ret = dirstore.load ? dirstore.load(dir) : -ENOENT;
+    if ((ret < 0) && (ret != -ENOENT)) {
+        logMessage(LOG_ERR, __func__, 
+                   "loading dir(%d) failed: %s", *handle, strerror(-ret));
+        free_directory(dir);
+        return NULL;
+    }
+    if (ret == 0)
+        shard->loads++;
+
+    cache_publish_mapping(dir);
+    dir->dirty = 0;
+
+    HASH_ADD(hh, shard->dirs, handle, sizeof(DIR_handle_t), dir);
+
+    LOG_MSG(LOG_TRACE, "Cache_CREATE: dir(%d)", *handle);
 
     return dir;
 }
 
+/* Evict directories until the shard is within its budget; only directories
+ * that nobody references, and that are stored if dirty, can be evicted. */
+static
+void evict_directories(struct cache_shard *shard)
+{
+    size_t budget = giga_options_t.cache_size / CACHE_SHARDS;
+    unsigned int sweep = 2 * HASH_COUNT(shard->dirs);
+    struct giga_directory *dir;
+
+    if (giga_options_t.cache_size == 0)
+        return;
+
+    while ((shard->bytes > budget) && (sweep-- > 0)) {
+        if ((dir = shard->hand) == NULL)
+            dir = shard->dirs;
+        shard->hand = dir->hh.next;
+
+        if (dir->refcount > 1)
+            continue;
+        if (dir->referenced) {
+            dir->referenced = 0;
+            continue;
+        }
+        if (dir->dirty && dirstore.store && (dirstore.store(dir) < 0))
+            continue;
+
+        LOG_MSG(LOG_TRACE, "Cache_EVICT: dir(%d)", dir->handle);
+
+        HASH_DEL(shard->dirs, dir);
+        __sync_fetch_and_sub(&shard->bytes, dir->cache_bytes);
+        shard->evictions++;
+        free_directory(dir);
+    }
+}
+
 int cache_init()
 {
    return 0; 
 }
 
+void cache_set_store(const struct cache_store *store)
+{
+    dirstore = *store;
+}
+
+void cache_get_stats(struct cache_stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        struct cache_shard *shard = &dircache[i];
+
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->loads += shard->loads;
+        stats->evictions += shard->evictions;
+        stats->dirs += HASH_COUNT(shard->dirs);
+        stats->bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
 struct giga_directory* cache_fetch(DIR_handle_t *handle)
 {
     struct giga_directory *dir = NULL;
+    struct cache_shard *shard = get_shard(handle);
 
-    HASH_FIND(hh, dircache, handle, sizeof(DIR_handle_t), dir);
+    pthread_mutex_lock(&shard->lock);
+
+    HASH_FIND(hh, shard->dirs, handle, sizeof(DIR_handle_t), dir);
 
     if (!dir) {
-        logMessage(LOG_DEBUG, __func__, "Cache_MISS: dir(%d)", *handle); 
-        if ((dir = new_directory(handle)) == NULL) {
-            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        LOG_MSG(LOG_DEBUG, "Cache_MISS: dir(%d)", *handle); 
+        shard->misses++;
+        if ((dir = new_directory(shard, handle)) == NULL) {
+            pthread_mutex_unlock(&shard->lock);
+            logMessage(LOG_FATAL, __func__, "Cache_CREATE(%d) failed", *handle);
             return NULL;
         }
+        __sync_fetch_and_add(&dir->refcount, 1);
+        evict_directories(shard);
+    }
+    else {
+        LOG_MSG(LOG_DEBUG, "Cache_HIT: dir(%d)\n", *handle); 
+        shard->hits++;
+        dir->referenced = 1;
+        __sync_fetch_and_add(&dir->refcount, 1);
     }
-    else
-        logMessage(LOG_DEBUG, __func__, "Cache_HIT: dir(%d)\n", *handle); 
-
 
-    dir->refcount++;
+    pthread_mutex_unlock(&shard->lock);
 
     return dir;
 }
@@ -83,19 +251,105 @@ struct giga_directory* cache_fetch(DIR_handle_t *handle)
 void cache_return(struct giga_directory *dir)
 {
     assert(dir->refcount > 0);
-    dir->refcount--;
+
+    /* the cache's own reference is only dropped by cache_destroy() */
+    if (__sync_sub_and_fetch(&dir->refcount, 1) == 0)
+        free_directory(dir);
 }
 
 /* when an object is deleted */
 void cache_destroy(struct giga_directory *dir)
 {
+    struct cache_shard *shard = get_shard(&dir->handle);
+
     assert(dir->refcount > 1);
 
-    /* once to release from the caller */
-    __sync_fetch_and_sub(&dir->refcount, 1);
+    pthread_mutex_lock(&shard->lock);
+    if (shard->hand == dir)
+        shard->hand = dir->hh.next;
+    HASH_DEL(shard->dirs, dir);
+    __sync_fetch_and_sub(&shard->bytes, dir->cache_bytes);
+    pthread_mutex_unlock(&shard->lock);
 
-    HASH_DEL(dircache, dir);
+    /* once to release from the caller, and once for the cache */
+    if (__sync_sub_and_fetch(&dir->refcount, 2) == 0)
+        free_directory(dir);
+}
 
-    if (__sync_sub_and_fetch(&dir->refcount, 1) == 0)
-        free(dir);
+/* Seqlock writer: the sequence number is odd while the view changes, and 
+ * the release fences order it against the changes. */
+void cache_publish_mapping(struct giga_directory *dir)
+{
+    struct giga_mapping_t *mapping = &dir->mapping;
+    struct cache_bmap *bmap = dir->view_bmap;
+    unsigned int seq = dir->view_seq;
+    unsigned int old_len = dir->view.bitmap_len;
+
+    __atomic_store_n(&dir->view_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if ((bmap == NULL) || (bmap->cap < mapping->bitmap_len)) {
+        unsigned int cap = bmap ? bmap->cap * 2 : 1;
+        while (cap < mapping->bitmap_len)
+            cap *= 2;
+
+        struct cache_bmap *b = malloc(sizeof(*b) + cap*sizeof(bitmap_t));
+        if (b == NULL) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        b->replaced = bmap;
+        b->cap = cap;
+        memset(b->words, 0, cap*sizeof(bitmap_t));
+        memcpy(b->words, mapping->bitmap, mapping->bitmap_len*sizeof(bitmap_t));
+
+        __atomic_store_n(&dir->view_bmap, b, __ATOMIC_RELEASE);
+        bmap = b;
+    }
+    else {
+        memcpy(bmap->words, mapping->bitmap, 
+               mapping->bitmap_len*sizeof(bitmap_t));
+        if (old_len > mapping->bitmap_len)
+            memset(&bmap->words[mapping->bitmap_len], 0, 
+                   (old_len - mapping->bitmap_len)*sizeof(bitmap_t));
+    }
+
+    dir->view = *mapping;
+    dir->view.bitmap = NULL;
+
+    __atomic_store_n(&dir->view_seq, seq + 2, __ATOMIC_RELEASE);
+
+    // the bitmaps (and split state) may have grown
+    size_t bytes = directory_bytes(dir);
+    __sync_fetch_and_add(&get_shard(&dir->handle)->bytes, 
+                         bytes - dir->cache_bytes);
+    dir->cache_bytes = bytes;
+    dir->dirty = 1;
+}
+
+/* Seqlock reader: wait for an even sequence number, then take the view; the
+ * bitmap pointer is loaded once, and the length is clamped to it so a torn 
+ * view can't read past the bitmap (its result is discarded on retry). */
+unsigned int cache_read_begin(struct giga_directory *dir, 
+                              struct giga_mapping_t *view)
+{
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&dir->view_seq, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+
+    struct cache_bmap *bmap = __atomic_load_n(&dir->view_bmap, 
+                                              __ATOMIC_ACQUIRE);
+    *view = dir->view;
+    view->bitmap = bmap->words;
+    if (view->bitmap_len > bmap->cap)
+        view->bitmap_len = bmap->cap;
+
+    return seq;
+}
+
+int cache_read_retry(struct giga_directory *dir, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&dir->view_seq, __ATOMIC_RELAXED) != seq;
 }
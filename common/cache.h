@@ -1,23 +1,75 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <pthread.h>
+
 #include "giga_index.h"
 #include "uthash.h"
 
 typedef int DIR_handle_t;
 
+struct cache_bmap;
+
 struct giga_directory {
     DIR_handle_t handle;
-    struct giga_mapping_t mapping;
-    int refcount;
+    struct giga_mapping_t mapping;  /* changed only under partition_mtx */
+    int refcount;                   /* atomic; the cache holds one reference */
+    int referenced;                 /* CLOCK bit, set on every cache hit */
+    int dirty;                      /* state changed since it was stored */
+    size_t cache_bytes;             /* memory charged to the cache */
+
+    /* lock-free readers see the mapping through a seqlock-protected view,
+     * updated by cache_publish_mapping() */
+    unsigned int view_seq;          /* odd while the view is being updated */
+    struct giga_mapping_t view;     /* scalar fields of the published mapping */
+    struct cache_bmap *view_bmap;   /* bitmap of the published mapping */
+
+    /* split state (used by servers) */
+    pthread_mutex_t partition_mtx;  /* protects mapping and split state */
+    pthread_cond_t split_cond;      /* signaled when creates[] drains */
+    int split_index;                /* partition being split, -1 if none */
+    int split_queued;               /* a split waits for a split thread */
+    int create_epoch;               /* mkdirs count in creates[epoch] ... */
+    int creates[2];                 /* ... while they write their entry */
+    int *partition_size;            /* number of entries in each partition */
+    int partition_size_len;
+
     UT_hash_handle hh;
 
 };
 
 
+/* Persistent storage of directory state, used to evict directories from 
+ * the cache (which has a byte budget, giga_options_t.cache_size): 
+ * - load() fills a new directory (its mapping is freshly initialized) and 
+ *   returns 0, -ENOENT if nothing was stored for it, or another -errno;
+ * - store() saves a dirty directory before it is evicted (a directory is 
+ *   kept if that fails).
+ * Without a store (as in clients) evicted directories start over. */
+struct cache_store {
+    int (*load)(struct giga_directory *dir);
+    int (*store)(struct giga_directory *dir);
+};
+
+/* hit/miss/eviction counters of the cache */
+struct cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long loads;            /* misses that found stored state */
+    unsigned long evictions;
+    unsigned long dirs;             /* directories in the cache */
+    unsigned long bytes;            /* memory charged to the cache */
+};
+
 /* initialize the directory cache */
 int cache_init();
 
+/* set the persistent storage of directories (before any cache_fetch()) */
+void cache_set_store(const struct cache_store *store);
+
+/* sum the counters of the cache */
+void cache_get_stats(struct cache_stats *stats);
+
 /* get the skye_directory object for a given PVFS_object_ref. */
 struct giga_directory* cache_fetch(DIR_handle_t *handle);
 
@@ -25,4 +77,20 @@ struct giga_directory* cache_fetch(DIR_handle_t *handle);
  * refcount skye_directory objects */
 void cache_return(struct giga_directory *dir);
 
+/* remove a fetched directory from the cache (when the object is deleted); 
+ * it is freed when the last reference is returned */
+void cache_destroy(struct giga_directory *dir);
+
+/* make changes to dir->mapping visible to lock-free readers; called with 
+ * dir->partition_mtx held, after every change to the mapping */
+void cache_publish_mapping(struct giga_directory *dir);
+
+/* lock-free read of the mapping (seqlock): cache_read_begin() fills "view"
+ * with the published mapping (its bitmap stays valid as long as "dir" is 
+ * referenced), and anything computed from it is valid only if 
+ * cache_read_retry() then returns 0; otherwise start over. */
+unsigned int cache_read_begin(struct giga_directory *dir, 
+                              struct giga_mapping_t *view);
+int cache_read_retry(struct giga_directory *dir, unsigned int seq);
+
 #endif
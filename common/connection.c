@@ -3,18 +3,38 @@
 #include "rpc_giga.h"
 #include "connection.h"
 #include "debugging.h"
+#include "rpc_async.h"
 
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <rpc/rpc.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-static CLIENT **rpc_clients;
+/* A CLIENT handle can't be shared by concurrent calls, so each server has a
+ * pool of connections: a request checks one out for its calls, and puts it
+ * back when done. Pools open their first connection in rpcConnect(), and 
+ * more on demand, up to giga_options_t.conn_pool_size.
+ */
+struct conn_pool {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;        /* signaled when a connection is put back */
+    CLIENT **idle;              /* connections not checked out */
+    int num_idle;
+    int num_open;               /* idle, checked out, or being opened */
+};
+
+static struct conn_pool *rpc_pools;
+
+/* Each server also has one pipelined connection, opened on first use, that
+ * is shared by all asynchronous calls to it. */
+static pthread_mutex_t async_conns_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct rpc_async_conn **async_conns;
 
 static int rpc_host_connect(CLIENT **rpc_client, const char *host);
 
@@ -25,29 +45,125 @@ CLIENT *getConnection(int serverid)
 {
     assert(serverid >= 0 && serverid < giga_options_t.num_servers);
 
-    return rpc_clients[serverid];
+    struct conn_pool *pool = &rpc_pools[serverid];
+    CLIENT *rpc_clnt = NULL;
+
+    pthread_mutex_lock(&pool->mtx);
+    while (pool->num_idle == 0) {
+        if (pool->num_open < giga_options_t.conn_pool_size) {
+            pool->num_open++;
+            pthread_mutex_unlock(&pool->mtx);
+            if (rpc_host_connect(&rpc_clnt, 
+                                 giga_options_t.serverlist[serverid]) == 0)
+                return rpc_clnt;
+            pthread_mutex_lock(&pool->mtx);
+            pool->num_open--;
+            if (pool->num_open == 0)
+                break;  // the server is unreachable
+        }
+        else
+            pthread_cond_wait(&pool->cond, &pool->mtx);
+    }
+    if (pool->num_idle > 0)
+        rpc_clnt = pool->idle[--pool->num_idle];
+    pthread_mutex_unlock(&pool->mtx);
+
+    if (rpc_clnt == NULL)
+        logMessage(LOG_ERR, __func__, "no connection to server-%d", serverid);
+
+    return rpc_clnt;
+}
+
+void putConnection(int serverid, CLIENT *rpc_clnt)
+{
+    struct conn_pool *pool = &rpc_pools[serverid];
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->idle[pool->num_idle++] = rpc_clnt;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+void discardConnection(int serverid, CLIENT *rpc_clnt)
+{
+    struct conn_pool *pool = &rpc_pools[serverid];
+
+    clnt_destroy(rpc_clnt);
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->num_open--;
+    pthread_cond_signal(&pool->cond);   // a waiter can open a new one
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+struct rpc_async_conn *getAsyncConnection(int serverid)
+{
+    assert(serverid >= 0 && serverid < giga_options_t.num_servers);
+
+    struct rpc_async_conn *conn, *lost = NULL;
+
+    pthread_mutex_lock(&async_conns_mtx);
+    conn = async_conns[serverid];
+    if ((conn != NULL) && rpc_async_failed(conn)) {
+        // the server went away (or restarted): reconnect, like the pools 
+        // do after discardConnection()
+        lost = conn;
+        conn = NULL;
+    }
+    if (conn == NULL) {
+        conn = rpc_async_connect(giga_options_t.serverlist[serverid], 
+                                 DEFAULT_PORT, 
+                                 GIGA_RPC_PROG, GIGA_RPC_VERSION);
+        async_conns[serverid] = conn;
+    }
+    if (conn != NULL)
+        rpc_async_hold(conn);
+    pthread_mutex_unlock(&async_conns_mtx);
+
+    // freed once its other holders put it back
+    if (lost != NULL)
+        rpc_async_close(lost);
+
+    if (conn == NULL)
+        logMessage(LOG_ERR, __func__, "no connection to server-%d", serverid);
+
+    return conn;
+}
+
+void putAsyncConnection(struct rpc_async_conn *conn)
+{
+    rpc_async_release(conn);
 }
 
 int rpcConnect(void)
 {
     int i;
 
-    rpc_clients = malloc(sizeof(CLIENT *)*giga_options_t.num_servers);
-    if (!rpc_clients)
+    if (giga_options_t.conn_pool_size < 1)
+        giga_options_t.conn_pool_size = 1;
+
+    rpc_pools = calloc(giga_options_t.num_servers, sizeof(struct conn_pool));
+    async_conns = calloc(giga_options_t.num_servers, 
+                         sizeof(struct rpc_async_conn *));
+    if (!rpc_pools || !async_conns)
         return -ENOMEM;
 
     for (i = 0; i < giga_options_t.num_servers; i++) { 
-        int ret = rpc_host_connect(&rpc_clients[i], giga_options_t.serverlist[i]);
+        struct conn_pool *pool = &rpc_pools[i];
+
+        pthread_mutex_init(&pool->mtx, NULL);
+        pthread_cond_init(&pool->cond, NULL);
+        pool->idle = malloc(sizeof(CLIENT *)*giga_options_t.conn_pool_size);
+        if (!pool->idle)
+            return -ENOMEM;
+
+        int ret = rpc_host_connect(&pool->idle[0], giga_options_t.serverlist[i]);
         if (ret < 0) {
             //TODO: print error msg
             return ret;
         }
-    }
-    for (i = 0; i < giga_options_t.num_servers; i++) {
-	    struct timeval to;
-        to.tv_sec = 60;
-        to.tv_usec = 0;
-	    clnt_control(rpc_clients[i], CLSET_TIMEOUT, (char*)&to);
+        pool->num_idle = 1;
+        pool->num_open = 1;
     }
     
     return 0;
@@ -55,35 +171,68 @@ int rpcConnect(void)
 
 void rpcDisconnect(void)
 {
-    int i;
+    int i, j;
 
-    for (i = 0; i < giga_options_t.num_servers; i++)
-        clnt_destroy (rpc_clients[i]);
+    for (i = 0; i < giga_options_t.num_servers; i++) {
+        struct conn_pool *pool = &rpc_pools[i];
+
+        pthread_mutex_lock(&pool->mtx);
+        for (j = 0; j < pool->num_idle; j++)
+            clnt_destroy (pool->idle[j]);
+        pool->num_open -= pool->num_idle;
+        pool->num_idle = 0;
+        pthread_mutex_unlock(&pool->mtx);
+
+        pthread_mutex_lock(&async_conns_mtx);
+        if (async_conns[i] != NULL) {
+            rpc_async_close(async_conns[i]);
+            async_conns[i] = NULL;
+        }
+        pthread_mutex_unlock(&async_conns_mtx);
+    }
 }
 
+// Pool connections are opened by concurrent requests, so the host is 
+// resolved with getaddrinfo() (gethostbyname() is not thread-safe); its 
+// (IPv4, for clnttcp_create()) addresses are tried in order.
+//
 static int rpc_host_connect(CLIENT **rpc_client, const char *host)
 {
-    int sock = RPC_ANYSOCK;
+    struct addrinfo hints, *info, *p;
+    int gai_result;
 
-    struct hostent *he;
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(DEFAULT_PORT);
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
 
-    he = gethostbyname(host);
-    if (!he) {
-        //FIXME:
-        //err_ret("unable to resolve %s\n", host);
+    if ((gai_result = getaddrinfo(host, NULL, &hints, &info)) != 0) {
+        logMessage(LOG_ERR, __func__, "unable to resolve %s: %s", 
+                   host, gai_strerror(gai_result));
         return -1;
     }
-    memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
 
-    *rpc_client = clnttcp_create (&addr, GIGA_RPC_PROG, GIGA_RPC_VERSION, &sock, 0, 0);
+    *rpc_client = NULL;
+    for (p = info; (p != NULL) && (*rpc_client == NULL); p = p->ai_next) {
+        struct sockaddr_in addr;
+        int sock = RPC_ANYSOCK;
+
+        memcpy(&addr, p->ai_addr, sizeof(addr));
+        addr.sin_port = htons(DEFAULT_PORT);
+        *rpc_client = clnttcp_create(&addr, GIGA_RPC_PROG, GIGA_RPC_VERSION, 
+                                     &sock, 0, 0);
+    }
+    freeaddrinfo(info);
+
     if (*rpc_client == NULL) {
         clnt_pcreateerror (NULL);
         return -1;
     }
 
+    struct timeval to;
+    to.tv_sec = 60;
+    to.tv_usec = 0;
+    clnt_control(*rpc_client, CLSET_TIMEOUT, (char*)&to);
+
     return 0;
 }
 
@@ -6,7 +6,21 @@
 
 extern char *my_hostname;
 
+/* Check out a connection to "serverid" (waiting for one if all of its 
+ * connections are in use), and return it when done; a connection that had
+ * an RPC error should be discarded instead. getConnection() returns NULL if
+ * the server can't be reached. */
 CLIENT *getConnection(int serverid);
+void putConnection(int serverid, CLIENT *rpc_clnt);
+void discardConnection(int serverid, CLIENT *rpc_clnt);
+
+/* The pipelined connection to "serverid" for asynchronous calls (see 
+ * rpc_async.h), or NULL if the server can't be reached; put it back when
+ * done sending. A connection that was lost is dropped, and the next call
+ * opens a new one. */
+struct rpc_async_conn *getAsyncConnection(int serverid);
+void putAsyncConnection(struct rpc_async_conn *conn);
+
 int rpcConnect(void);
 void rpcDisconnect(void);
 
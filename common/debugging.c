@@ -11,6 +11,9 @@
 #include "debugging.h"
 #include "defaults.h"
 
+log_level_t sys_log_level;          /* Log level */
+FILE *log_fp;                       /* Log file stream */
+
 static char *log_level_str[5] = {
     "LOG_FATAL",
     "LOG_ERR",
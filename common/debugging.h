@@ -47,8 +47,8 @@ typedef enum log_level {
 
 #define TIMESTAMP_ENABLED   1
 
-log_level_t sys_log_level;          /* Log level */
-FILE *log_fp;                       /* Log file stream */
+extern log_level_t sys_log_level;   /* Log level */
+extern FILE *log_fp;                /* Log file stream */
 
 
 void logOpen(const char *logFilename, log_level_t level);
@@ -56,4 +56,26 @@ void logClose(void);
 
 void logMessage(log_level_t lev, const char *location, const char *format, ...);
 
+/* 
+ * Logging from hot paths.
+ *
+ * LOG_MSG() only evaluates its arguments (and calls logMessage()) when the
+ * level is enabled at runtime. Levels above LOG_MAX_LEVEL are removed at 
+ * compile time; e.g. build with -DLOG_MAX_LEVEL=LOG_DEBUG to drop all 
+ * LOG_TRACE messages. Use LOG_ENABLED() to guard expensive debug output.
+ * */
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL   LOG_TRACE
+#endif
+
+#define LOG_ENABLED(lev) \
+    (((lev) <= LOG_MAX_LEVEL) && ((lev) <= sys_log_level))
+
+#define LOG_MSG(lev, ...)                                   \
+    do {                                                    \
+        if (LOG_ENABLED(lev))                               \
+            logMessage((lev), __func__, __VA_ARGS__);       \
+    } while (0)
+
 #endif /* DEBUGGING_H */
@@ -39,6 +39,25 @@
 
 #define ROOT_DIR_ID 0
 
+#define DEFAULT_NAME_HASH       GIGA_HASH_MURMUR64  /* of new dirs */
+#define DEFAULT_CACHE_SIZE      (64UL << 20)    /* dircache budget (bytes) */
+#define DEFAULT_CONN_POOL_SIZE  8               /* connections per server */
+#define DEFAULT_NUM_WORKERS     32              /* server's RPC handler threads */
+#define DEFAULT_TRANSPORT       TRANSPORT_EPOLL /* see transport_t */
+
+#define DEFAULT_LDB_DURABILITY  LDB_DURABILITY_ASYNC /* see ldb_durability_t */
+#define DEFAULT_LDB_GROUP_MAX   1024            /* entries per group commit */
+#define DEFAULT_LDB_GROUP_DELAY 0               /* usecs (0 = don't wait) */
+
+#define DEFAULT_LDB_BLOOM_BITS      10          /* ~1% false positives */
+#define DEFAULT_LDB_CACHE_SIZE      (64UL << 20)    /* LevelDB block cache */
+#define DEFAULT_LDB_WRITE_BUFFER    (16UL << 20)    /* LevelDB memtable */
+#define DEFAULT_LDB_BLOCK_SIZE      4096    /* bytes of a table block */
+#define DEFAULT_LDB_PARANOID_CHECKS 1
+#define DEFAULT_LDB_MAX_OPEN_FILES  1000
+#define DEFAULT_LDB_COMPRESSION     LDB_COMPRESSION_NONE
+#define DEFAULT_LDB_SHARDS          4       /* LevelDB instances per server */
+
 /* 
  * Sizes of different string lengths and buffer lengths 
  * 
@@ -46,6 +65,15 @@
 #define MAX_LEN     512     /* things with a "length" (e.g., path name, ip) */
 #define MAX_SIZE    4096    /* things with a "buffer" (e.g., read/write) */
 
+/* 
+ * Partition splits stream entries between servers in chunks.
+ * */
+#define MIGRATE_CHUNK_SIZE  65536       /* bytes of packed entries per chunk */
+#define MIGRATE_CREDITS     8           /* chunks in flight per migration */
+#define MIGRATE_RETRIES     5           /* tries to learn how a migration ended */
+#define MIGRATE_RETRY_DELAY 100000      /* usecs before the first retry */
+#define SPLIT_THREADS       4           /* splits of different dirs at once */
+
 /*
 #define MAX_FILENAME_LEN    256
 #define MAX_PATHNAME_LEN    4096
@@ -12,10 +12,10 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <malloc.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 
 #include "debugging.h"
 #include "giga_index.h"
@@ -28,20 +28,37 @@
 //static int hash_compare(char hash_val_1[], char hash_val_2[], int len);
 
 static index_t get_child_index(index_t index, int radix);
+static index_t get_split_child(struct giga_mapping_t *mapping, index_t index);
 static index_t get_parent_index(index_t index);
 
-static index_t compute_index(char hash_value[], int radix); 
-static int get_highest_index(bitmap_t bitmap[]);
+static void hash_name_binary(const char *hash_key, uint8_t hash[]);
+static index_t compute_index(uint64_t hash, int radix); 
+static int find_highest_index(struct giga_mapping_t *mapping, int word);
 
-static int get_bit_status(bitmap_t bmap[], index_t index);
+static int get_bit_status(struct giga_mapping_t *mapping, index_t index);
+static void set_bit(struct giga_mapping_t *mapping, index_t index);
+static void clear_bit(struct giga_mapping_t *mapping, index_t index);
+static void grow_bitmap(struct giga_mapping_t *mapping, index_t index);
 
-static int get_radix_from_bmap(bitmap_t bitmap[]);
+static void set_highest_index(struct giga_mapping_t *mapping, index_t index);
 static int get_radix_from_index(index_t index);
 
-static void print_bitmap(bitmap_t bmap[]);
+static void print_bitmap(struct giga_mapping_t *mapping);
 
 //static void struct giga_mapping_t_update_radix(struct giga_mapping_t *table);
 
+// Position of the most significant 1-bit in a non-zero index, i.e.
+// floor(log2(index)) computed with a count-leading-zeros instruction.
+//
+#define HIGHEST_BIT(index) ((int)(sizeof(unsigned int)*8) - 1 - \
+                            __builtin_clz((unsigned int)(index)))
+
+// Highest and lowest 1-bit, and number of 1-bits, in a non-zero bitmap word.
+//
+#define WORD_HIGHEST_BIT(word)  (BITS_PER_MAP - 1 - __builtin_clzll(word))
+#define WORD_LOWEST_BIT(word)   (__builtin_ctzll(word))
+#define WORD_NUM_BITS(word)     (__builtin_popcountll(word))
+
 // Compute the SHA-1 hash of the file name (or path name) 
 //
 void giga_hash_name(const char* hash_key, char hash_value[])
@@ -49,40 +66,171 @@ void giga_hash_name(const char* hash_key, char hash_value[])
     uint8_t hash[SHA1_HASH_SIZE] = {0}; 
     assert(hash_key);
     assert(hash_value);
-    int len = (int)strlen(hash_key);
 
-    logMessage(GIGA_LOG, __func__,
-               "hash: key={%s} of len=%d", hash_key, len);
+    LOG_MSG(GIGA_LOG, "hash: key={%s}", hash_key);
 
-    shahash((uint8_t*) hash_key, len, hash);
+    hash_name_binary(hash_key, hash);
     binary2hex(hash, SHA1_HASH_SIZE, hash_value);
 
 #ifdef DBG_INDEXING
     int i;
-    logMessage(GIGA_LOG, __func__, "hash={");
+    LOG_MSG(GIGA_LOG, "hash={");
     for (i=0; i<HASH_LEN; i++)
-        logMessage(GIGA_LOG, __func__, "%c", hash_value[i]);
-    logMessage(GIGA_LOG, __func__, "} of len=%d\n", HASH_LEN);
+        LOG_MSG(GIGA_LOG, "%c", hash_value[i]);
+    LOG_MSG(GIGA_LOG, "} of len=%d\n", HASH_LEN);
 #endif
 }
 
+// Compute the SHA-1 hash of the file name into its binary digest. The lookup
+// path uses this directly, instead of going through binary2hex/hex2binary.
+//
+static void hash_name_binary(const char *hash_key, uint8_t hash[])
+{
+    shahash((uint8_t*) hash_key, (int)strlen(hash_key), hash);
+}
+
+// SHA-1: the digest is read as a big-endian number, so the value used for
+// indexing is its final eight bytes.
+//
+static uint64_t hash_sha1(const char *name, size_t len)
+{
+    uint8_t hash[SHA1_HASH_SIZE];
+    uint64_t value = 0;
+    int i;
+
+    shahash((uint8_t*) name, (int)len, hash);
+    for (i = SHA1_HASH_SIZE-sizeof(uint64_t); i < SHA1_HASH_SIZE; i++)
+        value = (value << 8) | hash[i];
+
+    return value;
+}
+
+// MurmurHash64A (by Austin Appleby, public domain). Input words are read as
+// little-endian so that all hosts compute the same placement.
+//
+static uint64_t hash_murmur64(const char *name, size_t len)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const uint8_t *data = (const uint8_t*) name;
+    const uint8_t *end = data + (len & ~(size_t)7);
+    uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+    int i;
+
+    for (; data != end; data += 8) {
+        uint64_t k = 0;
+        for (i = 7; i >= 0; i--)
+            k = (k << 8) | data[i];
+
+        k *= m; 
+        k ^= k >> r; 
+        k *= m; 
+
+        h ^= k;
+        h *= m; 
+    }
+
+    switch (len & 7) {
+        case 7: h ^= (uint64_t)data[6] << 48;   // fall through
+        case 6: h ^= (uint64_t)data[5] << 40;   // fall through
+        case 5: h ^= (uint64_t)data[4] << 32;   // fall through
+        case 4: h ^= (uint64_t)data[3] << 24;   // fall through
+        case 3: h ^= (uint64_t)data[2] << 16;   // fall through
+        case 2: h ^= (uint64_t)data[1] << 8;    // fall through
+        case 1: h ^= (uint64_t)data[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+// Registry of the supported name hashes, indexed by GIGA_HASH_* id.
+//
+static const struct {
+    unsigned int id;
+    const char *name;
+    uint64_t (*hash)(const char *name, size_t len);
+} hash_functions[] = {
+    { 0,                    NULL,       NULL },
+    { GIGA_HASH_SHA1,       "sha1",     hash_sha1 },
+    { GIGA_HASH_MURMUR64,   "murmur64", hash_murmur64 },
+};
+
+int giga_hash_supported(unsigned int hash_type)
+{
+    return ((hash_type < ARRAY_LEN(hash_functions)) &&
+            (hash_functions[hash_type].hash != NULL));
+}
+
+unsigned int giga_hash_by_name(const char *name)
+{
+    unsigned int i;
+
+    for (i = 1; i < ARRAY_LEN(hash_functions); i++)
+        if (strcmp(name, hash_functions[i].name) == 0)
+            return hash_functions[i].id;
+
+    return 0;
+}
+
+uint64_t giga_hash_value(unsigned int hash_type, const char *name)
+{
+    assert(name);
+    assert(giga_hash_supported(hash_type));
+
+    uint64_t value = hash_functions[hash_type].hash(name, strlen(name));
+
+    LOG_MSG(GIGA_LOG, "%s(%s)=%016llx",
+            hash_functions[hash_type].name, name, (unsigned long long)value);
+
+    return value;
+}
+
+unsigned int giga_get_zeroth_server(int dir_id, unsigned int server_count)
+{
+    uint8_t id[sizeof(uint32_t)];
+    unsigned int i;
+
+    if (server_count == 0)
+        return 0;
+
+    // hash the id as little-endian bytes, like the names
+    for (i = 0; i < sizeof(id); i++)
+        id[i] = ((uint32_t)dir_id >> (8*i)) & 0xff;
+
+    return hash_murmur64((const char*)id, sizeof(id)) % server_count;
+}
+
 // Initialize the mapping table: 
 // - set the bitmap to all zeros, except for the first location to one which
 //   indicates the presence of a zeroth bucket
 // - set the radix to 1 (XXX: do we need radix??)
 // - flag indicates the number of servers if you use static partitioning
 //
+// The bitmap is allocated here, sized for the partitions that exist, and any
+// previous contents of "mapping" are ignored (use giga_free_mapping() first
+// on a mapping that is in use).
+//
 void giga_init_mapping(struct giga_mapping_t *mapping, int flag, 
                        unsigned int zeroth_server, unsigned int server_count)
 {
-    int i;
-    logMessage(GIGA_LOG, __func__,
-               "initialize giga mapping (flag=%d)", flag);
+    index_t i;
+    LOG_MSG(GIGA_LOG,
+            "initialize giga mapping (flag=%d)", flag);
 
     assert(mapping != NULL);
 
-    memset(mapping->bitmap, 0, MAX_BMAP_LEN);
+    mapping->bitmap = NULL;
+    mapping->bitmap_len = 0;
+    set_highest_index(mapping, -1);
 
+    mapping->hash_type = GIGA_HASH_DEFAULT;
+    mapping->split_type = SPLIT_T_DEFAULT;
+    mapping->split_bound = SPLIT_BOUND_DEFAULT;
     mapping->zeroth_server = zeroth_server;
     if (server_count > 0)
         mapping->server_count = server_count;
@@ -90,51 +238,105 @@ void giga_init_mapping(struct giga_mapping_t *mapping, int flag,
         mapping->server_count = 1;
     
     if (flag == -1) {
-        mapping->bitmap[0] = 1;
-        mapping->curr_radix = 1;
+        set_bit(mapping, 0);
         return;
     }
     
-    switch(SPLIT_TYPE) {
+    switch(mapping->split_type) {
         //case SPLIT_TYPE_KEEP_SPLITTING:
         case SPLIT_T_NO_BOUND:
-            mapping->bitmap[0] = 1;
-            mapping->curr_radix = 1;    
+            set_bit(mapping, 0);
             break;
         //case SPLIT_TYPE_NEVER_SPLIT:
         case SPLIT_T_NO_SPLITTING_EVER:
             assert(flag != -1);
-            if (flag < BITS_PER_MAP){
-                mapping->bitmap[i] = (1<<flag)-1;
-            } else {
+            if ((flag < 1) || (flag > (1<<MAX_RADIX))) {
                 logMessage(LOG_FATAL, __func__, 
-                           "XXX: need to fixx this dude!!!\n");
-
+                           "ERROR: can't pre-create %d partitions.", flag);
                 exit(1);
             }
-            mapping->curr_radix = get_radix_from_bmap(mapping->bitmap);
+            for (i = 0; i < flag; i++)
+                set_bit(mapping, i);
             break;
         //case SPLIT_TYPE_ALL_SERVERS:
         case SPLIT_T_NUM_SERVERS_BOUND:
-            mapping->bitmap[0] = 1;
-            mapping->curr_radix = 1;    
+            set_bit(mapping, 0);
             break;
         //case SPLIT_TYPE_POWER_OF_2:
         case SPLIT_T_NEXT_HIGHEST_POW2:
-            mapping->bitmap[0] = 1;
-            mapping->curr_radix = 1;    
+            set_bit(mapping, 0);
             break;
         default:
             logMessage(LOG_FATAL, __func__, 
-                       "ERROR: Illegal Split Type. %d\n", SPLIT_TYPE);
+                       "ERROR: Illegal Split Type. %d\n", 
+                       mapping->split_type);
             exit(1);
             break;
     }
     
-    //mapping->curr_radix = get_radix_from_bmap(mapping->bitmap);
+    giga_check_mapping(mapping);
+}
+
+int giga_split_supported(unsigned int split_type, unsigned int split_bound)
+{
+    switch (split_type) {
+        case SPLIT_T_NO_BOUND:
+            return 1;
+        case SPLIT_T_NO_SPLITTING_EVER:
+        case SPLIT_T_NUM_SERVERS_BOUND:
+        case SPLIT_T_NEXT_HIGHEST_POW2:
+            return ((split_bound >= 1) && (split_bound <= (1<<MAX_RADIX)));
+        default:
+            return 0;
+    }
+}
+
+// Set the split policy of a mapping; the bitmap is only touched for static
+// partitioning, which creates all the partitions up front.
+//
+int giga_set_split_policy(struct giga_mapping_t *mapping,
+                          unsigned int split_type, unsigned int split_bound)
+{
+    index_t i, num_partitions;
+
     assert(mapping != NULL);
+
+    if (!giga_split_supported(split_type, split_bound)) {
+        logMessage(LOG_ERR, __func__, 
+                   "invalid split policy: type=%d, bound=%d", 
+                   split_type, split_bound);
+        return -1;
+    }
+
+    mapping->split_type = split_type;
+    mapping->split_bound = split_bound;
+
+    if (split_type == SPLIT_T_NO_SPLITTING_EVER) {
+        num_partitions = split_bound * mapping->server_count;
+        if (num_partitions > (1<<MAX_RADIX))
+            num_partitions = (1<<MAX_RADIX);
+        for (i = 0; i < num_partitions; i++)
+            set_bit(mapping, i);
+        giga_check_mapping(mapping);
+    }
+
+    LOG_MSG(GIGA_LOG, "split policy: type=%d, bound=%d", 
+            split_type, split_bound);
+
+    return 0;
 }
 
+// Release the bitmap memory held by a mapping.
+//
+void giga_free_mapping(struct giga_mapping_t *mapping)
+{
+    assert(mapping != NULL);
+
+    free(mapping->bitmap);
+    mapping->bitmap = NULL;
+    mapping->bitmap_len = 0;
+    set_highest_index(mapping, -1);
+}
 
 // Initialize the mapping table to an existing bitmap
 //
@@ -143,49 +345,63 @@ void giga_init_mapping_from_bitmap(struct giga_mapping_t *mapping,
                                    unsigned int zeroth_server, 
                                    unsigned int server_count)
 {
-    int i;
-    logMessage(GIGA_LOG, __func__, "initialize giga mapping from bitmap");
-
+    LOG_MSG(GIGA_LOG, "initialize giga mapping from bitmap");
 
     assert(mapping != NULL);
+    assert(bitmap_len > 0 && bitmap[0] != 0);
+
     giga_init_mapping(mapping, -1, zeroth_server, server_count);
 
-    int bigger_bmap = ((MAX_BMAP_LEN > bitmap_len) ? bitmap_len : MAX_BMAP_LEN);
-    for (i=0; i<bigger_bmap; i++) {
-        if (i==0)
-            assert(bitmap[i] != 0);
-        mapping->bitmap[i] = bitmap[i];
-    }
-    mapping->curr_radix = get_radix_from_bmap(mapping->bitmap);
+    if (bitmap_len > MAX_BMAP_LEN)
+        bitmap_len = MAX_BMAP_LEN;
+    grow_bitmap(mapping, bitmap_len*BITS_PER_MAP - 1);
+    memcpy(mapping->bitmap, bitmap, bitmap_len*sizeof(bitmap_t));
+
+    set_highest_index(mapping, 
+                      find_highest_index(mapping, mapping->bitmap_len-1));
+    giga_check_mapping(mapping);
 }
 
-// Copy a source mapping to a destination mapping structure. 
+// Copy a source mapping to a destination mapping structure. The destination
+// must be a valid mapping or zero-filled; its bitmap is resized to fit.
 //
 void giga_copy_mapping(struct giga_mapping_t *dest, struct giga_mapping_t *src, int z)
 {
-    int i;
-
     assert(dest != NULL);
+    assert(src != NULL);
 
-    logMessage(GIGA_LOG, __func__, "copy one map into another");
+    LOG_MSG(GIGA_LOG, "copy one map into another");
     
     if (z == 0) {
+        giga_free_mapping(dest);
         giga_init_mapping(dest, -1, src->zeroth_server, src->server_count);
+        dest->hash_type = src->hash_type;
+        dest->split_type = src->split_type;
+        dest->split_bound = src->split_bound;
     } 
     else {
-        assert(src != NULL);
-
-        //XXX: do we need to check the length of both bitmaps
-        for(i = 0;i < MAX_BMAP_LEN; i++)
-            dest->bitmap[i] = src->bitmap[i];
-        
-        dest->curr_radix = get_radix_from_bmap(dest->bitmap);
-        //XXX: why not this?
-        //curr->curr_radix = update->curr_radix;
+        bitmap_t *bitmap = realloc(dest->bitmap, 
+                                   src->bitmap_len*sizeof(bitmap_t));
+        if (bitmap == NULL) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        memcpy(bitmap, src->bitmap, src->bitmap_len*sizeof(bitmap_t));
+
+        dest->bitmap = bitmap;
+        dest->bitmap_len = src->bitmap_len;
+        dest->curr_radix = src->curr_radix;
+        dest->highest_index = src->highest_index;
+        dest->zeroth_server = src->zeroth_server;
+        dest->server_count = src->server_count;
+        dest->hash_type = src->hash_type;
+        dest->split_type = src->split_type;
+        dest->split_bound = src->split_bound;
     }
 
-    logMessage(GIGA_LOG, __func__, "copy successful");
+    LOG_MSG(GIGA_LOG, "copy successful");
     giga_print_mapping(dest);
+    giga_check_mapping(dest);
 
     return;
 }
@@ -194,26 +410,45 @@ void giga_copy_mapping(struct giga_mapping_t *dest, struct giga_mapping_t *src,
 //
 void giga_update_cache(struct giga_mapping_t *curr, struct giga_mapping_t *update)
 {
-    int i;
+    unsigned int i;
 
-    logMessage(GIGA_LOG, __func__, "beginning to update the cached copy.");
+    LOG_MSG(GIGA_LOG, "beginning to update the cached copy.");
 
     assert(curr != NULL);
     assert(update != NULL);
 
     //XXX: what do we need to check for?
-    //  - the length of both bitmaps: same or different?
     //  - anything to do with radix?
     //
-    for(i = 0;i < MAX_BMAP_LEN; i++)
+    // A bitmap built with another hash function describes a different
+    // placement, so it is replaced rather than merged.
+    //
+    if (curr->hash_type != update->hash_type) {
+        LOG_MSG(GIGA_LOG, "hash changed: %d -> %d",
+                curr->hash_type, update->hash_type);
+        curr->hash_type = update->hash_type;
+        memset(curr->bitmap, 0, curr->bitmap_len*sizeof(bitmap_t));
+        set_highest_index(curr, -1);
+    }
+
+    if (update->bitmap_len > 0)
+        grow_bitmap(curr, update->bitmap_len*BITS_PER_MAP - 1);
+    for(i = 0; i < update->bitmap_len; i++)
         curr->bitmap[i] = curr->bitmap[i] | update->bitmap[i];
     
-    curr->curr_radix = get_radix_from_bmap(curr->bitmap);
+    // the union's highest partition is the higher of the two
+    if (update->highest_index > curr->highest_index)
+        set_highest_index(curr, update->highest_index);
+    giga_check_mapping(curr);
 
     if (update->server_count > curr->server_count)
         curr->server_count = update->server_count;
+
+    // the split policy is decided by the servers
+    curr->split_type = update->split_type;
+    curr->split_bound = update->split_bound;
     
-    logMessage(GIGA_LOG, __func__, "updating the cached copy. success.");
+    LOG_MSG(GIGA_LOG, "updating the cached copy. success.");
 
     return;
 }
@@ -226,37 +461,22 @@ void giga_update_cache(struct giga_mapping_t *curr, struct giga_mapping_t *updat
 void giga_update_mapping(struct giga_mapping_t *mapping, index_t new_index)
 {
 
-    logMessage(GIGA_LOG, __func__, "post-split update @index=%d", new_index);
-    int index_in_bmap = new_index / BITS_PER_MAP;
-    int bit_in_index = new_index % BITS_PER_MAP;
+    LOG_MSG(GIGA_LOG, "post-split update @index=%d", new_index);
 
-    bitmap_t mask = (bitmap_t)(1<<(bit_in_index));
-    bitmap_t bit_info = mapping->bitmap[index_in_bmap];
-   
-    bit_info = bit_info | mask;
-    
-    mapping->bitmap[index_in_bmap] = bit_info;
-    mapping->curr_radix = get_radix_from_bmap(mapping->bitmap);
+    set_bit(mapping, new_index);
+    giga_check_mapping(mapping);
 
-    logMessage(GIGA_LOG, __func__, 
-               "post-split update @index=%d. DONE.", new_index);
-    print_bitmap(mapping->bitmap);
+    LOG_MSG(GIGA_LOG,
+            "post-split update @index=%d. DONE.", new_index);
+    print_bitmap(mapping);
     
     return;
 }
 
 void giga_update_mapping_remove(struct giga_mapping_t *mapping, index_t new_index)
 {
-    int index_in_bmap = new_index / BITS_PER_MAP;
-    int bit_in_index = new_index % BITS_PER_MAP;
-
-    bitmap_t mask = (bitmap_t)(1<<(bit_in_index));
-    bitmap_t bit_info = mapping->bitmap[index_in_bmap];
-   
-    bit_info = bit_info & (~mask);
-    
-    mapping->bitmap[index_in_bmap] = bit_info;
-    mapping->curr_radix = get_radix_from_bmap(mapping->bitmap);
+    clear_bit(mapping, new_index);
+    giga_check_mapping(mapping);
 
     return;
 }
@@ -268,10 +488,10 @@ index_t giga_index_for_splitting(struct giga_mapping_t *mapping, index_t index)
 {
     index_t new_index = index;
 
-    logMessage(GIGA_LOG, __func__, "split index=%d for bitmap below", index);
+    LOG_MSG(GIGA_LOG, "split index=%d for bitmap below", index);
     giga_print_mapping(mapping);
 
-    assert(get_bit_status(mapping->bitmap, index) == 1); 
+    assert(get_bit_status(mapping, index) == 1); 
     /*
     int radix = get_radix_from_index(index);
     do {
@@ -283,22 +503,14 @@ index_t giga_index_for_splitting(struct giga_mapping_t *mapping, index_t index)
         //if (new_index >= 1)
         //    radix += 1;
         new_index = get_child_index(new_index, radix);
-    } while (get_bit_status(mapping->bitmap, new_index) == 1);
+    } while (get_bit_status(mapping, new_index) == 1);
     */
 
-    int i = get_radix_from_index(index);
-    while (1) {
-        assert (i < MAX_RADIX);
-        new_index = get_child_index(index, i);
-        if (get_bit_status(mapping->bitmap, new_index) == 0)
-            break;
-        i++;
-    }
-
-    assert(new_index != index);
+    new_index = get_split_child(mapping, index);
+    assert(new_index > index);
     
-    logMessage(GIGA_LOG, __func__, 
-               "index=%d --[split]-- index=%d", index, new_index);
+    LOG_MSG(GIGA_LOG,
+            "index=%d --[split]-- index=%d", index, new_index);
     return new_index;
 }
 
@@ -322,14 +534,12 @@ index_t giga_get_index_for_backup(index_t index)
 index_t giga_get_index_for_file(struct giga_mapping_t *mapping, 
                                 const char *filename)
 {
-    logMessage(GIGA_LOG, __func__, "getting index for file(%s)", filename);
+    LOG_MSG(GIGA_LOG, "getting index for file(%s)", filename);
     
-    char hash[HASH_LEN] = {0};
-    giga_hash_name(filename, hash);
+    uint64_t hash = giga_hash_value(mapping->hash_type, filename);
     
-    // find the current radix 
-    int curr_radix = get_radix_from_bmap(mapping->bitmap);
-    //int curr_radix = mapping->curr_radix;
+    // the current radix is kept up to date with the bitmap
+    int curr_radix = mapping->curr_radix;
     
     // compute index using the "radix" bits of the filename hash
     index_t index = compute_index(hash, curr_radix); 
@@ -341,17 +551,16 @@ index_t giga_get_index_for_file(struct giga_mapping_t *mapping,
     // example: 
     //   bitmap={11101000}, so radix=3, 
     //   if index is 6, it doesn't exist yet, trace to parent (2)
-    // XXX: check for error: from p3->p2 but p2 is set to 0!!
-    // although this should never happen, we should still check it.
-    while (get_bit_status(mapping->bitmap, index) == 0) {
+    // The walk ends at partition 0 at the latest (it is never cleared); the
+    // bitmap isn't read again after the walk, because lock-free readers of
+    // the directory cache may see it change underneath them.
+    while (get_bit_status(mapping, index) == 0) {
         index_t curr_index = index;
         index = get_parent_index(curr_index);
     }
 
-    assert(get_bit_status(mapping->bitmap, index) == 1);
-
-    logMessage(GIGA_LOG, __func__, 
-               "file=%s --> partition_index=%d", filename, index);
+    LOG_MSG(GIGA_LOG,
+            "file=%s --> partition_index=%d", filename, index);
    
     return index;
 }
@@ -378,43 +587,52 @@ index_t giga_get_bucket_num_for_server(struct giga_mapping_t *mapping, index_t i
 // Pass the "index" of the current bucket. 
 // Return ZERO, if the file stays in the bucket.
 // 
-int giga_file_migration_status(const char* filename, index_t new_index) 
+int giga_file_migration_status(struct giga_mapping_t *mapping,
+                               const char* filename, index_t new_index) 
 {
     int ret = 0;
-    logMessage(GIGA_LOG, __func__, "checking if file(%s) moves?", filename);
+    LOG_MSG(GIGA_LOG, "checking if file(%s) moves?", filename);
     
-    char hash[HASH_LEN] = {0};
-    giga_hash_name(filename, hash);
+    uint64_t hash = giga_hash_value(mapping->hash_type, filename);
 
     int radix = get_radix_from_index(new_index);
     if (compute_index(hash, radix) == new_index)
         ret = 1;
 
-    logMessage(GIGA_LOG, __func__, "file(%s) move status: %d", filename, ret);
+    LOG_MSG(GIGA_LOG, "file(%s) move status: %d", filename, ret);
     
     return ret;
 }
 
 int giga_is_splittable(struct giga_mapping_t *mapping, index_t old_index)
 {
-    switch (SPLIT_TYPE) {
-        index_t new_index;
+    index_t new_index;
+    long bound;
+
+    if (mapping->split_type == SPLIT_T_NO_SPLITTING_EVER)
+        return 0;
+
+    // a partition at the deepest level of the tree can't split at all
+    new_index = get_split_child(mapping, old_index);
+    if (new_index < 0)
+        return 0;
+
+    bound = (long)mapping->split_bound * mapping->server_count;
+
+    switch (mapping->split_type) {
         case SPLIT_T_NO_BOUND:
             return 1;
-        case SPLIT_T_NO_SPLITTING_EVER:
-            return 0;
         case SPLIT_T_NUM_SERVERS_BOUND:
-            new_index = giga_index_for_splitting(mapping, old_index);
-            if (new_index < MAX_BKTS_PER_SERVER * (signed int)mapping->server_count)
-                return 1;
-            else
-                return 0;
+            return (new_index < bound);
         case SPLIT_T_NEXT_HIGHEST_POW2:
-            abort();
+            if (bound > 1)
+                bound = 1L << (HIGHEST_BIT(bound - 1) + 1);
+            return (new_index < bound);
+        default:
+            logMessage(LOG_FATAL, __func__, 
+                       "ERROR: Illegal Split Type. %d", mapping->split_type);
+            exit(1);
     }
-
-    /* should never get here */
-    return 1;
 }
 
 // Print the struct giga_mapping_t contents. 
@@ -422,88 +640,208 @@ int giga_is_splittable(struct giga_mapping_t *mapping, index_t old_index)
 void giga_print_mapping(struct giga_mapping_t *mapping)
 {
     assert(mapping != NULL);
+
+    if (!LOG_ENABLED(GIGA_LOG))
+        return;
     
-    logMessage(GIGA_LOG, __func__, "=========="); 
-    logMessage(GIGA_LOG, __func__, "printing the header table ... ");
-    logMessage(GIGA_LOG, __func__, "\tradix=%d", mapping->curr_radix);
-    logMessage(GIGA_LOG, __func__, "\tzeroth server=%d", mapping->zeroth_server);
-    logMessage(GIGA_LOG, __func__, "\tserver count=%d", mapping->server_count);
-    logMessage(GIGA_LOG, __func__, "\tbitmap_size=%d", MAX_BMAP_LEN);
-    logMessage(GIGA_LOG, __func__, "\tbitmap (from 0th position)=");
-    print_bitmap(mapping->bitmap);
-    logMessage(GIGA_LOG, __func__, "=========="); 
+    LOG_MSG(GIGA_LOG, "=========="); 
+    LOG_MSG(GIGA_LOG, "printing the header table ... ");
+    LOG_MSG(GIGA_LOG, "\tradix=%d", mapping->curr_radix);
+    LOG_MSG(GIGA_LOG, "\tzeroth server=%d", mapping->zeroth_server);
+    LOG_MSG(GIGA_LOG, "\tserver count=%d", mapping->server_count);
+    LOG_MSG(GIGA_LOG, "\thash=%d", mapping->hash_type);
+    LOG_MSG(GIGA_LOG, "\tsplit=%d (bound=%d)", 
+            mapping->split_type, mapping->split_bound);
+    LOG_MSG(GIGA_LOG, "\tbitmap_size=%d", mapping->bitmap_len);
+    LOG_MSG(GIGA_LOG, "\tbitmap (from 0th position)=");
+    print_bitmap(mapping);
+    LOG_MSG(GIGA_LOG, "=========="); 
+}
+
+int giga_get_num_partitions(struct giga_mapping_t *mapping)
+{
+    unsigned int i;
+    int num = 0;
+
+    for (i = 0; i < mapping->bitmap_len; i++)
+        num += WORD_NUM_BITS(mapping->bitmap[i]);
+
+    return num;
+}
+
+int giga_bitmap_wire_len(struct giga_mapping_t *mapping)
+{
+    return mapping->highest_index / BITS_PER_WIRE_BYTE + 1;
+}
+
+void giga_bitmap_to_wire(struct giga_mapping_t *mapping, 
+                         unsigned char wire[], int wire_len)
+{
+    unsigned int i;
+
+    assert(wire_len >= giga_bitmap_wire_len(mapping));
+    (void)wire_len;
+
+    for (i = 0; i < mapping->bitmap_len; i++) {
+        bitmap_t word = mapping->bitmap[i];
+        while (word != 0) {
+            index_t index = i*BITS_PER_MAP + WORD_LOWEST_BIT(word);
+            wire[index / BITS_PER_WIRE_BYTE] |= 
+                (unsigned char)(1 << (index % BITS_PER_WIRE_BYTE));
+            word &= word - 1;
+        }
+    }
 }
 
-static void print_bitmap(bitmap_t bmap[])
+int giga_bitmap_from_wire(struct giga_mapping_t *mapping, 
+                          const unsigned char wire[], int wire_len)
 {
     int i;
-    char bitmap_buf[MAX_BMAP_LEN] = {0};
-    bitmap_buf[0] = '\0';
-    for(i = 0; i < MAX_BMAP_LEN; i++) {
-        char buf[8] = {0};
-        snprintf(buf, sizeof(buf),"%d|", bmap[i]);
-        buf[strlen(buf)] = '\0';
-        strncat(bitmap_buf, buf, strlen(buf));
+
+    if ((wire_len <= 0) || (wire_len > MAX_BMAP_WIRE_LEN) || 
+        ((wire[0] & 1) == 0))
+        return -1;      // partition zero always exists
+
+    mapping->bitmap = NULL;
+    mapping->bitmap_len = 0;
+    set_highest_index(mapping, -1);
+
+    // highest byte first, so that the bitmap is allocated only once
+    for (i = wire_len-1; i >= 0; i--) {
+        unsigned int byte = wire[i] & ((1 << BITS_PER_WIRE_BYTE) - 1);
+        while (byte != 0) {
+            index_t index = i*BITS_PER_WIRE_BYTE + __builtin_ctz(byte);
+            if (index >= (1<<MAX_RADIX)) {
+                giga_free_mapping(mapping);
+                return -1;
+            }
+            set_bit(mapping, index);
+            byte &= byte - 1;
+        }
     }
-    logMessage(GIGA_LOG, __func__, "%s", bitmap_buf);
-    logMessage(GIGA_LOG, __func__, "\n");
+    giga_check_mapping(mapping);
+
+    return 0;
 }
 
-// From a given bitmap, find the radix for that bitmap by looking
-// at the highest index in the bitmap with a "1".
+int giga_bitmap_num_words(struct giga_mapping_t *mapping)
+{
+    return mapping->highest_index / BITS_PER_MAP + 1;
+}
+
+void giga_bitmap_to_words(struct giga_mapping_t *mapping, 
+                          unsigned char words[], int num_words)
+{
+    int i, j;
+
+    assert(num_words >= giga_bitmap_num_words(mapping));
+
+    for (i = 0; i < num_words; i++) {
+        bitmap_t word = 
+            ((unsigned int)i < mapping->bitmap_len) ? mapping->bitmap[i] : 0;
+        for (j = 0; j < 8; j++)
+            words[i*8 + j] = (unsigned char)(word >> (56 - 8*j));
+    }
+}
+
+int giga_bitmap_from_words(struct giga_mapping_t *mapping, 
+                           const unsigned char words[], int num_words)
+{
+    int i, j;
+
+    if ((num_words <= 0) || (num_words > MAX_BMAP_LEN) || 
+        ((words[7] & 1) == 0))
+        return -1;      // partition zero always exists
+
+    mapping->bitmap = NULL;
+    mapping->bitmap_len = 0;
+    grow_bitmap(mapping, num_words*BITS_PER_MAP - 1);
+
+    for (i = 0; i < num_words; i++) {
+        bitmap_t word = 0;
+        for (j = 0; j < 8; j++)
+            word = (word << 8) | words[i*8 + j];
+        mapping->bitmap[i] = word;
+    }
+    set_highest_index(mapping, find_highest_index(mapping, num_words-1));
+    giga_check_mapping(mapping);
+
+    return 0;
+}
+
+// Print the bitmap elements; a log message is at most MAX_ERR_BUF_SIZE long,
+// so large bitmaps are cut off at that point.
 //
-static int get_radix_from_bmap(bitmap_t bitmap[])
+static void print_bitmap(struct giga_mapping_t *mapping)
 {
-    logMessage(GIGA_LOG, __func__, "for given bitmap, find radix ... ");
-    print_bitmap(bitmap);
+    unsigned int i;
+    char bitmap_buf[MAX_ERR_BUF_SIZE] = {0};
+    int len = 0;
 
-    int radix = get_radix_from_index(get_highest_index(bitmap));
+    if (!LOG_ENABLED(GIGA_LOG))
+        return;
+    for(i = 0; i < mapping->bitmap_len; i++) {
+        if (len + (int)sizeof("0123456789abcdef|") > (int)sizeof(bitmap_buf))
+            break;
+        len += snprintf(bitmap_buf+len, sizeof(bitmap_buf)-len, "%016llx|", 
+                        (unsigned long long)mapping->bitmap[i]);
+    }
+    LOG_MSG(GIGA_LOG, "%s", bitmap_buf);
+    LOG_MSG(GIGA_LOG, "\n");
+}
 
-    logMessage(GIGA_LOG, __func__, "for above bitmap, radix=%d", radix);
+// Record the highest partition in the bitmap, and the radix derived from it
+// (-1 for an empty bitmap).
+//
+static void set_highest_index(struct giga_mapping_t *mapping, index_t index)
+{
+    mapping->highest_index = index;
+    mapping->curr_radix = (index >= 0) ? get_radix_from_index(index) : 0;
 
-    return radix;
+    LOG_MSG(GIGA_LOG, "highest=%d, radix=%d", index, mapping->curr_radix);
 }
 
 // Simply put, given a string of 1s and 0s, find the highest location of 1.
 // In this function, the "string" is the GIGA+ bitmap, and you have to find the
-// highest "location" in this bitmap where the bit value is 1
+// highest "location" in this bitmap where the bit value is 1. The search
+// starts at element "word" and goes down; returns -1 if there is no 1.
 //
-static int get_highest_index(bitmap_t bitmap[])
+static int find_highest_index(struct giga_mapping_t *mapping, int word)
 {
-    int i,j;
-    int max_index = -1;
-    int index_in_bmap = -1;  // highest index with a non-zero element
-    int bit_in_index = -1;  // highest bit in the element in index_in_bmap
+    int i;
+    bitmap_t *bitmap = mapping->bitmap;
     
     // find the largest non-zero element, and then in that element find the
     // highest bit that is 1
     //
-    for (i=MAX_BMAP_LEN-1; i>=0; i--) {
-        //printf("@element%d\n",i);
-        if (bitmap[i] != 0) {
-            index_in_bmap = i;  
-            //printf("@element%d:value=%d;index_in_bmap=%d\n",i, bitmap[i], index_in_bmap);
-            break;
-        }
-    }
-    
-    bitmap_t value = bitmap[i];
-    for (j=BITS_PER_MAP-1; j>=0; j--) {
-        bitmap_t mask = (bitmap_t)1<<j;
-        //printf("\t looking at bit-%d of 8, with mask=%d\n",(j+1), mask);
-        if ((value & mask) != 0) {
-            bit_in_index = j;
-            break;
-        }
+    for (i = word; i >= 0; i--) {
+        if (bitmap[i] != 0)
+            return (i * BITS_PER_MAP) + WORD_HIGHEST_BIT(bitmap[i]);
     }
-    
-    max_index = (index_in_bmap * BITS_PER_MAP) + bit_in_index;
-    assert(max_index >= 0);
 
-    logMessage(GIGA_LOG, __func__, "for bitmap below, highest=%d", max_index);
-    print_bitmap(bitmap);
+    return -1;
+}
 
-    return max_index;
+// Debugging aid: recompute the radix and the highest index from the bitmap
+// and check them against the cached values.
+//
+void giga_check_mapping(struct giga_mapping_t *mapping)
+{
+#ifdef DBG_INDEXING
+    int highest = find_highest_index(mapping, (int)mapping->bitmap_len-1);
+
+    if ((highest != mapping->highest_index) ||
+        ((highest >= 0) && 
+         ((int)mapping->curr_radix != get_radix_from_index(highest)))) {
+        logMessage(LOG_FATAL, __func__,
+                   "mapping out of sync: highest=%d (cached %d), radix=%d",
+                   highest, mapping->highest_index, mapping->curr_radix);
+        giga_print_mapping(mapping);
+        assert(0);
+    }
+#else
+    (void)mapping;
+#endif
 }
 
 // Get radix from the index, i.e. for index i, you need a r-bit binary number.
@@ -511,44 +849,93 @@ static int get_highest_index(bitmap_t bitmap[])
 //
 static int get_radix_from_index(index_t index)
 {
-    //int radix = ((index > 0) ? ((int)(floor(log2(index)))+1) : 0);
-    
-    int radix = -1;
-    if (index == 0)
-        radix = 0;
-    else if (index == 1)
-        radix = 1;
-    else
-        radix = ((int)(floor(log2((double)index)))+1);
+    assert(index >= 0);
+
+    int radix = ((index > 0) ? (HIGHEST_BIT(index) + 1) : 0);
 
-    logMessage(GIGA_LOG, __func__, "for index=%d, radix=%d ", index, radix);
+    LOG_MSG(GIGA_LOG, "for index=%d, radix=%d ", index, radix);
 
     return radix;
 }
 
-// Return the status of a bit at a given index in the bitmap.
+// Return the status of a bit at a given index in the bitmap; partitions past
+// the end of the (compact) bitmap do not exist.
 //
-static int get_bit_status(bitmap_t bmap[], index_t index)
+static int get_bit_status(struct giga_mapping_t *mapping, index_t index)
 {   
     int status = 0;
 
-    int index_in_bmap = index / BITS_PER_MAP;
+    unsigned int index_in_bmap = index / BITS_PER_MAP;
     int bit_in_index = index % BITS_PER_MAP;
 
-    bitmap_t mask = (bitmap_t)(1<<(bit_in_index));
-    bitmap_t bit_info = bmap[index_in_bmap];
-    
-    bit_info = bit_info & mask;
-    if (bit_info != 0)
-        status = 1;
+    if (index_in_bmap < mapping->bitmap_len) {
+        bitmap_t mask = (bitmap_t)1 << bit_in_index;
+        if ((mapping->bitmap[index_in_bmap] & mask) != 0)
+            status = 1;
+    }
 
-    logMessage(GIGA_LOG, __func__, 
-               "in bitmap below @ index=%d, bit-status=%d ", index, status);
-    print_bitmap(bmap);
+    LOG_MSG(GIGA_LOG,
+            "in bitmap below @ index=%d, bit-status=%d ", index, status);
+    print_bitmap(mapping);
 
     return status;
 }
 
+// Grow the bitmap (at least doubling it) so that it can hold "index". 
+// Directories allocate only what their partitions need, up to MAX_BMAP_LEN.
+//
+static void grow_bitmap(struct giga_mapping_t *mapping, index_t index)
+{
+    assert((index >= 0) && (index < (1<<MAX_RADIX)));
+
+    unsigned int needed = index / BITS_PER_MAP + 1;
+    if (needed <= mapping->bitmap_len)
+        return;
+
+    unsigned int len = mapping->bitmap_len * 2;
+    if (len < needed)
+        len = needed;
+    if (len > MAX_BMAP_LEN)
+        len = MAX_BMAP_LEN;
+
+    bitmap_t *bitmap = realloc(mapping->bitmap, len*sizeof(bitmap_t));
+    if (bitmap == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    memset(&bitmap[mapping->bitmap_len], 0, 
+           (len - mapping->bitmap_len)*sizeof(bitmap_t));
+
+    mapping->bitmap = bitmap;
+    mapping->bitmap_len = len;
+}
+
+// Setting and clearing bits keeps the highest index (and radix) current; only
+// clearing the highest partition needs a search, down from its own element.
+//
+static void set_bit(struct giga_mapping_t *mapping, index_t index)
+{
+    grow_bitmap(mapping, index);
+    mapping->bitmap[index / BITS_PER_MAP] |= 
+        (bitmap_t)1 << (index % BITS_PER_MAP);
+
+    if (index > mapping->highest_index)
+        set_highest_index(mapping, index);
+}
+
+static void clear_bit(struct giga_mapping_t *mapping, index_t index)
+{
+    if ((unsigned int)(index / BITS_PER_MAP) >= mapping->bitmap_len)
+        return;
+
+    mapping->bitmap[index / BITS_PER_MAP] &= 
+        ~((bitmap_t)1 << (index % BITS_PER_MAP));
+
+    if (index == mapping->highest_index)
+        set_highest_index(mapping, 
+                          find_highest_index(mapping, index / BITS_PER_MAP));
+}
+
 // Return the child index for any given index, i.e. the index of 
 // partition created after a split.
 // Unlike get_parent_index() this requires a radix because you might want to
@@ -567,11 +954,28 @@ static index_t get_child_index(index_t index, int radix)
     //else
     //    child_index = index + (int)(1<<radix); 
 
-    logMessage(GIGA_LOG, __func__, "child of %d -> %d", index, child_index);
+    LOG_MSG(GIGA_LOG, "child of %d -> %d", index, child_index);
 
     return child_index;
 }
 
+// Return the partition created by the next split of "index": its first child
+// (going down the tree) that does not exist yet, or -1 if all children up
+// to MAX_RADIX exist.
+//
+static index_t get_split_child(struct giga_mapping_t *mapping, index_t index)
+{
+    int radix;
+
+    for (radix = get_radix_from_index(index); radix < MAX_RADIX; radix++) {
+        index_t child = get_child_index(index, radix);
+        if (get_bit_status(mapping, child) == 0)
+            return child;
+    }
+
+    return -1;
+}
+
 // Return the parent index of any given index 
 // (traverse the bit position one-level up the tree)
 //
@@ -579,9 +983,9 @@ static index_t get_parent_index(index_t index)
 {
     index_t parent_index = 0;
     if (index > 0)
-        parent_index = index - (int)(1 << ((int)(floor(log2((double)index)))));
+        parent_index = index & ~(1 << HIGHEST_BIT(index));
 
-    logMessage(GIGA_LOG, __func__, "parent of %d -> %d", index, parent_index);
+    LOG_MSG(GIGA_LOG, "parent of %d -> %d", index, parent_index);
 
     return parent_index;
 }
@@ -597,46 +1001,15 @@ index_t get_split_index_for_newserver(index_t index)
 // Use the last "radix" number of bits from the hash value to find the 
 // index of the bucket where the file needs to be inserted.
 //
-static index_t compute_index(char hash_value[], int radix) 
+static index_t compute_index(uint64_t hash, int radix) 
 {
-    index_t index = 0;
-    int i;
-
-    assert(radix < MAX_RADIX);
-
-    // use the last "radix" bits from the hash
-    int curr_byte;
-    index_t curr_mask, curr_value, curr_shift;
-    int num_useful_bytes, residual_useful_bits;
-
-    uint8_t bin_hash[SHA1_HASH_SIZE] = {0}; 
-    hex2binary(hash_value, HASH_LEN, bin_hash);
-    //for (i=0; i<SHA1_HASH_SIZE; i++) printf("%d,", bin_hash[i]);
+    assert(radix <= MAX_RADIX);
 
-    num_useful_bytes = radix/(sizeof(bin_hash[0])*8);
-    residual_useful_bits = radix%(sizeof(bin_hash[0])*8);
-    //if (residual_useful_bits != 0)
-    if ((residual_useful_bits != 0) || (num_useful_bytes>0))
-        num_useful_bytes += 1; 
-
-    //printf("num_useful_bytes(from hash)=%d, residual_bits=%d\n", 
-    //        num_useful_bytes, residual_useful_bits);
-    for (i=0; i<num_useful_bytes-1; i++) {
-        curr_byte = bin_hash[SHA1_HASH_SIZE-1-i];
-        curr_shift = curr_byte<<(i*sizeof(bin_hash[0])*8);
-        index += curr_shift;
-    }
-
-    curr_byte = bin_hash[SHA1_HASH_SIZE-1-i];
-    curr_mask = (1<<residual_useful_bits) - 1;
-    curr_value = curr_byte & curr_mask;
-    curr_shift = curr_value<<(i*sizeof(bin_hash[0])*8);
- 
-    //printf("byte=%d, after shift=%d\n", curr_byte, curr_shift); 
-    index += curr_shift;
+    index_t index = (index_t)(hash & ((1ULL << radix) - 1));
         
-    logMessage(GIGA_LOG, __func__, 
-               "use radix=%d on {hash={%s},index=%d}", radix, hash_value, index);
+    LOG_MSG(GIGA_LOG,
+            "use radix=%d on {hash=%016llx,index=%d}", 
+            radix, (unsigned long long)hash, index);
 
     return index;
 }
@@ -657,7 +1030,7 @@ static int hash_compare(char hash_val_1[], char hash_val_2[], int len)
             status=-1;
     }
 
-    logMessage(GIGA_LOG, __func__, "comparing hash1 and hash2 == ", status);
+    LOG_MSG(GIGA_LOG, "comparing hash1 and hash2 == ", status);
 
     return status;
 }
@@ -701,3 +1074,220 @@ static void struct giga_mapping_t_update_radix(struct giga_mapping_t *table)
 }
 */
 
+
+#ifdef GIGA_INDEX_BENCH
+
+// Microbenchmark for the lookup path. It compares giga_get_index_for_file()
+// against the previous hex round-trip/floating-point lookup (kept below as a
+// reference) and checks that both pick the same partition for every name.
+//
+// Build (from common/):
+//   gcc -O2 -DGIGA_INDEX_BENCH -iquote .. -o giga_index_bench
+//       giga_index.c sha.c debugging.c -lm
+// and add -DLOG_MAX_LEVEL=LOG_DEBUG to measure with trace logging compiled 
+// out (otherwise it is only filtered at runtime).
+//
+#include <math.h>
+#include <sys/time.h>
+
+#define BENCH_NUM_NAMES     (1<<16)
+#define BENCH_NUM_ROUNDS    16
+#define BENCH_NUM_RUNS      7       /* each timing is the best of these */
+#define BENCH_LARGE_PARTITIONS  (1<<16)
+#define BENCH_NUM_DIRS      (1<<20)
+
+static index_t legacy_compute_index(char hash_value[], int radix)
+{
+    index_t index = 0;
+    int i;
+    int curr_byte;
+    index_t curr_mask, curr_value, curr_shift;
+    int num_useful_bytes, residual_useful_bits;
+
+    uint8_t bin_hash[SHA1_HASH_SIZE] = {0}; 
+    hex2binary(hash_value, HASH_LEN, bin_hash);
+
+    num_useful_bytes = radix/(sizeof(bin_hash[0])*8);
+    residual_useful_bits = radix%(sizeof(bin_hash[0])*8);
+    if ((residual_useful_bits != 0) || (num_useful_bytes>0))
+        num_useful_bytes += 1; 
+
+    for (i=0; i<num_useful_bytes-1; i++) {
+        curr_byte = bin_hash[SHA1_HASH_SIZE-1-i];
+        curr_shift = curr_byte<<(i*sizeof(bin_hash[0])*8);
+        index += curr_shift;
+    }
+
+    curr_byte = bin_hash[SHA1_HASH_SIZE-1-i];
+    curr_mask = (1<<residual_useful_bits) - 1;
+    curr_value = curr_byte & curr_mask;
+    curr_shift = curr_value<<(i*sizeof(bin_hash[0])*8);
+    index += curr_shift;
+
+    return index;
+}
+
+static index_t legacy_get_index_for_file(struct giga_mapping_t *mapping,
+                                         const char *filename)
+{
+    char hash[HASH_LEN+1] = {0};
+    giga_hash_name(filename, hash);
+
+    // the bitmap was scanned for the radix on every lookup
+    int highest = find_highest_index(mapping, (int)mapping->bitmap_len-1);
+    int curr_radix = get_radix_from_index(highest);
+    index_t index = legacy_compute_index(hash, curr_radix); 
+
+    while (get_bit_status(mapping, index) == 0) {
+        if (index > 0)
+            index = index - (int)(1 << ((int)(floor(log2((double)index)))));
+    }
+
+    return index;
+}
+
+// Placement of directories over "num_servers": most directories have one
+// partition, and the others 2..64 (as if they had split); returns the load 
+// of the busiest server relative to the mean, with every directory starting
+// on server 0 (the old placement) or on its hashed zeroth server.
+//
+static double placement_imbalance(unsigned int num_servers, int hashed)
+{
+    static unsigned long load[1024];
+    unsigned long total = 0, max = 0;
+    uint32_t rand = 12345;
+    struct giga_mapping_t mapping;
+    int d, i;
+
+    memset(load, 0, num_servers*sizeof(load[0]));
+    memset(&mapping, 0, sizeof(mapping));
+    mapping.server_count = num_servers;
+
+    for (d = 0; d < BENCH_NUM_DIRS; d++) {
+        rand = rand*1103515245 + 12345;
+        int num_partitions = ((rand >> 16) % 10 == 0) ? 
+                             2 << ((rand >> 8) % 6) : 1;
+
+        mapping.zeroth_server = hashed ? 
+                                giga_get_zeroth_server(d, num_servers) : 0;
+        for (i = 0; i < num_partitions; i++)
+            load[giga_get_server_for_index(&mapping, i)]++;
+        total += num_partitions;
+    }
+
+    for (i = 0; i < (int)num_servers; i++)
+        if (load[i] > max)
+            max = load[i];
+
+    return max / ((double)total / num_servers);
+}
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static char bench_names[BENCH_NUM_NAMES][32];
+static volatile index_t bench_sink;
+
+static void run_legacy(struct giga_mapping_t *mapping)
+{
+    int i;
+    for (i = 0; i < BENCH_NUM_NAMES; i++)
+        bench_sink += legacy_get_index_for_file(mapping, bench_names[i]);
+}
+
+static void run_single(struct giga_mapping_t *mapping)
+{
+    int i;
+    for (i = 0; i < BENCH_NUM_NAMES; i++)
+        bench_sink += giga_get_index_for_file(mapping, bench_names[i]);
+}
+
+// Lookups per second of "run", as the best of BENCH_NUM_RUNS timings of
+// BENCH_NUM_ROUNDS passes over all names (a single timing is too noisy on a
+// shared machine to compare the variants).
+//
+static double best_rate(struct giga_mapping_t *mapping,
+                        void (*run)(struct giga_mapping_t *mapping))
+{
+    double best = 0;
+    int r, j;
+
+    for (r = 0; r < BENCH_NUM_RUNS; r++) {
+        double start = now_sec();
+        for (j = 0; j < BENCH_NUM_ROUNDS; j++)
+            run(mapping);
+        double elapsed = now_sec() - start;
+        if ((r == 0) || (elapsed < best))
+            best = elapsed;
+    }
+
+    return (double)BENCH_NUM_NAMES * BENCH_NUM_ROUNDS / best;
+}
+
+int main()
+{
+    struct giga_mapping_t mapping;
+    index_t i;
+
+    log_fp = stderr;
+    sys_log_level = LOG_FATAL;
+
+    // a partially split directory: partitions 0..39 exist
+    giga_init_mapping(&mapping, -1, 0, 1);
+    for (i = 1; i < 40; i++)
+        giga_update_mapping(&mapping, i);
+
+    for (i = 0; i < BENCH_NUM_NAMES; i++)
+        snprintf(bench_names[i], sizeof(bench_names[i]), "file.%08d", i);
+
+    for (i = 0; i < BENCH_NUM_NAMES; i++) {
+        if (giga_get_index_for_file(&mapping, bench_names[i]) !=
+            legacy_get_index_for_file(&mapping, bench_names[i])) {
+            printf("MISMATCH for %s\n", bench_names[i]);
+            return 1;
+        }
+    }
+
+    double legacy = best_rate(&mapping, run_legacy);
+    double current = best_rate(&mapping, run_single);
+
+    mapping.hash_type = GIGA_HASH_MURMUR64;
+    double murmur = best_rate(&mapping, run_single);
+
+    printf("lookups: %d names x %d rounds (best of %d), "
+           "all partitions match\n",
+           BENCH_NUM_NAMES, BENCH_NUM_ROUNDS, BENCH_NUM_RUNS);
+    printf("  before (hex + log2):   %12.0f lookups/sec\n", legacy);
+    printf("  after  (binary + clz): %12.0f lookups/sec\n", current);
+    printf("  after  (murmur64):     %12.0f lookups/sec\n", murmur);
+
+    // a large directory whose highest partition sits just past a power of
+    // two, so the (doubled) bitmap has many empty words above it
+    giga_free_mapping(&mapping);
+    giga_init_mapping(&mapping, -1, 0, 1);
+    mapping.hash_type = GIGA_HASH_MURMUR64;
+    for (i = 1; i <= BENCH_LARGE_PARTITIONS; i++)
+        giga_update_mapping(&mapping, i);
+
+    printf("  large  (%d partitions): %9.0f lookups/sec\n", 
+           giga_get_num_partitions(&mapping), 
+           best_rate(&mapping, run_single));
+
+    giga_free_mapping(&mapping);
+
+    static const unsigned int servers[] = { 3, 8, 16, 64, 100 };
+    printf("placement: %d directories, busiest server / mean load\n",
+           BENCH_NUM_DIRS);
+    for (i = 0; i < (int)ARRAY_LEN(servers); i++)
+        printf("  %3u servers: zeroth=0 %6.2f   hashed %6.3f\n", servers[i],
+               placement_imbalance(servers[i], 0),
+               placement_imbalance(servers[i], 1));
+
+    return 0;
+}
+
+#endif /* GIGA_INDEX_BENCH */
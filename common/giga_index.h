@@ -8,48 +8,106 @@
 
 #include "sha.h"
 
-typedef unsigned char bitmap_t;         // Bitmap stored as array of "bitmap_t"
+typedef uint64_t bitmap_t;              // Bitmap stored as array of "bitmap_t"
 typedef int index_t;                    // Index is the position in the bitmap 
 
 #define HASH_NUM_BYTES 16                   //128-bit MD5 hash
 #define HASH_LEN    2*SHA1_HASH_SIZE        //bigger array for binary2hex
 
-#define MAX_RADIX 8 
+// A directory can grow to (1<<MAX_RADIX) partitions; the bitmap is allocated
+// on demand, so this only bounds the largest bitmap.
+//
+#define MAX_RADIX 20
 #define MIN_RADIX 0
 
-// Support different modes of splitting in GIGA+
+// Hash functions used to place file names into partitions. The hash id is
+// recorded in each directory's mapping (and carried over the wire), so every
+// client and server hashes a directory's names the same way.
+//
+#define GIGA_HASH_SHA1              1   // SHA-1 (original GIGA+ placement)
+#define GIGA_HASH_MURMUR64          2   // 64-bit MurmurHash64A (fast, non-crypto)
+
+#define GIGA_HASH_DEFAULT           GIGA_HASH_SHA1
+
+// Support different modes of splitting in GIGA+. The split type and its
+// bound are set per directory (see giga_set_split_policy()) and carried in
+// the mapping; the bound is the number of partitions per server:
+// -- NO_BOUND: keep splitting (up to MAX_RADIX).
+// -- NO_SPLITTING_EVER: pre-create (bound * server_count) partitions, and 
+//    never split them.
+// -- NUM_SERVERS_BOUND: split up to (bound * server_count) partitions.
+// -- NEXT_HIGHEST_POW2: split up to the next power of two that is at least
+//    (bound * server_count) partitions, so the tree stays balanced.
 //
 #define SPLIT_T_NO_BOUND            1111
 #define SPLIT_T_NO_SPLITTING_EVER   2222
 #define SPLIT_T_NUM_SERVERS_BOUND   3333
 #define SPLIT_T_NEXT_HIGHEST_POW2   4444
 
-#define SPLIT_TYPE                  SPLIT_T_NUM_SERVERS_BOUND
+#define SPLIT_T_DEFAULT             SPLIT_T_NUM_SERVERS_BOUND
+#define SPLIT_BOUND_DEFAULT         2 
 
-#define MAX_BKTS_PER_SERVER         2 
-
-// To avoid the signed and unsigned bit business, we just use the 7-bits in
-// every byte to represent the bitmap
+// In memory, the bitmap uses every bit of each 64-bit word: partition i is
+// bit (i % BITS_PER_MAP) of word (i / BITS_PER_MAP).
 //
-#define BITS_PER_MAP ((int)(sizeof(bitmap_t)*8)-1)
+#define BITS_PER_MAP ((int)(sizeof(bitmap_t)*8))
 
 #define MAX_BMAP_LEN ( (((1<<MAX_RADIX)%(BITS_PER_MAP)) == 0) ? ((1<<MAX_RADIX)/(BITS_PER_MAP)) : ((1<<MAX_RADIX)/(BITS_PER_MAP))+1 ) 
 
+// On the wire (since RPC version 2, see xdr_giga_mapping_t()), the bitmap 
+// is a counted array of bytes using only the low 7 bits of each byte, sent
+// only up to the byte holding the highest partition.
+//
+#define BITS_PER_WIRE_BYTE  7
+
+#define MAX_BMAP_WIRE_LEN ( ((1<<MAX_RADIX) + BITS_PER_WIRE_BYTE - 1) / BITS_PER_WIRE_BYTE )
+
 // Header table stored cached by each client/server. It consists of:
 // -- The bitmap indicating if a bucket is created or not.
-// -- Current radix of the header table.
+// -- Current radix of the header table, i.e. the number of bits in the 
+//    highest partition index; both are kept up to date on every change to
+//    the bitmap, so lookups never scan it.
+//
+// The bitmap is heap allocated and only as long as the highest partition
+// needs (at most MAX_BMAP_LEN); mappings must be copied with
+// giga_copy_mapping() and released with giga_free_mapping().
 //
 struct giga_mapping_t {
-    bitmap_t bitmap[MAX_BMAP_LEN];      // bitmap
+    bitmap_t *bitmap;                   // bitmap
+    unsigned int bitmap_len;            // number of elements in bitmap
     unsigned int curr_radix;            // current radix (depth in tree)
+    int highest_index;                  // highest partition in the bitmap
     unsigned int zeroth_server;
     unsigned int server_count;
+    unsigned int hash_type;             // GIGA_HASH_* used for file names
+    unsigned int split_type;            // SPLIT_T_* policy of the directory
+    unsigned int split_bound;           // partitions per server (if bounded)
 }; 
 
 // Hash the component name (hash_key) to return the hash value.
 //
 void giga_hash_name(const char *hash_key, char hash_value[]);
 
+// Hash a name with the hash function "hash_type"; the partition index is
+// taken from the low-order bits of the returned value.
+//
+uint64_t giga_hash_value(unsigned int hash_type, const char *name);
+
+// Return 1 if "hash_type" is a known GIGA_HASH_* id, 0 otherwise.
+//
+int giga_hash_supported(unsigned int hash_type);
+
+// Return the GIGA_HASH_* id of the hash named "name" (e.g., "sha1"), or 0 if
+// there is none.
+//
+unsigned int giga_hash_by_name(const char *name);
+
+// Zeroth server of a directory, from a hash of its id (the same on every 
+// host), so that directories (and the first partitions of their splits) 
+// are spread evenly over the "server_count" servers.
+//
+unsigned int giga_get_zeroth_server(int dir_id, unsigned int server_count);
+
 // Initialize the mapping table.
 //
 void giga_init_mapping(struct giga_mapping_t *mapping, int flag, 
@@ -59,8 +117,25 @@ void giga_init_mapping_from_bitmap(struct giga_mapping_t *mapping,
                                    unsigned int zeroth_server, 
                                    unsigned int server_count); 
 
+// Return 1 if "split_type" is a known SPLIT_T_* policy and "split_bound" is
+// valid for it, 0 otherwise.
+//
+int giga_split_supported(unsigned int split_type, unsigned int split_bound);
+
+// Set the split policy of a freshly initialized mapping (which uses 
+// SPLIT_T_DEFAULT); returns -1 if the policy is not valid. For 
+// SPLIT_T_NO_SPLITTING_EVER, this pre-creates all the partitions.
+//
+int giga_set_split_policy(struct giga_mapping_t *mapping,
+                          unsigned int split_type, unsigned int split_bound);
+
+// Release the memory held by a mapping's bitmap.
+//
+void giga_free_mapping(struct giga_mapping_t *mapping);
+
 // Copy one mapping structure into another; the integer flag tells if the 
-// the destination should be filled with zeros (if z == 0);
+// the destination should be filled with zeros (if z == 0); the destination
+// must be zero-filled or a valid mapping.
 //
 void giga_copy_mapping(struct giga_mapping_t *dest, struct giga_mapping_t *src, int z);
 
@@ -80,9 +155,44 @@ void giga_update_mapping_remove(struct giga_mapping_t *mapping, index_t index);
 //
 void giga_print_mapping(struct giga_mapping_t *mapping);
 
+// Verify that the cached radix and highest index match the bitmap; only
+// compiled in with DBG_INDEXING (a no-op otherwise).
+//
+void giga_check_mapping(struct giga_mapping_t *mapping);
+
+// Number of partitions (set bits) in the mapping.
+//
+int giga_get_num_partitions(struct giga_mapping_t *mapping);
+
+// Convert the bitmap to/from its 7-bits-per-byte wire format. 
+// - giga_bitmap_wire_len() returns the number of bytes needed; 
+// - giga_bitmap_to_wire() fills (zero-filled) "wire" of that length;
+// - giga_bitmap_from_wire() replaces the mapping's bitmap, returning -1 if 
+//   the wire bitmap is not valid.
+//
+int giga_bitmap_wire_len(struct giga_mapping_t *mapping);
+void giga_bitmap_to_wire(struct giga_mapping_t *mapping, 
+                         unsigned char wire[], int wire_len);
+int giga_bitmap_from_wire(struct giga_mapping_t *mapping, 
+                          const unsigned char wire[], int wire_len);
+
+// Convert the bitmap to/from big-endian 64-bit words (the format of the 
+// binary frames, see rpc_frame.h), in the same way as above:
+// - giga_bitmap_num_words() returns the number of words needed; 
+// - giga_bitmap_to_words() fills "words" (8 bytes each) of that length;
+// - giga_bitmap_from_words() replaces the mapping's bitmap, returning -1 if
+//   the words are not a valid bitmap.
+//
+int giga_bitmap_num_words(struct giga_mapping_t *mapping);
+void giga_bitmap_to_words(struct giga_mapping_t *mapping, 
+                          unsigned char words[], int num_words);
+int giga_bitmap_from_words(struct giga_mapping_t *mapping, 
+                           const unsigned char words[], int num_words);
+
 // Check whether a file needs to move to the new bucket created from a split.
 //
-int giga_file_migration_status(const char *filename, index_t new_index);   
+int giga_file_migration_status(struct giga_mapping_t *mapping,
+                               const char *filename, index_t new_index);   
 
 // Given the index of the overflow partition, return the index 
 // of the partition created after splitting that partition.
@@ -116,6 +226,9 @@ index_t giga_get_index_for_backup(index_t index);
 
 index_t get_split_index_for_newserver(index_t index);
 
+// Return 1 if the partition "old_index" may split under the mapping's split
+// policy, 0 otherwise.
+//
 int giga_is_splittable(struct giga_mapping_t *mapping, index_t old_index);
 
 #endif /* GIGA_INDEX_H */
@@ -2,6 +2,7 @@
 #include "common/connection.h"
 #include "common/debugging.h"
 #include "common/defaults.h"
+#include "common/giga_index.h"
 #include "common/options.h"
 
 #include <ctype.h>
@@ -69,11 +70,228 @@ void init_self_network_IDs()
 }
 
 
+/* Split policies, as named in the config file. */
+static const struct {
+    const char *name;
+    unsigned int split_type;
+} split_policies[] = {
+    { "no_bound",           SPLIT_T_NO_BOUND },
+    { "no_splitting_ever",  SPLIT_T_NO_SPLITTING_EVER },
+    { "num_servers_bound",  SPLIT_T_NUM_SERVERS_BOUND },
+    { "next_highest_pow2",  SPLIT_T_NEXT_HIGHEST_POW2 },
+};
+
+/* Server transports, as named in the config file. */
+static const struct {
+    const char *name;
+    transport_t transport;
+} transports[] = {
+    { "epoll",      TRANSPORT_EPOLL },
+    { "io_uring",   TRANSPORT_IO_URING },
+};
+
+/* LevelDB durability modes, as named in the config file. */
+static const struct {
+    const char *name;
+    ldb_durability_t durability;
+} ldb_durabilities[] = {
+    { "async",      LDB_DURABILITY_ASYNC },
+    { "group_sync", LDB_DURABILITY_GROUP_SYNC },
+    { "sync",       LDB_DURABILITY_SYNC },
+};
+
+/* LevelDB block compression, as named in the config file. */
+static const struct {
+    const char *name;
+    ldb_compression_t compression;
+} ldb_compressions[] = {
+    { "none",       LDB_COMPRESSION_NONE },
+    { "snappy",     LDB_COMPRESSION_SNAPPY },
+};
+
+static
+void init_default_split_policy()
+{
+    giga_options_t.split_type = SPLIT_T_DEFAULT;
+    giga_options_t.split_bound = SPLIT_BOUND_DEFAULT;
+}
+
+static
+void init_default_name_hash()
+{
+    giga_options_t.name_hash = DEFAULT_NAME_HASH;
+}
+
+static
+void init_default_cache_size()
+{
+    giga_options_t.cache_size = DEFAULT_CACHE_SIZE;
+}
+
+static
+void init_default_conn_pool_size()
+{
+    giga_options_t.conn_pool_size = DEFAULT_CONN_POOL_SIZE;
+}
+
+static
+void init_default_num_workers()
+{
+    giga_options_t.num_workers = DEFAULT_NUM_WORKERS;
+}
+
+static
+void init_default_transport()
+{
+    giga_options_t.transport = DEFAULT_TRANSPORT;
+}
+
+static
+void init_default_ldb_commit()
+{
+    giga_options_t.ldb_durability = DEFAULT_LDB_DURABILITY;
+    giga_options_t.ldb_group_max = DEFAULT_LDB_GROUP_MAX;
+    giga_options_t.ldb_group_delay = DEFAULT_LDB_GROUP_DELAY;
+}
+
+static
+void init_default_ldb_tuning()
+{
+    giga_options_t.ldb_bloom_bits = DEFAULT_LDB_BLOOM_BITS;
+    giga_options_t.ldb_cache_size = DEFAULT_LDB_CACHE_SIZE;
+    giga_options_t.ldb_write_buffer = DEFAULT_LDB_WRITE_BUFFER;
+    giga_options_t.ldb_block_size = DEFAULT_LDB_BLOCK_SIZE;
+    giga_options_t.ldb_paranoid_checks = DEFAULT_LDB_PARANOID_CHECKS;
+    giga_options_t.ldb_max_open_files = DEFAULT_LDB_MAX_OPEN_FILES;
+    giga_options_t.ldb_compression = DEFAULT_LDB_COMPRESSION;
+    giga_options_t.ldb_shards = DEFAULT_LDB_SHARDS;
+}
+
+/* Parse a "key=value" line of the config file. */
+static 
+void parse_setting(char *line)
+{
+    char *key = line;
+    char *value = strchr(line, '=');
+    unsigned int i;
+
+    *value++ = '\0';
+
+    if (strcmp(key, "split_policy") == 0) {
+        for (i = 0; i < sizeof(split_policies)/sizeof(split_policies[0]); i++) {
+            if (strcmp(value, split_policies[i].name) == 0) {
+                giga_options_t.split_type = split_policies[i].split_type;
+                break;
+            }
+        }
+        if (i == sizeof(split_policies)/sizeof(split_policies[0])) {
+            logMessage(LOG_FATAL, __func__, "unknown split_policy=%s", value);
+            exit(1);
+        }
+    }
+    else if (strcmp(key, "split_bound") == 0) {
+        giga_options_t.split_bound = (unsigned int)strtoul(value, NULL, 10);
+    }
+    else if (strcmp(key, "name_hash") == 0) {
+        if ((giga_options_t.name_hash = giga_hash_by_name(value)) == 0) {
+            logMessage(LOG_FATAL, __func__, "unknown name_hash=%s", value);
+            exit(1);
+        }
+    }
+    else if (strcmp(key, "cache_size") == 0) {
+        giga_options_t.cache_size = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(key, "conn_pool_size") == 0) {
+        giga_options_t.conn_pool_size = atoi(value);
+    }
+    else if (strcmp(key, "num_workers") == 0) {
+        giga_options_t.num_workers = atoi(value);
+    }
+    else if (strcmp(key, "transport") == 0) {
+        for (i = 0; i < sizeof(transports)/sizeof(transports[0]); i++) {
+            if (strcmp(value, transports[i].name) == 0) {
+                giga_options_t.transport = transports[i].transport;
+                break;
+            }
+        }
+        if (i == sizeof(transports)/sizeof(transports[0])) {
+            logMessage(LOG_FATAL, __func__, "unknown transport=%s", value);
+            exit(1);
+        }
+    }
+    else if (strcmp(key, "ldb_durability") == 0) {
+        for (i = 0; i < sizeof(ldb_durabilities)/sizeof(ldb_durabilities[0]); 
+             i++) {
+            if (strcmp(value, ldb_durabilities[i].name) == 0) {
+                giga_options_t.ldb_durability = ldb_durabilities[i].durability;
+                break;
+            }
+        }
+        if (i == sizeof(ldb_durabilities)/sizeof(ldb_durabilities[0])) {
+            logMessage(LOG_FATAL, __func__, 
+                       "unknown ldb_durability=%s", value);
+            exit(1);
+        }
+    }
+    else if (strcmp(key, "ldb_group_max") == 0) {
+        giga_options_t.ldb_group_max = atoi(value);
+    }
+    else if (strcmp(key, "ldb_group_delay") == 0) {
+        giga_options_t.ldb_group_delay = atoi(value);
+    }
+    else if (strcmp(key, "ldb_bloom_bits") == 0) {
+        giga_options_t.ldb_bloom_bits = atoi(value);
+    }
+    else if (strcmp(key, "ldb_cache_size") == 0) {
+        giga_options_t.ldb_cache_size = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(key, "ldb_write_buffer") == 0) {
+        giga_options_t.ldb_write_buffer = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(key, "ldb_block_size") == 0) {
+        giga_options_t.ldb_block_size = atoi(value);
+    }
+    else if (strcmp(key, "ldb_paranoid_checks") == 0) {
+        giga_options_t.ldb_paranoid_checks = atoi(value);
+    }
+    else if (strcmp(key, "ldb_max_open_files") == 0) {
+        giga_options_t.ldb_max_open_files = atoi(value);
+    }
+    else if (strcmp(key, "ldb_compression") == 0) {
+        for (i = 0; i < sizeof(ldb_compressions)/sizeof(ldb_compressions[0]); 
+             i++) {
+            if (strcmp(value, ldb_compressions[i].name) == 0) {
+                giga_options_t.ldb_compression = 
+                    ldb_compressions[i].compression;
+                break;
+            }
+        }
+        if (i == sizeof(ldb_compressions)/sizeof(ldb_compressions[0])) {
+            logMessage(LOG_FATAL, __func__, 
+                       "unknown ldb_compression=%s", value);
+            exit(1);
+        }
+    }
+    else if (strcmp(key, "ldb_shards") == 0) {
+        giga_options_t.ldb_shards = atoi(value);
+    }
+    else {
+        logMessage(LOG_FATAL, __func__, "unknown setting: %s", key);
+        exit(1);
+    }
+
+    logMessage(LOG_TRACE, __func__, "%s=%s", key, value);
+}
+
+/* The config file lists one server address per line; it can also have
+ * "key=value" settings, blank lines and "#" comments.
+ */
 static 
 void parse_serverlist_file(const char *serverlist_file)
 {
     FILE *conf_fp;
     char ip_addr[MAX_LEN];
+    size_t len;
 
     if ((conf_fp = fopen(serverlist_file, "r+")) == NULL) {
         logMessage(LOG_FATAL, __func__, "err_open(conf=%s).", serverlist_file);
@@ -91,7 +309,16 @@ void parse_serverlist_file(const char *serverlist_file)
 
     logMessage(LOG_TRACE, __func__, "SERVER_LIST=...");
     while (fgets(ip_addr, MAX_LEN, conf_fp) != NULL) {
-        ip_addr[strlen(ip_addr)-1]='\0';
+        len = strlen(ip_addr);
+        while ((len > 0) && isspace((unsigned char)ip_addr[len-1]))
+            ip_addr[--len] = '\0';
+
+        if ((len == 0) || (ip_addr[0] == '#'))
+            continue;
+        if (strchr(ip_addr, '=') != NULL) {
+            parse_setting(ip_addr);
+            continue;
+        }
 
         int i = giga_options_t.num_servers;
         giga_options_t.serverlist[i] = (char*)malloc(sizeof(char)*MAX_LEN);
@@ -113,6 +340,43 @@ void parse_serverlist_file(const char *serverlist_file)
 
     logMessage(LOG_TRACE, __func__, "NUM_SERVERS=%d",giga_options_t.num_servers);
 
+    if (!giga_split_supported(giga_options_t.split_type, 
+                              giga_options_t.split_bound)) {
+        logMessage(LOG_FATAL, __func__, "invalid split_bound=%u", 
+                   giga_options_t.split_bound);
+        exit(1);
+    }
+    if ((giga_options_t.ldb_group_max < 1) || 
+        (giga_options_t.ldb_group_delay < 0)) {
+        logMessage(LOG_FATAL, __func__, "invalid ldb_group_max=%d or "
+                   "ldb_group_delay=%d", giga_options_t.ldb_group_max,
+                   giga_options_t.ldb_group_delay);
+        exit(1);
+    }
+    if ((giga_options_t.ldb_bloom_bits < 0) || 
+        (giga_options_t.ldb_write_buffer == 0) ||
+        (giga_options_t.ldb_max_open_files < 1)) {
+        logMessage(LOG_FATAL, __func__, "invalid ldb_bloom_bits=%d, "
+                   "ldb_write_buffer=%lu or ldb_max_open_files=%d",
+                   giga_options_t.ldb_bloom_bits, 
+                   giga_options_t.ldb_write_buffer,
+                   giga_options_t.ldb_max_open_files);
+        exit(1);
+    }
+    if ((giga_options_t.ldb_block_size < 1) || 
+        ((giga_options_t.ldb_paranoid_checks != 0) && 
+         (giga_options_t.ldb_paranoid_checks != 1))) {
+        logMessage(LOG_FATAL, __func__, "invalid ldb_block_size=%d or "
+                   "ldb_paranoid_checks=%d", giga_options_t.ldb_block_size,
+                   giga_options_t.ldb_paranoid_checks);
+        exit(1);
+    }
+    if (giga_options_t.ldb_shards < 1) {
+        logMessage(LOG_FATAL, __func__, "invalid ldb_shards=%d", 
+                   giga_options_t.ldb_shards);
+        exit(1);
+    }
+
     fclose(conf_fp);
 }
 
@@ -128,6 +392,14 @@ void initGIGAsetting(int process_type, const char *serverlist_file)
 
     init_default_backends();
     init_self_network_IDs();
+    init_default_split_policy();
+    init_default_name_hash();
+    init_default_cache_size();
+    init_default_conn_pool_size();
+    init_default_num_workers();
+    init_default_transport();
+    init_default_ldb_commit();
+    init_default_ldb_tuning();
     parse_serverlist_file(serverlist_file);
 
     print_settings();
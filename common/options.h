@@ -15,6 +15,22 @@ typedef enum backends {
     BACKEND_RPC_LEVELDB
 } backend_t;
 
+typedef enum transports {
+    TRANSPORT_EPOLL,            /* epoll loop and send()s */
+    TRANSPORT_IO_URING          /* io_uring (epoll if the kernel lacks it) */
+} transport_t;
+
+typedef enum ldb_durability {
+    LDB_DURABILITY_ASYNC,       /* grouped writes, not synced */
+    LDB_DURABILITY_GROUP_SYNC,  /* grouped writes, one sync per group */
+    LDB_DURABILITY_SYNC         /* every mutation synced on its own */
+} ldb_durability_t;
+
+typedef enum ldb_compression {
+    LDB_COMPRESSION_NONE,
+    LDB_COMPRESSION_SNAPPY
+} ldb_compression_t;
+
 #define GIGA_CLIENT 12345
 #define GIGA_SERVER 67890
 
@@ -36,11 +52,30 @@ struct giga_options {
    int num_servers;             /* num of servers in the server list */
    const char **serverlist;     /* server list GIGA+ nodes */
    
+   unsigned int split_type;     /* split policy (SPLIT_T_*) of new dirs */
+   unsigned int split_bound;    /* partitions per server for that policy */
+   unsigned int name_hash;      /* GIGA_HASH_* placing names of new dirs */
+
+   unsigned long cache_size;    /* bytes of directory cache (0 = no limit) */
+   int conn_pool_size;          /* max RPC connections to each server */
    
    /* 
     * Server specific parameters 
     * */
    int serverID;                       /* ID of the current server */
+   int num_workers;                    /* threads running RPC handlers */
+   transport_t transport;              /* how client connections are served */
+   ldb_durability_t ldb_durability;    /* how LevelDB writes are committed */
+   int ldb_group_max;                  /* max entries in a group commit */
+   int ldb_group_delay;                /* usecs a group waits to grow */
+   int ldb_bloom_bits;                 /* bloom filter bits/key (0 = none) */
+   unsigned long ldb_cache_size;       /* bytes of LevelDB block cache */
+   unsigned long ldb_write_buffer;     /* bytes of LevelDB memtable */
+   int ldb_block_size;                 /* bytes of LevelDB table blocks */
+   int ldb_paranoid_checks;            /* LevelDB checks its data (0/1) */
+   int ldb_max_open_files;             /* LevelDB table files kept open */
+   ldb_compression_t ldb_compression;  /* of LevelDB blocks */
+   int ldb_shards;                     /* LevelDB instances of the server */
 
    /* 
     * Client-specific parameters.
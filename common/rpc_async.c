@@ -0,0 +1,603 @@
+#include "rpc_async.h"
+#include "rpc_frame.h"
+#include "debugging.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Calls use the Sun RPC wire format (record-marked call and reply messages
+ * on a TCP stream), so the server side is the usual rpcgen dispatcher; only
+ * the client differs from clnttcp_create(), which sends one call and waits
+ * for its reply. Calls can also be sent in binary frames (see rpc_frame.h),
+ * to servers that serve them; the replies come back in frames too.
+ *
+ * A call's slot in the window is picked by its xid, so xids are allocated in
+ * order and a sender waits while the slot of the next xid is still in use,
+ * which also bounds the calls in flight.
+ *
+ * Each call has a deadline, on the monotonic clock. A sender waits for its 
+ * slot until then, and the reader fails the calls that are still waiting 
+ * for their replies after it: its socket has a receive timeout, so that it 
+ * looks for expired calls (about once per EXPIRE_INTERVAL) even when no 
+ * replies come.
+ */
+
+#define RPC_ASYNC_MASK      (RPC_ASYNC_WINDOW - 1)
+#define CALL_HDR_MAX        64          /* call header with AUTH_NONE */
+#define LAST_FRAG           0x80000000u
+#define READ_BUF_SIZE       65536
+#define EXPIRE_INTERVAL     1           /* seconds */
+
+#if (RPC_ASYNC_WINDOW & RPC_ASYNC_MASK) != 0
+#error "RPC_ASYNC_WINDOW must be a power of 2"
+#endif
+
+struct async_call {
+    u_int32_t xid;
+    int busy;
+    xdrproc_t xresult;
+    rpc_async_decode decode;    // for frames
+    void *result;
+    rpc_async_cb cb;
+    void *cb_arg;
+    struct timespec deadline;
+};
+
+struct rpc_async_conn {
+    int sock;
+    u_long prog;
+    u_long vers;
+    pthread_t reader;
+
+    pthread_mutex_t send_mtx;   // orders xids and the writes of calls
+    u_int32_t next_xid;
+
+    pthread_mutex_t mtx;        // protects the call slots, "error", "refs"
+    pthread_cond_t slot_free;
+    int error;
+    int refs;
+    struct async_call calls[RPC_ASYNC_WINDOW];
+
+    /* buffered input of the reader thread */
+    char *in;
+    size_t in_start;
+    size_t in_end;
+    time_t next_expire;
+};
+
+static void* reader_thread(void *arg);
+static void expire_calls(struct rpc_async_conn *conn);
+
+static int expired(const struct timespec *now, const struct timespec *deadline)
+{
+    return ((now->tv_sec > deadline->tv_sec) ||
+            ((now->tv_sec == deadline->tv_sec) && 
+             (now->tv_nsec >= deadline->tv_nsec)));
+}
+
+static int write_all(int sock, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(struct rpc_async_conn *conn, char *buf, size_t len)
+{
+    while (len > 0) {
+        if (conn->in_start == conn->in_end) {
+            ssize_t n = recv(conn->sock, conn->in, READ_BUF_SIZE, 0);
+            expire_calls(conn);
+            if (n < 0 && 
+                (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+            if (n <= 0)
+                return -EIO;
+            conn->in_start = 0;
+            conn->in_end = n;
+        }
+        size_t avail = conn->in_end - conn->in_start;
+        if (avail > len)
+            avail = len;
+        memcpy(buf, conn->in + conn->in_start, avail);
+        conn->in_start += avail;
+        buf += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+/* read one record (all of its fragments), or a frame, into *buf */
+static int read_record(struct rpc_async_conn *conn,
+                       char **buf, size_t *cap, size_t *len, int *frame)
+{
+    u_int32_t mark;
+
+    *len = 0;
+    *frame = 0;
+    do {
+        if (read_all(conn, (char*)&mark, sizeof(mark)) < 0)
+            return -EIO;
+        mark = ntohl(mark);
+
+        size_t frag_len = mark & ~LAST_FRAG;
+        if (GIGA_FRAME_IS_MARK(mark)) {
+            if (*len > 0)
+                return -EIO;    // not in the middle of a record
+            *frame = 1;
+            frag_len = GIGA_FRAME_LEN(mark);
+            mark = LAST_FRAG;
+        }
+        if (*len + frag_len > *cap) {
+            size_t new_cap = *cap * 2;
+            while (new_cap < *len + frag_len)
+                new_cap *= 2;
+            char *new_buf = realloc(*buf, new_cap);
+            if (new_buf == NULL)
+                return -ENOMEM;
+            *buf = new_buf;
+            *cap = new_cap;
+        }
+        if (read_all(conn, *buf + *len, frag_len) < 0)
+            return -EIO;
+        *len += frag_len;
+    } while (!(mark & LAST_FRAG));
+
+    return 0;
+}
+
+struct rpc_async_conn* rpc_async_connect(const char *host, int port,
+                                         u_long prog, u_long vers)
+{
+    struct addrinfo hints, *info, *p;
+    struct rpc_async_conn *conn;
+    struct timeval to = {EXPIRE_INTERVAL, 0};
+    pthread_condattr_t attr;
+    char service[16];
+    int gai_result;
+    int one = 1;
+
+    // connections are opened by concurrent callers (getaddrinfo() is 
+    // thread-safe, gethostbyname() is not)
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if ((gai_result = getaddrinfo(host, service, &hints, &info)) != 0) {
+        logMessage(LOG_ERR, __func__, "unable to resolve %s: %s", 
+                   host, gai_strerror(gai_result));
+        return NULL;
+    }
+
+    conn = calloc(1, sizeof(struct rpc_async_conn));
+    if (conn == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    conn->in = malloc(READ_BUF_SIZE);
+    if (conn->in == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    conn->sock = -1;
+    for (p = info; (p != NULL) && (conn->sock < 0); p = p->ai_next) {
+        conn->sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if ((conn->sock >= 0) && 
+            (connect(conn->sock, p->ai_addr, p->ai_addrlen) < 0)) {
+            close(conn->sock);
+            conn->sock = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (conn->sock < 0) {
+        logMessage(LOG_ERR, __func__,
+                   "connect(%s) failed: %s", host, strerror(errno));
+        goto err;
+    }
+    // calls are small and shouldn't wait for the replies of earlier ones
+    setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // the reader wakes up to expire calls
+    setsockopt(conn->sock, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
+
+    conn->prog = prog;
+    conn->vers = vers;
+    conn->next_xid = (u_int32_t)random();
+    conn->refs = 1;
+    pthread_mutex_init(&conn->send_mtx, NULL);
+    pthread_mutex_init(&conn->mtx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&conn->slot_free, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&conn->reader, NULL, reader_thread, conn) != 0) {
+        logMessage(LOG_ERR, __func__, "pthread_create() failed");
+        goto err;
+    }
+
+    return conn;
+
+err:
+    if (conn->sock >= 0)
+        close(conn->sock);
+    free(conn->in);
+    free(conn);
+    return NULL;
+}
+
+void rpc_async_close(struct rpc_async_conn *conn)
+{
+    shutdown(conn->sock, SHUT_RDWR);    // the reader fails the pending calls
+    pthread_join(conn->reader, NULL);
+
+    rpc_async_release(conn);
+}
+
+void rpc_async_hold(struct rpc_async_conn *conn)
+{
+    pthread_mutex_lock(&conn->mtx);
+    conn->refs++;
+    pthread_mutex_unlock(&conn->mtx);
+}
+
+void rpc_async_release(struct rpc_async_conn *conn)
+{
+    int refs;
+
+    pthread_mutex_lock(&conn->mtx);
+    refs = --conn->refs;
+    pthread_mutex_unlock(&conn->mtx);
+    if (refs > 0)
+        return;
+
+    // the last holder is gone, and so is the reader (see rpc_async_close())
+    close(conn->sock);
+    pthread_mutex_destroy(&conn->send_mtx);
+    pthread_mutex_destroy(&conn->mtx);
+    pthread_cond_destroy(&conn->slot_free);
+    free(conn->in);
+    free(conn);
+}
+
+int rpc_async_failed(struct rpc_async_conn *conn)
+{
+    int error;
+
+    pthread_mutex_lock(&conn->mtx);
+    error = conn->error;
+    pthread_mutex_unlock(&conn->mtx);
+
+    return error;
+}
+
+/* Take the slot of the next xid for "req" (its result and callback, with
+ * the call's deadline), waiting for it if it is still in use; called with 
+ * "send_mtx" held, which the caller keeps until the call is sent. Returns 
+ * 0 and sets the xid of "req", or -errno. */
+static int start_call(struct rpc_async_conn *conn, struct async_call *req)
+{
+    u_int32_t xid = conn->next_xid;
+    struct async_call *call = &conn->calls[xid & RPC_ASYNC_MASK];
+    int ret = 0;
+
+    pthread_mutex_lock(&conn->mtx);
+    while (call->busy && !conn->error && (ret == 0))
+        ret = -pthread_cond_timedwait(&conn->slot_free, &conn->mtx, 
+                                      &req->deadline);
+    if (conn->error || call->busy) {
+        ret = conn->error ? -EIO : -ETIMEDOUT;
+        pthread_mutex_unlock(&conn->mtx);
+        return ret;
+    }
+    req->xid = xid;
+    req->busy = 1;
+    *call = *req;
+    pthread_mutex_unlock(&conn->mtx);
+    conn->next_xid++;
+
+    return 0;
+}
+
+/* After sending call "xid" failed with "ret": give its slot back, unless
+ * the reader already failed the call (then its callback ran, and the call
+ * counts as sent). Returns the status of the call. */
+static int end_failed_call(struct rpc_async_conn *conn, u_int32_t xid, int ret)
+{
+    struct async_call *call = &conn->calls[xid & RPC_ASYNC_MASK];
+
+    pthread_mutex_lock(&conn->mtx);
+    if (call->busy && call->xid == xid) {
+        call->busy = 0;
+        pthread_cond_broadcast(&conn->slot_free);
+    }
+    else
+        ret = 0;
+    pthread_mutex_unlock(&conn->mtx);
+
+    return ret;
+}
+
+int rpc_async_call(struct rpc_async_conn *conn, u_long proc,
+                   xdrproc_t xargs, void *args,
+                   xdrproc_t xresult, void *result,
+                   rpc_async_cb cb, void *cb_arg)
+{
+    struct rpc_msg msg;
+    struct async_call call;
+    XDR xdrs;
+    int ret = 0;
+
+    memset(&call, 0, sizeof(call));
+    call.xresult = xresult;
+    call.result = result;
+    call.cb = cb;
+    call.cb_arg = cb_arg;
+    clock_gettime(CLOCK_MONOTONIC, &call.deadline);
+    call.deadline.tv_sec += RPC_ASYNC_TIMEOUT;
+
+    size_t size = sizeof(u_int32_t) + CALL_HDR_MAX + xdr_sizeof(xargs, args);
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    pthread_mutex_lock(&conn->send_mtx);
+    if ((ret = start_call(conn, &call)) < 0)
+        goto out;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.rm_xid = call.xid;
+    msg.rm_direction = CALL;
+    msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+    msg.rm_call.cb_prog = conn->prog;
+    msg.rm_call.cb_vers = conn->vers;
+    msg.rm_call.cb_proc = proc;
+    msg.rm_call.cb_cred = _null_auth;
+    msg.rm_call.cb_verf = _null_auth;
+
+    xdrmem_create(&xdrs, buf + sizeof(u_int32_t),
+                  size - sizeof(u_int32_t), XDR_ENCODE);
+    if (!xdr_callmsg(&xdrs, &msg) || !xargs(&xdrs, args)) {
+        logMessage(LOG_ERR, __func__, "encoding call (proc=%lu) failed", proc);
+        ret = -EINVAL;
+    }
+    else {
+        u_int32_t len = xdr_getpos(&xdrs);
+        u_int32_t mark = htonl(LAST_FRAG | len);
+        memcpy(buf, &mark, sizeof(mark));
+        ret = write_all(conn->sock, buf, sizeof(mark) + len);
+    }
+    xdr_destroy(&xdrs);
+
+    if (ret < 0)
+        ret = end_failed_call(conn, call.xid, ret);
+
+out:
+    pthread_mutex_unlock(&conn->send_mtx);
+    free(buf);
+    return ret;
+}
+
+int rpc_async_frame_call(struct rpc_async_conn *conn, char *frame, size_t len,
+                         rpc_async_decode decode, void *result,
+                         rpc_async_cb cb, void *cb_arg)
+{
+    struct async_call call;
+    u_int32_t mark, xid;
+    int ret;
+
+    assert((len >= GIGA_FRAME_HDR_SIZE) && 
+           (len - sizeof(mark) <= GIGA_FRAME_MAX_LEN));
+
+    memset(&call, 0, sizeof(call));
+    call.decode = decode;
+    call.result = result;
+    call.cb = cb;
+    call.cb_arg = cb_arg;
+    clock_gettime(CLOCK_MONOTONIC, &call.deadline);
+    call.deadline.tv_sec += RPC_ASYNC_TIMEOUT;
+
+    pthread_mutex_lock(&conn->send_mtx);
+    if ((ret = start_call(conn, &call)) == 0) {
+        mark = htonl(GIGA_FRAME_MARK(len - sizeof(mark)));
+        xid = htonl(call.xid);
+        memcpy(frame, &mark, sizeof(mark));
+        memcpy(frame + sizeof(mark), &xid, sizeof(xid));
+        if ((ret = write_all(conn->sock, frame, len)) < 0)
+            ret = end_failed_call(conn, call.xid, ret);
+    }
+    pthread_mutex_unlock(&conn->send_mtx);
+
+    return ret;
+}
+
+/* decode the reply in "buf" (a record, or the frame after its mark) into 
+ * the result of its call, and complete it */
+static void complete_call(struct rpc_async_conn *conn, 
+                          char *buf, size_t len, int frame)
+{
+    struct async_call call;
+    struct rpc_msg msg;
+    u_int32_t xid;
+    XDR xdrs;
+    int status = 0;
+
+    if (len < sizeof(xid))
+        return;
+    memcpy(&xid, buf, sizeof(xid));
+    xid = ntohl(xid);
+
+    pthread_mutex_lock(&conn->mtx);
+    call = conn->calls[xid & RPC_ASYNC_MASK];
+    pthread_mutex_unlock(&conn->mtx);
+    if (!call.busy || call.xid != xid) {
+        logMessage(LOG_ERR, __func__, "reply to unknown call (xid=%u)", xid);
+        return;
+    }
+
+    if ((call.decode != NULL) != frame) {
+        logMessage(LOG_ERR, __func__, "reply (xid=%u) in the wrong format", xid);
+        status = -EIO;
+        goto done;
+    }
+    if (frame) {
+        if (call.decode(call.result, buf + sizeof(xid), 
+                        len - sizeof(xid)) < 0) {
+            logMessage(LOG_ERR, __func__, "decoding reply (xid=%u) failed", xid);
+            status = -EIO;
+        }
+        goto done;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.acpted_rply.ar_verf = _null_auth;
+    msg.acpted_rply.ar_results.where = call.result;
+    msg.acpted_rply.ar_results.proc = call.xresult;
+
+    xdrmem_create(&xdrs, buf, len, XDR_DECODE);
+    if (!xdr_replymsg(&xdrs, &msg)) {
+        logMessage(LOG_ERR, __func__, "decoding reply (xid=%u) failed", xid);
+        status = -EIO;
+    }
+    else if (msg.rm_reply.rp_stat != MSG_ACCEPTED ||
+             msg.acpted_rply.ar_stat != SUCCESS) {
+        logMessage(LOG_ERR, __func__, "call (xid=%u) was not successful", xid);
+        status = -EIO;
+    }
+    xdr_destroy(&xdrs);
+
+done:
+    pthread_mutex_lock(&conn->mtx);
+    conn->calls[xid & RPC_ASYNC_MASK].busy = 0;
+    pthread_cond_broadcast(&conn->slot_free);
+    pthread_mutex_unlock(&conn->mtx);
+
+    call.cb(call.cb_arg, status);
+}
+
+static void* reader_thread(void *arg)
+{
+    struct rpc_async_conn *conn = (struct rpc_async_conn*)arg;
+    size_t cap = READ_BUF_SIZE, len;
+    char *buf = malloc(cap);
+    int i, frame;
+
+    if (buf == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    while (read_record(conn, &buf, &cap, &len, &frame) == 0)
+        complete_call(conn, buf, len, frame);
+    free(buf);
+
+    // the connection is gone: fail the calls in flight, and any new ones
+    pthread_mutex_lock(&conn->mtx);
+    conn->error = 1;
+    pthread_cond_broadcast(&conn->slot_free);
+    pthread_mutex_unlock(&conn->mtx);
+
+    for (i = 0; i < RPC_ASYNC_WINDOW; i++) {
+        struct async_call call;
+
+        pthread_mutex_lock(&conn->mtx);
+        call = conn->calls[i];
+        conn->calls[i].busy = 0;
+        pthread_mutex_unlock(&conn->mtx);
+
+        if (call.busy)
+            call.cb(call.cb_arg, -EIO);
+    }
+
+    return NULL;
+}
+
+/* Fail the calls that are past their deadlines; called by the reader (so 
+ * that a reply is never decoded into the result of a failed call). */
+static void expire_calls(struct rpc_async_conn *conn)
+{
+    struct timespec now;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < conn->next_expire)
+        return;
+    conn->next_expire = now.tv_sec + EXPIRE_INTERVAL;
+
+    for (i = 0; i < RPC_ASYNC_WINDOW; i++) {
+        struct async_call call;
+
+        pthread_mutex_lock(&conn->mtx);
+        call = conn->calls[i];
+        if (call.busy && expired(&now, &call.deadline)) {
+            conn->calls[i].busy = 0;
+            pthread_cond_broadcast(&conn->slot_free);
+        }
+        else
+            call.busy = 0;
+        pthread_mutex_unlock(&conn->mtx);
+
+        if (call.busy) {
+            logMessage(LOG_ERR, __func__, "call (xid=%u) timed out", call.xid);
+            call.cb(call.cb_arg, -ETIMEDOUT);
+        }
+    }
+}
+
+void rpc_future_init(struct rpc_future *future)
+{
+    pthread_mutex_init(&future->mtx, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    future->done = 0;
+    future->status = 0;
+}
+
+void rpc_future_destroy(struct rpc_future *future)
+{
+    pthread_mutex_destroy(&future->mtx);
+    pthread_cond_destroy(&future->cond);
+}
+
+int rpc_future_wait(struct rpc_future *future)
+{
+    pthread_mutex_lock(&future->mtx);
+    while (!future->done)
+        pthread_cond_wait(&future->cond, &future->mtx);
+    pthread_mutex_unlock(&future->mtx);
+
+    return future->status;
+}
+
+void rpc_future_complete(void *arg, int status)
+{
+    struct rpc_future *future = (struct rpc_future*)arg;
+
+    pthread_mutex_lock(&future->mtx);
+    future->status = status;
+    future->done = 1;
+    pthread_cond_signal(&future->cond);
+    pthread_mutex_unlock(&future->mtx);
+}
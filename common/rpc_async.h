@@ -0,0 +1,78 @@
+#ifndef RPC_ASYNC_H
+#define RPC_ASYNC_H
+
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+/*
+ * Asynchronous (pipelined) RPC client: calls on a connection are tagged with
+ * their transaction id (xid), and up to RPC_ASYNC_WINDOW of them can be in
+ * flight at once; a reader thread matches replies to calls by their xid,
+ * decodes the results and completes the calls.
+ *
+ * Completion callbacks run on the reader thread of the connection, so they
+ * must be short and must not make calls on the same connection (which could
+ * wait for the window, and so for the reader); use a future to handle the
+ * result from the thread that made the call.
+ */
+
+#define RPC_ASYNC_WINDOW    1024    /* calls in flight per connection */
+#define RPC_ASYNC_TIMEOUT   60      /* seconds before a call fails */
+
+struct rpc_async_conn;
+
+/* "status" is 0 if "result" was decoded, or -errno if the call failed */
+typedef void (*rpc_async_cb)(void *cb_arg, int status);
+
+/* A future completes once; rpc_future_wait() returns the call's status. It
+ * needs no timeout of its own: a call with no reply by its deadline is 
+ * failed (with -ETIMEDOUT) by the reader, which completes the future. */
+struct rpc_future {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int done;
+    int status;
+};
+
+/* connect to "host" (returns NULL on error), and close the connection:
+ * calls still in flight fail with -EIO. The connection is freed once the 
+ * references taken with rpc_async_hold() are released too. */
+struct rpc_async_conn* rpc_async_connect(const char *host, int port,
+                                         u_long prog, u_long vers);
+void rpc_async_close(struct rpc_async_conn *conn);
+void rpc_async_hold(struct rpc_async_conn *conn);
+void rpc_async_release(struct rpc_async_conn *conn);
+
+/* true once the connection is lost (all of its calls then fail) */
+int rpc_async_failed(struct rpc_async_conn *conn);
+
+/* Send call "proc" with "args", and return without waiting for the reply
+ * (but waiting for a free slot if the window is full); "result" (zeroed by
+ * the caller) is filled in before "cb" runs. The call has RPC_ASYNC_TIMEOUT
+ * seconds, from now, to get its slot and its reply. Returns 0, or -errno if
+ * the call could not be sent (then "cb" is not called). */
+int rpc_async_call(struct rpc_async_conn *conn, u_long proc,
+                   xdrproc_t xargs, void *args,
+                   xdrproc_t xresult, void *result,
+                   rpc_async_cb cb, void *cb_arg);
+
+/* Decode the body of a reply frame (see rpc_frame.h) into "result"; 
+ * returns 0, or -1 if it is not valid (the call then fails with -EIO). */
+typedef int (*rpc_async_decode)(void *result, const char *buf, size_t len);
+
+/* Send a call in a binary frame, to a server that serves them: "frame" has
+ * "len" bytes, the body of the call after the first GIGA_FRAME_HDR_SIZE 
+ * (the mark and the xid, filled in here). "decode" runs on the body of the
+ * reply before "cb" does; otherwise, this works like rpc_async_call(). */
+int rpc_async_frame_call(struct rpc_async_conn *conn, char *frame, size_t len,
+                         rpc_async_decode decode, void *result,
+                         rpc_async_cb cb, void *cb_arg);
+
+void rpc_future_init(struct rpc_future *future);
+void rpc_future_destroy(struct rpc_future *future);
+int rpc_future_wait(struct rpc_future *future);
+
+/* an rpc_async_cb completing the future passed as "cb_arg" */
+void rpc_future_complete(void *future, int status);
+
+#endif /* RPC_ASYNC_H */
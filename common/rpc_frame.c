@@ -0,0 +1,236 @@
+#include "rpc_frame.h"
+#include "giga_index.h"
+#include "defaults.h"
+
+#include <errno.h>
+#include <string.h>
+
+static char* put_u32(char *buf, uint32_t val)
+{
+    unsigned char *p = (unsigned char *)buf;
+
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+    return buf + 4;
+}
+
+static char* put_u64(char *buf, uint64_t val)
+{
+    buf = put_u32(buf, (uint32_t)(val >> 32));
+    return put_u32(buf, (uint32_t)val);
+}
+
+static const char* get_u32(const char *buf, uint32_t *val)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    *val = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+    return buf + 4;
+}
+
+static const char* get_u64(const char *buf, uint64_t *val)
+{
+    uint32_t hi, lo;
+
+    buf = get_u32(buf, &hi);
+    buf = get_u32(buf, &lo);
+    *val = ((uint64_t)hi << 32) | lo;
+    return buf;
+}
+
+size_t giga_frame_call_size(const char *path)
+{
+    return GIGA_FRAME_CALL_SIZE + strlen(path) + 1;
+}
+
+void giga_frame_put_call(char *buf, int proc,
+                         int dir_id, const char *path, mode_t mode)
+{
+    size_t path_len = strlen(path) + 1;
+
+    buf = put_u32(buf, proc);
+    buf = put_u32(buf, dir_id);
+    buf = put_u32(buf, mode);
+    buf = put_u32(buf, path_len);
+    memcpy(buf, path, path_len);
+}
+
+int giga_frame_get_call(char *buf, size_t len, struct giga_frame_call *call)
+{
+    uint32_t proc, dir_id, mode, path_len;
+    const char *p = buf;
+
+    if (len < GIGA_FRAME_CALL_SIZE)
+        return -1;
+    p = get_u32(p, &proc);
+    p = get_u32(p, &dir_id);
+    p = get_u32(p, &mode);
+    p = get_u32(p, &path_len);
+
+    // the path (with its NUL) is the rest of the frame
+    if ((path_len == 0) || (path_len > MAX_LEN) ||
+        (path_len != len - GIGA_FRAME_CALL_SIZE) ||
+        (strnlen(p, path_len) != path_len - 1))
+        return -1;
+
+    call->proc = proc;
+    call->dir_id = dir_id;
+    call->mode = mode;
+    call->path = buf + GIGA_FRAME_CALL_SIZE;
+
+    return 0;
+}
+
+static int reply_record(giga_result_t *result, struct stat *statbuf)
+{
+    if (result->errnum == -EAGAIN)
+        return GIGA_FRAME_REC_MAPPING;
+    if ((result->errnum == 0) && (statbuf != NULL))
+        return GIGA_FRAME_REC_STAT;
+    return GIGA_FRAME_REC_NONE;
+}
+
+size_t giga_frame_reply_size(giga_result_t *result, struct stat *statbuf)
+{
+    struct giga_mapping_t *mapping = &result->giga_result_t_u.bitmap;
+
+    switch (reply_record(result, statbuf)) {
+        case GIGA_FRAME_REC_MAPPING:
+            return GIGA_FRAME_REPLY_SIZE + GIGA_FRAME_MAPPING_SIZE +
+                   giga_bitmap_num_words(mapping)*sizeof(bitmap_t);
+        case GIGA_FRAME_REC_STAT:
+            return GIGA_FRAME_REPLY_SIZE + GIGA_FRAME_STAT_SIZE;
+        default:
+            return GIGA_FRAME_REPLY_SIZE;
+    }
+}
+
+static char* put_stat(char *buf, struct stat *st)
+{
+    buf = put_u64(buf, st->st_dev);
+    buf = put_u64(buf, st->st_ino);
+    buf = put_u32(buf, st->st_mode);
+    buf = put_u32(buf, st->st_nlink);
+    buf = put_u32(buf, st->st_uid);
+    buf = put_u32(buf, st->st_gid);
+    buf = put_u64(buf, st->st_rdev);
+    buf = put_u64(buf, st->st_size);
+    buf = put_u32(buf, st->st_blksize);
+    buf = put_u64(buf, st->st_blocks);
+    buf = put_u64(buf, st->st_atim.tv_sec);
+    buf = put_u32(buf, st->st_atim.tv_nsec);
+    buf = put_u64(buf, st->st_mtim.tv_sec);
+    buf = put_u32(buf, st->st_mtim.tv_nsec);
+    buf = put_u64(buf, st->st_ctim.tv_sec);
+    buf = put_u32(buf, st->st_ctim.tv_nsec);
+    return buf;
+}
+
+static const char* get_stat(const char *buf, struct stat *st)
+{
+    uint64_t v64;
+    uint32_t v32;
+
+    memset(st, 0, sizeof(struct stat));
+    buf = get_u64(buf, &v64);   st->st_dev = v64;
+    buf = get_u64(buf, &v64);   st->st_ino = v64;
+    buf = get_u32(buf, &v32);   st->st_mode = v32;
+    buf = get_u32(buf, &v32);   st->st_nlink = v32;
+    buf = get_u32(buf, &v32);   st->st_uid = v32;
+    buf = get_u32(buf, &v32);   st->st_gid = v32;
+    buf = get_u64(buf, &v64);   st->st_rdev = v64;
+    buf = get_u64(buf, &v64);   st->st_size = v64;
+    buf = get_u32(buf, &v32);   st->st_blksize = v32;
+    buf = get_u64(buf, &v64);   st->st_blocks = v64;
+    buf = get_u64(buf, &v64);   st->st_atim.tv_sec = v64;
+    buf = get_u32(buf, &v32);   st->st_atim.tv_nsec = v32;
+    buf = get_u64(buf, &v64);   st->st_mtim.tv_sec = v64;
+    buf = get_u32(buf, &v32);   st->st_mtim.tv_nsec = v32;
+    buf = get_u64(buf, &v64);   st->st_ctim.tv_sec = v64;
+    buf = get_u32(buf, &v32);   st->st_ctim.tv_nsec = v32;
+    return buf;
+}
+
+void giga_frame_put_reply(char *buf,
+                          giga_result_t *result, struct stat *statbuf)
+{
+    struct giga_mapping_t *mapping = &result->giga_result_t_u.bitmap;
+    int record = reply_record(result, statbuf);
+
+    buf = put_u32(buf, result->errnum);
+    buf = put_u32(buf, record);
+
+    switch (record) {
+        case GIGA_FRAME_REC_MAPPING: {
+            int num_words = giga_bitmap_num_words(mapping);
+
+            buf = put_u32(buf, mapping->zeroth_server);
+            buf = put_u32(buf, mapping->server_count);
+            buf = put_u32(buf, mapping->hash_type);
+            buf = put_u32(buf, mapping->split_type);
+            buf = put_u32(buf, mapping->split_bound);
+            buf = put_u32(buf, num_words);
+            giga_bitmap_to_words(mapping, (unsigned char *)buf, num_words);
+            break;
+        }
+        case GIGA_FRAME_REC_STAT:
+            put_stat(buf, statbuf);
+            break;
+        default:
+            break;
+    }
+}
+
+int giga_frame_get_reply(const char *buf, size_t len,
+                         giga_result_t *result, struct stat *statbuf)
+{
+    struct giga_mapping_t *mapping = &result->giga_result_t_u.bitmap;
+    uint32_t errnum, record, num_words;
+
+    if (len < GIGA_FRAME_REPLY_SIZE)
+        return -1;
+    buf = get_u32(buf, &errnum);
+    buf = get_u32(buf, &record);
+    len -= GIGA_FRAME_REPLY_SIZE;
+
+    switch (record) {
+        case GIGA_FRAME_REC_MAPPING:
+            if (((int)errnum != -EAGAIN) || (len < GIGA_FRAME_MAPPING_SIZE))
+                return -1;
+            memset(mapping, 0, sizeof(struct giga_mapping_t));
+            buf = get_u32(buf, &mapping->zeroth_server);
+            buf = get_u32(buf, &mapping->server_count);
+            buf = get_u32(buf, &mapping->hash_type);
+            buf = get_u32(buf, &mapping->split_type);
+            buf = get_u32(buf, &mapping->split_bound);
+            buf = get_u32(buf, &num_words);
+            if (!giga_hash_supported(mapping->hash_type) ||
+                !giga_split_supported(mapping->split_type,
+                                      mapping->split_bound) ||
+                (num_words > MAX_BMAP_LEN) ||
+                (len - GIGA_FRAME_MAPPING_SIZE != num_words*sizeof(bitmap_t)))
+                return -1;
+            if (giga_bitmap_from_words(mapping, (const unsigned char *)buf,
+                                       num_words) < 0)
+                return -1;
+            break;
+        case GIGA_FRAME_REC_STAT:
+            if ((errnum != 0) || (statbuf == NULL) ||
+                (len != GIGA_FRAME_STAT_SIZE))
+                return -1;
+            get_stat(buf, statbuf);
+            break;
+        case GIGA_FRAME_REC_NONE:
+            if (((int)errnum == -EAGAIN) || (len != 0))
+                return -1;
+            break;
+        default:
+            return -1;
+    }
+    result->errnum = errnum;
+
+    return 0;
+}
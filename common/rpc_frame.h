@@ -0,0 +1,83 @@
+#ifndef RPC_FRAME_H
+#define RPC_FRAME_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "rpc_giga.h"
+
+/*
+ * Binary frames: a compact alternative to the XDR encoding of the client
+ * calls (GETATTR and MKDIR), for clients that asked for GIGA_PROTO_FRAMES
+ * at GIGA_RPC_INIT. Frames and Sun RPC records can be mixed on the same
+ * connection.
+ *
+ * A frame starts with a 4-byte mark: GIGA_FRAME_MAGIC in its top byte, and
+ * the length of the rest of the frame in the other 24 bits. A Sun RPC
+ * record mark never looks like that: the last fragment of a record has the
+ * top bit set, and other fragments would be larger than MAX_RECORD_SIZE.
+ * The mark is followed by the xid of the call, and the body:
+ *
+ *   call:   proc, dir_id, mode, path_len, path (path_len bytes, with its NUL)
+ *   reply:  errnum, record type (GIGA_FRAME_REC_*), record
+ *
+ * The records have a fixed layout: a stat (GIGA_FRAME_STAT_SIZE bytes), or
+ * a mapping (GIGA_FRAME_MAPPING_SIZE bytes followed by its bitmap in 64-bit
+ * words, up to the highest partition). All integers are big-endian.
+ *
+ * Frames are decoded in place: the path of a call is used where it is in
+ * the received frame, and a stat is read straight into the caller's. The
+ * mark and the xid are added and checked by the transports (the server's
+ * event loop and rpc_async.c).
+ */
+
+#define GIGA_FRAME_MAGIC        0x47u           /* 'G' */
+#define GIGA_FRAME_MAX_LEN      0xffffffu
+
+#define GIGA_FRAME_MARK(len)    ((GIGA_FRAME_MAGIC << 24) | (len))
+#define GIGA_FRAME_IS_MARK(m)   (((m) >> 24) == GIGA_FRAME_MAGIC)
+#define GIGA_FRAME_LEN(m)       ((m) & GIGA_FRAME_MAX_LEN)
+
+#define GIGA_FRAME_HDR_SIZE     8               /* mark and xid */
+
+#define GIGA_FRAME_REC_NONE     0
+#define GIGA_FRAME_REC_STAT     1               /* GETATTR, if errnum is 0 */
+#define GIGA_FRAME_REC_MAPPING  2               /* if errnum is -EAGAIN */
+
+#define GIGA_FRAME_CALL_SIZE    16              /* without the path */
+#define GIGA_FRAME_REPLY_SIZE   8               /* without the record */
+#define GIGA_FRAME_STAT_SIZE    96
+#define GIGA_FRAME_MAPPING_SIZE 24              /* without the bitmap */
+
+/* A call, as decoded by giga_frame_get_call() */
+struct giga_frame_call {
+    int proc;
+    int dir_id;
+    mode_t mode;
+    char *path;                 /* in the frame */
+};
+
+/* Calls (the body, after GIGA_FRAME_HDR_SIZE bytes):
+ * - giga_frame_call_size() returns the size of the call with "path";
+ * - giga_frame_put_call() encodes it (in that many bytes);
+ * - giga_frame_get_call() decodes "len" bytes, returning -1 if they are
+ *   not a valid call.
+ */
+size_t giga_frame_call_size(const char *path);
+void giga_frame_put_call(char *buf, int proc,
+                         int dir_id, const char *path, mode_t mode);
+int giga_frame_get_call(char *buf, size_t len, struct giga_frame_call *call);
+
+/* Replies, to a GETATTR if "statbuf" is given (it is sent only if the call
+ * succeeded); giga_frame_get_reply() allocates the bitmap of the mapping in
+ * "result" (free it with xdr_free(xdr_giga_result_t)), and returns -1 if
+ * the reply is not valid.
+ */
+size_t giga_frame_reply_size(giga_result_t *result, struct stat *statbuf);
+void giga_frame_put_reply(char *buf,
+                          giga_result_t *result, struct stat *statbuf);
+int giga_frame_get_reply(const char *buf, size_t len,
+                         giga_result_t *result, struct stat *statbuf);
+
+#endif /* RPC_FRAME_H */
@@ -21,6 +21,7 @@ typedef int giga_dir_id;
 typedef string giga_pathname<MAX_LEN>;
 typedef opaque giga_file_data<MAX_SIZE>;
 typedef struct giga_mapping_t giga_bitmap;
+typedef opaque giga_migrate_chunk<MIGRATE_CHUNK_SIZE>;
 
 struct giga_timestamp_t {
     int tv_sec;
@@ -49,23 +50,96 @@ struct giga_getattr_reply_t {
     /**int fn_retval;*/
 };
 
+/* Protocols a client may use for its calls (see GIGA_RPC_INIT) */
+const GIGA_PROTO_XDR = 1;               /* Sun RPC calls (always served) */
+const GIGA_PROTO_FRAMES = 2;            /* binary frames (see rpc_frame.h) */
+
+struct giga_init_reply_t {
+    giga_result_t result;
+    int protocols;                      /* GIGA_PROTO_* served to the client */
+};
+
+/* Batches: operations on entries of one directory, sent to one server */
+const GIGA_BATCH_MAX = 1024;            /* operations per batch */
+
+const GIGA_BATCH_GETATTR = 1;
+const GIGA_BATCH_MKDIR = 2;
+const GIGA_BATCH_CREATE = 3;            /* a regular file */
+
+struct giga_batch_op_t {
+    int op;                             /* GIGA_BATCH_* */
+    giga_pathname path;
+    mode_t mode;
+};
+
+typedef giga_batch_op_t giga_batch_ops<GIGA_BATCH_MAX>;
+
+struct giga_batch_result_t {
+    int errnum;
+    struct stat *statbuf;               /* GETATTR, if errnum is 0 */
+};
+
+struct giga_batch_reply_t {
+    giga_batch_result_t results<GIGA_BATCH_MAX>;
+    giga_bitmap *bitmap;                /* if any errnum is -EAGAIN */
+};
+
+struct giga_migrate_reply_t {
+    int errnum;
+    int credits;                /* chunks the sender may have in flight */
+};
+
 /* RPC definitions */
 
 program GIGA_RPC_PROG {                 /* program number */
 	version GIGA_RPC_VERSION {          /* version number */
 		/* Initial RPC.
-           - REQUEST: client sends "number of servers".
-           - REPLY: servers check, respond with its know "number of servers".
+           - REQUEST: client sends "number of servers", and the protocols
+             (GIGA_PROTO_*) it can use.
+           - REPLY: the mapping of the root directory, and the protocols the
+             server serves among them; both are served side by side, so the
+             client may use any of them on any connection.
         */
 		/*int GIGA_RPC_INIT(int) = 1;*/
-        giga_result_t GIGA_RPC_INIT(int) = 1;
+        giga_init_reply_t GIGA_RPC_INIT(int, int) = 1;
         
         giga_getattr_reply_t GIGA_RPC_GETATTR(giga_dir_id, giga_pathname) = 101;
 
         giga_result_t GIGA_RPC_MKDIR(giga_dir_id, giga_pathname, mode_t) = 201;
+
+        /* Batch of operations on entries of a directory: each operation
+           gets its own result, in order. The ones on entries that are not 
+           on this server (-EAGAIN) share the mapping sent with the reply.
+        */
+        giga_batch_reply_t GIGA_RPC_BATCH(giga_dir_id, giga_batch_ops) = 401;
+
+        /* SERVER-to-SERVER API (partition splits): the entries of the new
+           partition "index" are streamed in chunks of packed entries, by a
+           migration with an "id" chosen by the sender.
+           - MIGRATE_BEGIN: start the migration; the reply grants "credits".
+           - MIGRATE_CHUNK: chunk number "seq" (from 0). Only the last chunk
+             of every "credits" chunks is answered; the others are sent as
+             batched calls, so at most "credits" chunks are unacknowledged.
+           - MIGRATE_END: all "num_entries" entries have been sent; the 
+             receiver adds the partition to its mapping (merged with the 
+             splitting server's mapping). It may be sent again: once the
+             partition is added, it succeeds without doing anything.
+           - MIGRATE_STATUS: the state of the migration at the receiver; 0 
+             if the partition was added, -EINPROGRESS if the migration is
+             open, and -ENOENT (or its error) if it will never be added.
+        */
+        giga_migrate_reply_t GIGA_RPC_MIGRATE_BEGIN(giga_dir_id, int, 
+                                                    unsigned int) = 301;
+        giga_migrate_reply_t GIGA_RPC_MIGRATE_CHUNK(giga_dir_id, int, int,
+                                                    giga_migrate_chunk) = 302;
+        giga_result_t GIGA_RPC_MIGRATE_END(giga_dir_id, int, unsigned int,
+                                           giga_bitmap, int) = 303;
+        giga_migrate_reply_t GIGA_RPC_MIGRATE_STATUS(giga_dir_id, int,
+                                                     unsigned int) = 304;
 		
         /* CLIENT API */
 		/*giga_lookup_t RPC_CREATE(giga_dir_id, giga_pathname, mode_t) = 101;*/
 
-	} = 1;
+	} = 4;      /* 2: mapping carries its policy, 3: protocols and batches,
+                   4: migration ids and MIGRATE_STATUS */
 } = 522222; /* FIXME: Is this a okay value for program number? */
@@ -1,6 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <stdlib.h>
 
 #include "rpc_giga.h"
 #include "rpc_helper.h"
@@ -21,6 +22,42 @@ bool_t xdr_mode_t(XDR *xdrs, mode_t *mode)
     return TRUE;
 }
 
+/* The bitmap is 64-bit words in memory, but is sent in 7-bits-per-byte
+ * format (a counted array of u_char, up to the highest partition).
+ */
+static bool_t xdr_giga_wire_bitmap(XDR *xdrs, struct giga_mapping_t *objp)
+{
+    char *wire = NULL;
+    u_int wire_len = 0;
+    bool_t ret = FALSE;
+
+    switch (xdrs->x_op) {
+        case XDR_ENCODE:
+            wire_len = giga_bitmap_wire_len(objp);
+            if ((wire = calloc(wire_len, 1)) == NULL)
+                return FALSE;
+            giga_bitmap_to_wire(objp, (unsigned char *)wire, wire_len);
+            ret = xdr_array(xdrs, &wire, &wire_len, MAX_BMAP_WIRE_LEN, 
+                            sizeof(char), (xdrproc_t) xdr_u_char);
+            free(wire);
+            break;
+        case XDR_DECODE:
+            if (!xdr_array(xdrs, &wire, &wire_len, MAX_BMAP_WIRE_LEN, 
+                           sizeof(char), (xdrproc_t) xdr_u_char))
+                return FALSE;
+            ret = (giga_bitmap_from_wire(objp, 
+                                         (unsigned char *)wire, wire_len) == 0);
+            free(wire);
+            break;
+        case XDR_FREE:
+            giga_free_mapping(objp);
+            ret = TRUE;
+            break;
+    }
+
+    return ret;
+}
+
 bool_t xdr_giga_mapping_t(XDR *xdrs, struct giga_mapping_t *objp)
 {
     if (!xdr_u_int(xdrs, &objp->curr_radix))
@@ -29,8 +66,18 @@ bool_t xdr_giga_mapping_t(XDR *xdrs, struct giga_mapping_t *objp)
         return FALSE;
     if (!xdr_u_int(xdrs, &objp->server_count))
         return FALSE;
-    if (!(xdr_vector(xdrs, (char *)objp->bitmap, MAX_BMAP_LEN,
-                     sizeof(char), (xdrproc_t) xdr_char)))
+    if (!xdr_u_int(xdrs, &objp->hash_type))
+        return FALSE;
+    if ((xdrs->x_op == XDR_DECODE) && !giga_hash_supported(objp->hash_type))
+        return FALSE;   // mapping uses a hash this node does not know
+    if (!xdr_u_int(xdrs, &objp->split_type))
+        return FALSE;
+    if (!xdr_u_int(xdrs, &objp->split_bound))
+        return FALSE;
+    if ((xdrs->x_op == XDR_DECODE) && 
+        !giga_split_supported(objp->split_type, objp->split_bound))
+        return FALSE;
+    if (!xdr_giga_wire_bitmap(xdrs, objp))
         return FALSE;
 
     return TRUE;
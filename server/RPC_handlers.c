@@ -3,118 +3,249 @@
 #include "common/defaults.h"
 #include "common/debugging.h"
 #include "common/rpc_giga.h"
+#include "common/rpc_frame.h"
 #include "common/options.h"
 
 #include "backends/operations.h"
 
 #include "server.h"
+#include "split.h"
+#include "event_loop.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 
-bool_t giga_rpc_init_1_svc(int rpc_req, 
-                           giga_result_t *rpc_reply, 
+bool_t giga_rpc_init_4_svc(int rpc_req, int protocols,
+                           giga_init_reply_t *rpc_reply, 
                            struct svc_req *rqstp)
 {
     (void)rqstp;
     assert(rpc_reply);
 
-    logMessage(LOG_TRACE, __func__, "==> RPC_init_recv = %d", rpc_req);
+    LOG_MSG(LOG_TRACE, "==> RPC_init_recv = %d (protocols=%d)", 
+            rpc_req, protocols);
+
+    bzero(rpc_reply, sizeof(giga_init_reply_t));
+
+    // both protocols are always served (see giga_frame_dispatch())
+    rpc_reply->protocols = 
+        (protocols & (GIGA_PROTO_XDR | GIGA_PROTO_FRAMES)) | GIGA_PROTO_XDR;
 
     // send bitmap for the "root" directory.
     //
     int dir_id = 0;
     struct giga_directory *dir = cache_fetch(&dir_id);
     if (dir == NULL) {
-        rpc_reply->errnum = -EIO;
-        logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
+        rpc_reply->result.errnum = -EIO;
+        LOG_MSG(LOG_DEBUG, "Dir (id=%d) not in cache!", dir_id);
         return true;
     }
-    rpc_reply->errnum = -EAGAIN;
-    memcpy(&(rpc_reply->giga_result_t_u.bitmap), 
-           &dir->mapping, sizeof(dir->mapping));
+    rpc_reply->result.errnum = -EAGAIN;
+    pthread_mutex_lock(&dir->partition_mtx);
+    giga_copy_mapping(&(rpc_reply->result.giga_result_t_u.bitmap), 
+                      &dir->mapping, 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
 
-    logMessage(LOG_TRACE, __func__, "RPC_init_reply(%d)", rpc_reply->errnum);
+    LOG_MSG(LOG_TRACE, "RPC_init_reply(%d)", rpc_reply->result.errnum);
 
+    cache_return(dir);
     return true;
 }
 
-int giga_rpc_prog_1_freeresult(SVCXPRT *transp, 
+int giga_rpc_prog_4_freeresult(SVCXPRT *transp, 
                                xdrproc_t xdr_result, caddr_t result)
 {
     (void)transp;
     
-    logMessage(LOG_TRACE, __func__, "RPC_freeresult_recv");
+    LOG_MSG(LOG_TRACE, "RPC_freeresult_recv");
 
     xdr_free(xdr_result, result);
 
     /* TODO: add more cleanup code. */
     
-    logMessage(LOG_TRACE, __func__, "RPC_freeresult_reply");
+    LOG_MSG(LOG_TRACE, "RPC_freeresult_reply");
 
     return 1;
 }
 
-bool_t giga_rpc_getattr_1_svc(giga_dir_id dir_id, giga_pathname path, 
-                              giga_getattr_reply_t *rpc_reply, 
-                              struct svc_req *rqstp)
+/* Send the client the current mapping of "dir", with an -EAGAIN reply */
+static void copy_mapping(struct giga_directory *dir, 
+                         struct giga_mapping_t *mapping)
 {
-    (void)rqstp;
-    assert(rpc_reply);
-    assert(path);
+    pthread_mutex_lock(&dir->partition_mtx);
+    giga_copy_mapping(mapping, &dir->mapping, 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
+}
 
-    logMessage(LOG_TRACE, __func__, 
-               "==> RPC_getattr_recv(dir_id=%d,path=%s)", dir_id, path);
+/* getattr of entry "path" of "dir" (with id "dir_id"); returns -EAGAIN if
+ * the entry is on another server */
+static int getattr_entry(struct giga_directory *dir, giga_dir_id dir_id, 
+                         const char *path, struct stat *statbuf)
+{
+    struct giga_mapping_t mapping;
+    unsigned int seq;
+    int index, server;
+    int errnum = 0;
+
+retry:
+    // (1): get the giga index/partition for operation, without locking the 
+    // directory (see cache_read_begin())
+    seq = cache_read_begin(dir, &mapping);
+    index = giga_get_index_for_file(&mapping, path);
+    server = giga_get_server_for_index(&mapping, index);
+    if (cache_read_retry(dir, seq))
+        goto retry;
+    
+    // (2): is this the correct server? NO --> (errnum=-EAGAIN) and return
+    if (server != giga_options_t.serverID) {
+        LOG_MSG(LOG_TRACE, "req for server-%d reached server-%d.",
+                server, giga_options_t.serverID);
+        return -EAGAIN;
+    }
 
-    bzero(rpc_reply, sizeof(giga_getattr_reply_t));
+    char path_name[MAX_LEN];
+
+    switch (giga_options_t.backend_type) {
+        case BACKEND_RPC_LOCALFS:
+            snprintf(path_name, sizeof(path_name), 
+                     "%s/%s", giga_options_t.mountpoint, path);
+            errnum = local_getattr(path_name, statbuf);
+            break;
+        case BACKEND_RPC_LEVELDB:
+            errnum = leveldb_lookup(*leveldb_shard(dir_id, index), 
+                                    dir_id, index, path, statbuf);
+            // a split that finished during the lookup may have moved the 
+            // entry out of this partition
+            if (cache_read_retry(dir, seq))
+                goto retry;
+            break;  
+        default:
+            break;
 
-    struct giga_directory *dir = cache_fetch(&dir_id);
-    if (dir == NULL) {
-        rpc_reply->result.errnum = -EIO;
-        logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
-        return true;
     }
 
+    return errnum;
+}
+
+/* create entry "path" of "dir" (with id "dir_id"), a directory or a file 
+ * (of "obj_type"); returns -EAGAIN if the entry belongs to another server,
+ * or to a partition that is being split */
+static int create_entry(struct giga_directory *dir, giga_dir_id dir_id, 
+                        const char *path, mode_t mode, 
+                        ldb_obj_type_t obj_type)
+{
+    int errnum = 0;
+
+    pthread_mutex_lock(&dir->partition_mtx);
+
     // (1): get the giga index/partition for operation
-    int index = giga_get_index_for_file(&dir->mapping, (const char*)path);
-    int server = giga_get_server_for_index(&dir->mapping, index);
+    int index, server;
+    index = giga_get_index_for_file(&dir->mapping, path);
+    server = giga_get_server_for_index(&dir->mapping, index);
     
-    // (2): is this the correct server? NO --> (errnum=-EAGAIN) and return
-    if (server != giga_options_t.serverID) {
-        rpc_reply->result.errnum = -EAGAIN;
-        memcpy(&(rpc_reply->result.giga_result_t_u.bitmap), 
-               &dir->mapping, sizeof(dir->mapping));
-        logMessage(LOG_TRACE, __func__, "req for server-%d reached server-%d.",
-                   server, giga_options_t.serverID);
-        return true;
+    // (2): is this the correct server? NO --> (errnum=-EAGAIN) and return;
+    // a partition that is being split takes no new entries until the split
+    // is done (after which the entry may belong to the new partition), so 
+    // the client retries those too: waiting here would hold a worker that
+    // the split's migration to another server may need.
+    if ((server != giga_options_t.serverID) || (index == dir->split_index)) {
+        pthread_mutex_unlock(&dir->partition_mtx);
+        LOG_MSG(LOG_TRACE, "req for server-%d (p%d) reached server-%d.",
+                server, index, giga_options_t.serverID);
+        return -EAGAIN;
     }
 
+    // (3): create the entry without the lock; a split of the partition 
+    // that starts meanwhile waits for it (see split_bucket())
+    int epoch = dir->create_epoch;
+    dir->creates[epoch]++;
+    pthread_mutex_unlock(&dir->partition_mtx);
+
     char path_name[MAX_LEN];
+    int obj_id, split = 0;
 
     switch (giga_options_t.backend_type) {
         case BACKEND_RPC_LOCALFS:
             snprintf(path_name, sizeof(path_name), 
                      "%s/%s", giga_options_t.mountpoint, path);
-            rpc_reply->result.errnum = local_getattr(path_name, 
-                                                     &rpc_reply->statbuf);
+            if (obj_type == OBJ_DIR)
+                errnum = local_mkdir(path_name, mode);
+            else
+                errnum = local_mknod(path_name, S_IFREG | mode, 0);
             break;
         case BACKEND_RPC_LEVELDB:
-            rpc_reply->result.errnum = leveldb_lookup(ldb_mds, 
-                                                      dir_id, index, path, 
-                                                      &rpc_reply->statbuf);
-            break;  
+            if (obj_type == OBJ_FILE) {
+                // the file's data object is created when it is first used
+                errnum = leveldb_create(*leveldb_shard(dir_id, index), 
+                                        dir_id, index, OBJ_FILE, 
+                                        -1, path, mode, NULL);
+                break;
+            }
+
+            // a directory is only its entry (metadata) in levelDB
+            if ((obj_id = new_object_id()) < 0) {
+                errnum = obj_id;
+                break;
+            }
+            errnum = leveldb_create(*leveldb_shard(dir_id, index), 
+                                    dir_id, index, OBJ_DIR, 
+                                    obj_id, path, mode, NULL);
+            break;
         default:
             break;
 
     }
 
-    logMessage(LOG_TRACE, __func__, "RPC_getattr_reply");
+    // (4): split the partition (in the background) if it has grown too big
+    pthread_mutex_lock(&dir->partition_mtx);
+    if ((--dir->creates[epoch] == 0) && (epoch != dir->create_epoch))
+        pthread_cond_broadcast(&dir->split_cond);
+    if ((giga_options_t.backend_type == BACKEND_RPC_LEVELDB) &&
+        (errnum == 0))
+        split = split_add_entries(dir, index, 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    if (split)
+        split_schedule(dir, index);
+
+    return errnum;
+}
+
+bool_t giga_rpc_getattr_4_svc(giga_dir_id dir_id, giga_pathname path, 
+                              giga_getattr_reply_t *rpc_reply, 
+                              struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+    assert(path);
+
+    LOG_MSG(LOG_TRACE,
+            "==> RPC_getattr_recv(dir_id=%d,path=%s)", dir_id, path);
+
+    bzero(rpc_reply, sizeof(giga_getattr_reply_t));
+
+    struct giga_directory *dir = cache_fetch(&dir_id);
+    if (dir == NULL) {
+        rpc_reply->result.errnum = -EIO;
+        LOG_MSG(LOG_DEBUG, "Dir (id=%d) not in cache!", dir_id);
+        return true;
+    }
+
+    rpc_reply->result.errnum = getattr_entry(dir, dir_id, path, 
+                                             &rpc_reply->statbuf);
+    if (rpc_reply->result.errnum == -EAGAIN)
+        copy_mapping(dir, &rpc_reply->result.giga_result_t_u.bitmap);
+
+    LOG_MSG(LOG_TRACE, "RPC_getattr_reply");
+    cache_return(dir);
     return true;
 }
 
-bool_t giga_rpc_mkdir_1_svc(giga_dir_id dir_id, giga_pathname path, mode_t mode,
+bool_t giga_rpc_mkdir_4_svc(giga_dir_id dir_id, giga_pathname path, mode_t mode,
                             giga_result_t *rpc_reply, 
                             struct svc_req *rqstp)
 {
@@ -122,62 +253,233 @@ bool_t giga_rpc_mkdir_1_svc(giga_dir_id dir_id, giga_pathname path, mode_t mode,
     assert(rpc_reply);
     assert(path);
 
-    logMessage(LOG_TRACE, __func__, 
-               "==> RPC_mkdir_recv(path=%s,mode=0%3o)", path, mode);
+    LOG_MSG(LOG_TRACE,
+            "==> RPC_mkdir_recv(path=%s,mode=0%3o)", path, mode);
 
     bzero(rpc_reply, sizeof(giga_result_t));
 
     struct giga_directory *dir = cache_fetch(&dir_id);
     if (dir == NULL) {
         rpc_reply->errnum = -EIO;
-        logMessage(LOG_DEBUG, __func__, "Dir (id=%d) not in cache!", dir_id);
+        LOG_MSG(LOG_DEBUG, "Dir (id=%d) not in cache!", dir_id);
         return true;
     }
 
-    // (1): get the giga index/partition for operation
-    int index = giga_get_index_for_file(&dir->mapping, (const char*)path);
-    int server = giga_get_server_for_index(&dir->mapping, index);
-    
-    // (2): is this the correct server? NO --> (errnum=-EAGAIN) and return
-    if (server != giga_options_t.serverID) {
-        rpc_reply->errnum = -EAGAIN;
-        memcpy(&(rpc_reply->giga_result_t_u.bitmap), 
-               &dir->mapping, sizeof(dir->mapping));
-        logMessage(LOG_TRACE, __func__, "req for server-%d reached server-%d.",
-                   server, giga_options_t.serverID);
-        return true;
+    rpc_reply->errnum = create_entry(dir, dir_id, path, mode, OBJ_DIR);
+    if (rpc_reply->errnum == -EAGAIN)
+        copy_mapping(dir, &rpc_reply->giga_result_t_u.bitmap);
+
+    LOG_MSG(LOG_TRACE,
+            "RPC_mkdir_reply(status=%d)", rpc_reply->errnum);
+
+    cache_return(dir);
+    return true;
+}
+
+bool_t giga_rpc_batch_4_svc(giga_dir_id dir_id, giga_batch_ops ops, 
+                            giga_batch_reply_t *rpc_reply,
+                            struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+
+    LOG_MSG(LOG_TRACE, "==> RPC_batch_recv(dir_id=%d,ops=%u)", 
+            dir_id, ops.giga_batch_ops_len);
+
+    bzero(rpc_reply, sizeof(giga_batch_reply_t));
+
+    giga_batch_result_t *results = 
+        calloc(ops.giga_batch_ops_len, sizeof(giga_batch_result_t));
+    if ((results == NULL) && (ops.giga_batch_ops_len > 0)) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
     }
+    rpc_reply->results.results_val = results;
+    rpc_reply->results.results_len = ops.giga_batch_ops_len;
 
-    char path_name[MAX_LEN];
+    struct giga_directory *dir = cache_fetch(&dir_id);
 
-    switch (giga_options_t.backend_type) {
-        case BACKEND_RPC_LOCALFS:
-            snprintf(path_name, sizeof(path_name), 
-                     "%s/%s", giga_options_t.mountpoint, path);
-            rpc_reply->errnum = local_mkdir(path_name, mode);
+    // every op gets its own result; the ones that reached the wrong server
+    // share the mapping sent with the reply
+    unsigned int i;
+    int moved = 0;
+    for (i = 0; i < ops.giga_batch_ops_len; i++) {
+        giga_batch_op_t *op = &ops.giga_batch_ops_val[i];
+        struct stat statbuf;
+
+        if (dir == NULL) {
+            results[i].errnum = -EIO;
+            continue;
+        }
+        switch (op->op) {
+            case GIGA_BATCH_GETATTR:
+                results[i].errnum = getattr_entry(dir, dir_id, op->path, 
+                                                  &statbuf);
+                if (results[i].errnum == 0) {
+                    results[i].statbuf = malloc(sizeof(struct stat));
+                    if (results[i].statbuf == NULL) {
+                        logMessage(LOG_FATAL, __func__, 
+                                   "malloc_err: %s", strerror(errno));
+                        exit(1);
+                    }
+                    *results[i].statbuf = statbuf;
+                }
+                break;
+            case GIGA_BATCH_MKDIR:
+                results[i].errnum = create_entry(dir, dir_id, op->path, 
+                                                 op->mode, OBJ_DIR);
+                break;
+            case GIGA_BATCH_CREATE:
+                results[i].errnum = create_entry(dir, dir_id, op->path, 
+                                                 op->mode, OBJ_FILE);
+                break;
+            default:
+                results[i].errnum = -ENOSYS;
+                break;
+        }
+        if (results[i].errnum == -EAGAIN)
+            moved = 1;
+    }
+
+    if (moved) {
+        rpc_reply->bitmap = calloc(1, sizeof(giga_bitmap));
+        if (rpc_reply->bitmap == NULL) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        copy_mapping(dir, rpc_reply->bitmap);
+    }
+
+    if (dir == NULL)
+        LOG_MSG(LOG_DEBUG, "Dir (id=%d) not in cache!", dir_id);
+    else
+        cache_return(dir);
+
+    LOG_MSG(LOG_TRACE, "RPC_batch_reply");
+    return true;
+}
+
+/* Run a call that came in a binary frame (see common/rpc_frame.h) with the
+ * handlers of the Sun RPC calls: the path is used where it is in the frame,
+ * and the result is encoded straight into the reply. 
+ */
+int giga_frame_dispatch(void *xprt, char *frame, size_t len)
+{
+    struct giga_frame_call call;
+    giga_getattr_reply_t rpc_reply;
+    struct stat *statbuf = NULL;
+
+    if (giga_frame_get_call(frame, len, &call) < 0)
+        return -1;
+
+    bzero(&rpc_reply, sizeof(rpc_reply));
+    switch (call.proc) {
+        case GIGA_RPC_GETATTR:
+            giga_rpc_getattr_4_svc(call.dir_id, call.path, &rpc_reply, NULL);
+            statbuf = &rpc_reply.statbuf;
             break;
-        case BACKEND_RPC_LEVELDB:
-            // create object in the underlying file system
-            snprintf(path_name, sizeof(path_name), 
-                     "%s/%s", giga_options_t.mountpoint, path);
-            rpc_reply->errnum = local_mkdir(path_name, mode); 
-            
-            // create object entry (metadata) in levelDB
-            object_id += 1; 
-            rpc_reply->errnum = leveldb_create(ldb_mds, dir_id, index,
-                                               OBJ_DIR, 
-                                               object_id, path, path_name);
+        case GIGA_RPC_MKDIR:
+            giga_rpc_mkdir_4_svc(call.dir_id, call.path, call.mode, 
+                                 &rpc_reply.result, NULL);
             break;
         default:
+            rpc_reply.result.errnum = -ENOSYS;
             break;
-
     }
 
-    logMessage(LOG_TRACE, __func__, 
-               "RPC_mkdir_reply(status=%d)", rpc_reply->errnum);
+    len = giga_frame_reply_size(&rpc_reply.result, statbuf);
+    giga_frame_put_reply(event_loop_frame_reply(xprt, len), 
+                         &rpc_reply.result, statbuf);
+    xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&rpc_reply.result);
+
+    return 0;
+}
+
+bool_t giga_rpc_migrate_begin_4_svc(giga_dir_id dir_id, int index, 
+                                    unsigned int id,
+                                    giga_migrate_reply_t *rpc_reply, 
+                                    struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+
+    LOG_MSG(LOG_TRACE, "==> RPC_migrate_begin_recv(dir_id=%d,p%d,id=%u)", 
+            dir_id, index, id);
+
+    bzero(rpc_reply, sizeof(giga_migrate_reply_t));
+
+    rpc_reply->errnum = split_migrate_begin(dir_id, index, id);
+    rpc_reply->credits = MIGRATE_CREDITS;
+
+    LOG_MSG(LOG_TRACE, "RPC_migrate_begin_reply(status=%d)", 
+            rpc_reply->errnum);
+
+    return true;
+}
+
+bool_t giga_rpc_migrate_chunk_4_svc(giga_dir_id dir_id, int index, int seq,
+                                    giga_migrate_chunk chunk,
+                                    giga_migrate_reply_t *rpc_reply, 
+                                    struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+
+    LOG_MSG(LOG_TRACE, "==> RPC_migrate_chunk_recv(dir_id=%d,p%d,seq=%d)", 
+            dir_id, index, seq);
+
+    bzero(rpc_reply, sizeof(giga_migrate_reply_t));
+
+    rpc_reply->errnum = split_migrate_chunk(dir_id, index, 
+                                            chunk.giga_migrate_chunk_val,
+                                            chunk.giga_migrate_chunk_len);
+    rpc_reply->credits = MIGRATE_CREDITS;
+
+    // only the last chunk of every window of credits gets a reply; the 
+    // others were sent as batched calls.
+    return (((seq + 1) % MIGRATE_CREDITS) == 0);
+}
+
+bool_t giga_rpc_migrate_end_4_svc(giga_dir_id dir_id, int index, 
+                                  unsigned int id,
+                                  giga_bitmap mapping, int num_entries,
+                                  giga_result_t *rpc_reply, 
+                                  struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+
+    LOG_MSG(LOG_TRACE, "==> RPC_migrate_end_recv(dir_id=%d,p%d,id=%u,n=%d)",
+            dir_id, index, id, num_entries);
+
+    bzero(rpc_reply, sizeof(giga_result_t));
+
+    rpc_reply->errnum = split_migrate_end(dir_id, index, id,
+                                          &mapping, num_entries);
+
+    LOG_MSG(LOG_TRACE, "RPC_migrate_end_reply(status=%d)", rpc_reply->errnum);
 
     return true;
 }
 
+bool_t giga_rpc_migrate_status_4_svc(giga_dir_id dir_id, int index, 
+                                     unsigned int id,
+                                     giga_migrate_reply_t *rpc_reply, 
+                                     struct svc_req *rqstp)
+{
+    (void)rqstp;
+    assert(rpc_reply);
+
+    LOG_MSG(LOG_TRACE, "==> RPC_migrate_status_recv(dir_id=%d,p%d,id=%u)", 
+            dir_id, index, id);
 
+    bzero(rpc_reply, sizeof(giga_migrate_reply_t));
 
+    rpc_reply->errnum = split_migrate_status(dir_id, index, id);
+    rpc_reply->credits = MIGRATE_CREDITS;
+
+    LOG_MSG(LOG_TRACE, "RPC_migrate_status_reply(status=%d)", 
+            rpc_reply->errnum);
+
+    return true;
+}
@@ -0,0 +1,1567 @@
+#include "common/debugging.h"
+#include "common/rpc_frame.h"
+
+#include "event_loop.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// io_uring needs multishot accept/receive and buffer rings (Linux 6.0)
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+
+/*
+ * The loop thread reads whatever arrives on a connection, cuts it into the
+ * record-marked calls of the Sun RPC TCP framing, and queues the connection
+ * for the workers when it has complete calls. A worker takes a queued
+ * connection and runs all its calls: the dispatcher gets a memory transport
+ * that decodes the arguments from the call, and sends the reply.
+ *
+ * A client that asked for them can also send binary frames (see
+ * common/rpc_frame.h), mixed with its Sun RPC calls: they are cut out of
+ * the input in the same way, and run by the frame handler, which decodes
+ * them in place and gets its reply buffer from event_loop_frame_reply().
+ *
+ * Connections, rather than calls, are queued so that each connection is
+ * served by one worker at a time; clients that send several calls on one
+ * connection (like the partition migrations) rely on their order.
+ *
+ * With epoll, the loop thread reads (edge-triggered) with recv(), and the
+ * workers send their replies. With io_uring, the loop thread keeps a
+ * multishot accept, and a multishot receive (into a ring of provided
+ * buffers) per connection, armed; the workers queue their replies for it,
+ * and it sends all of them, and collects everything received meanwhile,
+ * with a single io_uring_enter().
+ *
+ * A connection is freed when its last reference goes: the loop thread has
+ * one until the client goes away, and a queued (or busy) connection and
+ * each reply waiting to be sent have one.
+ */
+
+#define MAX_EVENTS          256
+#define READ_SIZE           65536
+#define MAX_RECORD_SIZE     (64 << 20)      /* drop clients sending more */
+#define LAST_FRAG           0x80000000u
+
+#define COUNT(counter)      __sync_fetch_and_add(&loop.stats.counter, 1)
+
+struct request {
+    struct request *next;
+    int frame;          // a binary frame, rather than a Sun RPC call
+    size_t len;
+    char buf[];
+};
+
+// a reply for the io_uring thread to send
+struct send_req {
+    struct send_req *next;
+    struct conn *conn;
+    size_t len;
+    size_t off;         // bytes already sent
+    char buf[];
+};
+
+enum conn_state {
+    CONN_IDLE,          // no worker has it (and it is not queued)
+    CONN_QUEUED,
+    CONN_BUSY
+};
+
+struct conn {
+    int fd;
+    int refs;
+
+    /* input, only used by the loop thread */
+    char *in;           // start of a call that isn't complete yet
+    size_t in_len;
+    size_t in_cap;
+    char *rec;          // fragments of the current call
+    size_t rec_len;
+
+    /* replies being sent, only used by the io_uring thread */
+    struct send_req *send_head, *send_tail;
+
+    pthread_mutex_t mtx;            // protects the fields below
+    struct request *head, *tail;    // complete calls
+    enum conn_state state;
+    struct conn *next;              // in the work queue
+};
+
+#ifdef HAVE_IO_URING
+struct uring;
+static struct uring* uring_create(int listen_fd);
+static void* uring_thread(void *arg);
+static void uring_send(struct send_req *req);
+#endif
+
+static struct {
+    int listen_fd;
+    u_long prog;
+    u_long vers;
+    event_loop_dispatch_t dispatch;
+    event_loop_frame_t frame_handler;   // NULL if frames aren't served
+
+    int epoll_fd;
+#ifdef HAVE_IO_URING
+    struct uring *uring;            // NULL when using epoll
+#endif
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    struct conn *head, *tail;       // connections with calls to run
+
+    struct event_loop_stats stats;
+} loop;
+
+static const struct xp_ops mem_xp_ops;
+
+// per-call state of the memory transport (in xp_p1)
+struct mem_xprt {
+    struct conn *conn;
+    u_int32_t xid;
+    XDR in;
+    int broken;         // a reply couldn't be sent
+};
+
+static void* alloc_or_die(void *ptr)
+{
+    if (ptr == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    return ptr;
+}
+
+static struct conn* new_conn(int fd)
+{
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct conn *conn = alloc_or_die(calloc(1, sizeof(struct conn)));
+    conn->fd = fd;
+    conn->refs = 1;     // the loop thread's
+    pthread_mutex_init(&conn->mtx, NULL);
+
+    return conn;
+}
+
+static void get_conn(struct conn *conn)
+{
+    __sync_fetch_and_add(&conn->refs, 1);
+}
+
+static void put_conn(struct conn *conn)
+{
+    struct request *req;
+
+    if (__sync_sub_and_fetch(&conn->refs, 1) > 0)
+        return;
+
+    LOG_MSG(LOG_DEBUG, "Connection closed.");
+
+    while ((req = conn->head) != NULL) {
+        conn->head = req->next;
+        free(req);
+    }
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->mtx);
+    free(conn->in);
+    free(conn->rec);
+    free(conn);
+}
+
+static void queue_conn(struct conn *conn)
+{
+    conn->next = NULL;
+
+    pthread_mutex_lock(&loop.mtx);
+    if (loop.tail)
+        loop.tail->next = conn;
+    else
+        loop.head = conn;
+    loop.tail = conn;
+    pthread_cond_signal(&loop.cond);
+    pthread_mutex_unlock(&loop.mtx);
+}
+
+static struct conn* dequeue_conn(void)
+{
+    struct conn *conn;
+
+    pthread_mutex_lock(&loop.mtx);
+    while (loop.head == NULL)
+        pthread_cond_wait(&loop.cond, &loop.mtx);
+    conn = loop.head;
+    loop.head = conn->next;
+    if (loop.head == NULL)
+        loop.tail = NULL;
+    pthread_mutex_unlock(&loop.mtx);
+
+    return conn;
+}
+
+#if MAX_RECORD_SIZE >= (GIGA_FRAME_MAGIC << 24)
+#error "Sun RPC fragments must not look like binary frames"
+#endif
+
+/* cut "len" bytes of input of "conn" into calls; returns the number of
+ * bytes used, or -1 if the client is broken */
+static ssize_t cut_records(struct conn *conn, const char *buf, size_t len,
+                           struct request **head, struct request **tail)
+{
+    size_t pos = 0;
+
+    while (len - pos >= sizeof(u_int32_t)) {
+        u_int32_t mark;
+        memcpy(&mark, buf + pos, sizeof(mark));
+        mark = ntohl(mark);
+
+        // a frame is one piece, and can't be in the middle of a record
+        int frame = GIGA_FRAME_IS_MARK(mark);
+        if (frame && (conn->rec_len > 0))
+            return -1;
+
+        size_t frag_len = frame ? GIGA_FRAME_LEN(mark) : mark & ~LAST_FRAG;
+        if (conn->rec_len + frag_len > MAX_RECORD_SIZE)
+            return -1;
+        if (len - pos - sizeof(mark) < frag_len)
+            break;
+        pos += sizeof(mark);
+
+        if (!frame && !(mark & LAST_FRAG)) {
+            conn->rec = alloc_or_die(realloc(conn->rec,
+                                             conn->rec_len + frag_len));
+            memcpy(conn->rec + conn->rec_len, buf + pos, frag_len);
+            conn->rec_len += frag_len;
+        }
+        else {
+            size_t req_len = conn->rec_len + frag_len;
+            struct request *req =
+                alloc_or_die(malloc(sizeof(struct request) + req_len));
+            req->next = NULL;
+            req->frame = frame;
+            req->len = req_len;
+            if (conn->rec_len > 0)
+                memcpy(req->buf, conn->rec, conn->rec_len);
+            memcpy(req->buf + conn->rec_len, buf + pos, frag_len);
+            conn->rec_len = 0;
+
+            if (*tail)
+                (*tail)->next = req;
+            else
+                *head = req;
+            *tail = req;
+        }
+        pos += frag_len;
+    }
+
+    return pos;
+}
+
+/* add "len" bytes read from "conn" to its input, and cut the calls out of
+ * it; only the start of a call is kept in the connection until the rest
+ * arrives, so idle connections have no buffer. */
+static int add_input(struct conn *conn, const char *data, size_t len,
+                     struct request **head, struct request **tail)
+{
+    const char *buf = data;
+    ssize_t used;
+
+    if (conn->in_len > 0) {
+        if (conn->in_len + len > conn->in_cap) {
+            conn->in_cap = conn->in_len + len;
+            conn->in = alloc_or_die(realloc(conn->in, conn->in_cap));
+        }
+        memcpy(conn->in + conn->in_len, data, len);
+        buf = conn->in;
+        len += conn->in_len;
+    }
+
+    if ((used = cut_records(conn, buf, len, head, tail)) < 0)
+        return -1;
+
+    conn->in_len = len - used;
+    if (conn->in_len == 0) {
+        free(conn->in);
+        conn->in = NULL;
+        conn->in_cap = 0;
+    }
+    else if (buf == conn->in)
+        memmove(conn->in, conn->in + used, conn->in_len);
+    else {
+        conn->in_cap = conn->in_len;
+        conn->in = alloc_or_die(malloc(conn->in_cap));
+        memcpy(conn->in, buf + used, conn->in_len);
+    }
+
+    return 0;
+}
+
+/* hand the calls read from "conn" to the workers; at "eof", the loop
+ * thread is done with the connection */
+static void deliver_requests(struct conn *conn,
+                             struct request *head, struct request *tail,
+                             int eof)
+{
+    int queue = 0;
+
+    pthread_mutex_lock(&conn->mtx);
+    if (head) {
+        if (conn->tail)
+            conn->tail->next = head;
+        else
+            conn->head = head;
+        conn->tail = tail;
+    }
+    if (conn->state == CONN_IDLE && conn->head) {
+        conn->state = CONN_QUEUED;
+        get_conn(conn);         // the worker's
+        queue = 1;
+    }
+    pthread_mutex_unlock(&conn->mtx);
+
+    if (queue)
+        queue_conn(conn);
+    if (eof)
+        put_conn(conn);
+}
+
+static void accept_conns(void)
+{
+    struct epoll_event ev;
+
+    while (1) {
+        struct sockaddr_in remote_addr;
+        socklen_t len = sizeof(remote_addr);
+        int fd = accept4(loop.listen_fd, (struct sockaddr *)&remote_addr,
+                         &len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logMessage(LOG_ERR, __func__,
+                           "err_accept()ing: %s", strerror(errno));
+            return;
+        }
+
+        struct conn *conn = new_conn(fd);
+
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            logMessage(LOG_ERR, __func__,
+                       "epoll_ctl(ADD) failed: %s", strerror(errno));
+            put_conn(conn);
+            continue;
+        }
+
+        LOG_MSG(LOG_DEBUG, "connection accept()ed from {%s:%d}.",
+                inet_ntoa(remote_addr.sin_addr), ntohs(remote_addr.sin_port));
+    }
+}
+
+static void read_conn(struct conn *conn)
+{
+    static char buf[READ_SIZE];     // only used by the epoll thread
+    struct request *head = NULL, *tail = NULL;
+    int eof = 0;
+
+    // edge-triggered: read everything there is
+    while (1) {
+        ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+        COUNT(syscalls);
+        if (n > 0) {
+            if (add_input(conn, buf, n, &head, &tail) < 0) {
+                logMessage(LOG_ERR, __func__,
+                           "call too large, closing connection.");
+                eof = 1;
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            eof = 1;
+        break;
+    }
+
+    if (eof)
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+    deliver_requests(conn, head, tail, eof);
+}
+
+static void* event_loop_thread(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[MAX_EVENTS];
+    int i, n;
+
+    while (1) {
+        n = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, -1);
+        COUNT(syscalls);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            logMessage(LOG_FATAL, __func__,
+                       "epoll_wait() failed: %s", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_conns();
+            else
+                read_conn((struct conn *)events[i].data.ptr);
+        }
+    }
+
+    return NULL;
+}
+
+static int write_reply(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        COUNT(syscalls);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // the client isn't reading its replies; wait for it
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -errno;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* send (or queue for the io_uring thread) reply "req", which is freed once
+ * it is sent; returns -1 if the connection is broken */
+static int send_reply(struct conn *conn, struct send_req *req)
+{
+    int ret = 0;
+
+#ifdef HAVE_IO_URING
+    if (loop.uring) {
+        req->conn = conn;
+        req->off = 0;
+        get_conn(conn);         // until it is sent
+        uring_send(req);
+        return 0;
+    }
+#endif
+
+    if (write_reply(conn->fd, req->buf, req->len) < 0)
+        ret = -1;
+    free(req);
+
+    return ret;
+}
+
+static bool_t mem_getargs(SVCXPRT *xprt, xdrproc_t xargs, void *args)
+{
+    struct mem_xprt *mx = (struct mem_xprt *)xprt->xp_p1;
+
+    return xargs(&mx->in, args);
+}
+
+static bool_t mem_freeargs(SVCXPRT *xprt, xdrproc_t xargs, void *args)
+{
+    (void)xprt;
+    XDR xdrs;
+
+    xdrs.x_op = XDR_FREE;
+    return xargs(&xdrs, args);
+}
+
+static bool_t mem_reply(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    struct mem_xprt *mx = (struct mem_xprt *)xprt->xp_p1;
+    XDR xdrs;
+    bool_t ok;
+
+    msg->rm_xid = mx->xid;
+
+    size_t size = sizeof(u_int32_t) +
+                  xdr_sizeof((xdrproc_t)xdr_replymsg, msg);
+    struct send_req *req =
+        alloc_or_die(malloc(sizeof(struct send_req) + size));
+
+    xdrmem_create(&xdrs, req->buf + sizeof(u_int32_t),
+                  size - sizeof(u_int32_t), XDR_ENCODE);
+    ok = xdr_replymsg(&xdrs, msg);
+    u_int32_t len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok) {
+        free(req);
+        return FALSE;
+    }
+
+    u_int32_t mark = htonl(LAST_FRAG | len);
+    memcpy(req->buf, &mark, sizeof(mark));
+    req->len = sizeof(mark) + len;
+
+    if (send_reply(mx->conn, req) < 0) {
+        mx->broken = 1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static bool_t mem_recv(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    (void)xprt; (void)msg;
+    return FALSE;
+}
+
+static enum xprt_stat mem_stat(SVCXPRT *xprt)
+{
+    (void)xprt;
+    return XPRT_IDLE;
+}
+
+static void mem_destroy(SVCXPRT *xprt)
+{
+    (void)xprt;
+}
+
+static const struct xp_ops mem_xp_ops = {
+    .xp_recv = mem_recv,
+    .xp_stat = mem_stat,
+    .xp_getargs = mem_getargs,
+    .xp_reply = mem_reply,
+    .xp_freeargs = mem_freeargs,
+    .xp_destroy = mem_destroy,
+};
+
+// per-frame state (the "xprt" of the frame handler)
+struct frame_xprt {
+    struct send_req *reply;
+};
+
+char* event_loop_frame_reply(void *xprt, size_t len)
+{
+    struct frame_xprt *fx = (struct frame_xprt *)xprt;
+
+    assert((fx->reply == NULL) && 
+           (len <= GIGA_FRAME_MAX_LEN - sizeof(u_int32_t)));
+
+    fx->reply = alloc_or_die(malloc(sizeof(struct send_req) +
+                                    GIGA_FRAME_HDR_SIZE + len));
+    fx->reply->len = GIGA_FRAME_HDR_SIZE + len;
+
+    return fx->reply->buf + GIGA_FRAME_HDR_SIZE;
+}
+
+/* run a binary frame of "conn"; returns -1 if the connection is broken */
+static int run_frame(struct conn *conn, struct request *req)
+{
+    struct frame_xprt fx;
+    u_int32_t mark;
+
+    fx.reply = NULL;
+    if ((loop.frame_handler == NULL) || (req->len < sizeof(u_int32_t)) ||
+        (loop.frame_handler(&fx, req->buf + sizeof(u_int32_t),
+                            req->len - sizeof(u_int32_t)) < 0) ||
+        (fx.reply == NULL)) {
+        logMessage(LOG_ERR, __func__, "bad frame, closing connection.");
+        free(fx.reply);
+        return -1;
+    }
+    COUNT(calls);
+
+    // the reply has the mark, and the xid of the call
+    mark = htonl(GIGA_FRAME_MARK(fx.reply->len - sizeof(mark)));
+    memcpy(fx.reply->buf, &mark, sizeof(mark));
+    memcpy(fx.reply->buf + sizeof(mark), req->buf, sizeof(u_int32_t));
+
+    return send_reply(conn, fx.reply);
+}
+
+/* run one call of "conn"; returns -1 if the connection is broken */
+static int run_request(struct conn *conn, struct request *req)
+{
+    char cred_area[2*MAX_AUTH_BYTES];
+    struct rpc_msg msg;
+    struct svc_req rqst;
+    struct mem_xprt mx;
+    SVCXPRT xprt;
+
+    if (req->frame)
+        return run_frame(conn, req);
+
+    memset(&mx, 0, sizeof(mx));
+    mx.conn = conn;
+    memset(&xprt, 0, sizeof(xprt));
+    xprt.xp_fd = conn->fd;
+    xprt.xp_ops = &mem_xp_ops;
+    xprt.xp_verf = _null_auth;
+    xprt.xp_p1 = &mx;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.rm_call.cb_cred.oa_base = cred_area;
+    msg.rm_call.cb_verf.oa_base = cred_area + MAX_AUTH_BYTES;
+
+    xdrmem_create(&mx.in, req->buf, req->len, XDR_DECODE);
+    if (!xdr_callmsg(&mx.in, &msg) || msg.rm_direction != CALL) {
+        logMessage(LOG_ERR, __func__, "bad call, closing connection.");
+        xdr_destroy(&mx.in);
+        return -1;
+    }
+    mx.xid = msg.rm_xid;
+
+    memset(&rqst, 0, sizeof(rqst));
+    rqst.rq_prog = msg.rm_call.cb_prog;
+    rqst.rq_vers = msg.rm_call.cb_vers;
+    rqst.rq_proc = msg.rm_call.cb_proc;
+    rqst.rq_cred = msg.rm_call.cb_cred;
+    rqst.rq_xprt = &xprt;
+
+    if (msg.rm_call.cb_rpcvers != RPC_MSG_VERSION)
+        svcerr_noprog(&xprt);
+    else if (rqst.rq_prog != loop.prog)
+        svcerr_noprog(&xprt);
+    else if (rqst.rq_vers != loop.vers)
+        svcerr_progvers(&xprt, loop.vers, loop.vers);
+    else
+        loop.dispatch(&rqst, &xprt);
+
+    xdr_destroy(&mx.in);
+    COUNT(calls);
+
+    return mx.broken ? -1 : 0;
+}
+
+static void* worker_thread(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        struct conn *conn = dequeue_conn();
+        struct request *req;
+        int broken = 0;
+
+        pthread_mutex_lock(&conn->mtx);
+        conn->state = CONN_BUSY;
+        while ((req = conn->head) != NULL) {
+            conn->head = req->next;
+            if (conn->head == NULL)
+                conn->tail = NULL;
+            pthread_mutex_unlock(&conn->mtx);
+
+            if (!broken && run_request(conn, req) < 0) {
+                // the loop thread sees the shutdown, and lets it go
+                shutdown(conn->fd, SHUT_RDWR);
+                broken = 1;
+            }
+            free(req);
+
+            pthread_mutex_lock(&conn->mtx);
+        }
+        conn->state = CONN_IDLE;
+        pthread_mutex_unlock(&conn->mtx);
+
+        put_conn(conn);
+    }
+
+    return NULL;
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * The io_uring loop uses the system calls directly (no liburing). The low
+ * bits of the user_data of an operation tell what it was; receives and
+ * sends also carry their connection or reply.
+ */
+
+#define URING_ENTRIES       1024
+#define URING_NUM_BUFS      1024            /* a power of 2 */
+#define URING_BUF_SIZE      16384
+#define URING_BUF_GROUP     0
+
+#define OP_RECV             0               /* (struct conn *) */
+#define OP_SEND             1               /* (struct send_req *) */
+#define OP_ACCEPT           2
+#define OP_WAKEUP           3
+#define OP_MASK             3UL
+
+struct uring {
+    int fd;
+    int listen_fd;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending;            // filled in, not submitted yet
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* buffers the kernel receives into */
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    unsigned short buf_tail;
+
+    /* replies queued by the workers */
+    pthread_mutex_t send_mtx;
+    struct send_req *send_head, *send_tail;
+    int sleeping;                   // in io_uring_enter(), waiting
+    int wakeup_fd;                  // eventfd waking it up
+    uint64_t wakeup_val;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode,
+                                 void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* set up the ring, from the thread that will submit to it (the ring is 
+ * IORING_SETUP_SINGLE_ISSUER); returns NULL if this kernel can't do it */
+static struct uring* uring_create(int listen_fd)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct uring *ring;
+    char *rings = MAP_FAILED;
+    size_t rings_len = 0, sqes_len = 0;
+    const char *what;
+    unsigned i;
+
+    ring = alloc_or_die(calloc(1, sizeof(struct uring)));
+    ring->fd = -1;
+    ring->listen_fd = listen_fd;
+    ring->sqes = MAP_FAILED;
+    ring->buf_ring = MAP_FAILED;
+    ring->wakeup_fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    what = "io_uring_setup()";
+    if ((ring->fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0)
+        goto err;
+    what = "io_uring (too old)";
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        errno = ENOSYS;
+        goto err;
+    }
+
+    // both queues are in one mapping (IORING_FEAT_SINGLE_MMAP)
+    size_t sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    rings_len = sq_len > cq_len ? sq_len : cq_len;
+    sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+    what = "io_uring mmap()";
+    rings = mmap(NULL, rings_len, PROT_READ | PROT_WRITE, 
+                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED)
+        goto err;
+    ring->sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, 
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto err;
+    ring->buf_ring = mmap(NULL, URING_NUM_BUFS*sizeof(struct io_uring_buf),
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED)
+        goto err;
+
+    ring->sq_head = (unsigned *)(rings + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(rings + p.sq_off.ring_mask);
+    ring->cq_head = (unsigned *)(rings + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(rings + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+
+    // SQEs are used in order, so the index array never changes
+    for (i = 0; i < p.sq_entries; i++)
+        ((unsigned *)(rings + p.sq_off.array))[i] = i;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_NUM_BUFS;
+    reg.bgid = URING_BUF_GROUP;
+    what = "io_uring buffer ring";
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, 
+                              &reg, 1) < 0)
+        goto err;
+    ring->bufs = alloc_or_die(malloc((size_t)URING_NUM_BUFS*URING_BUF_SIZE));
+
+    what = "eventfd()";
+    if ((ring->wakeup_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        goto err;
+    pthread_mutex_init(&ring->send_mtx, NULL);
+
+    // io_uring waits for connections itself
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+    return ring;
+
+err:
+    logMessage(LOG_ERR, __func__, "%s failed: %s", what, strerror(errno));
+    if (ring->wakeup_fd >= 0)
+        close(ring->wakeup_fd);
+    free(ring->bufs);
+    if (ring->buf_ring != MAP_FAILED)
+        munmap(ring->buf_ring, URING_NUM_BUFS*sizeof(struct io_uring_buf));
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, sqes_len);
+    if (rings != MAP_FAILED)
+        munmap(rings, rings_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+    return NULL;
+}
+
+static void uring_add_buf(struct uring *ring, unsigned short bid)
+{
+    struct io_uring_buf *buf =
+        &ring->buf_ring->bufs[ring->buf_tail & (URING_NUM_BUFS - 1)];
+
+    buf->addr = (unsigned long)(ring->bufs + (size_t)bid*URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* submit what is filled in, and wait for a completion if "wait" */
+static int uring_submit(struct uring *ring, int wait)
+{
+    int ret;
+
+    do {
+        ret = sys_io_uring_enter(ring->fd, ring->sq_pending, wait ? 1 : 0,
+                                 wait ? IORING_ENTER_GETEVENTS : 0);
+        COUNT(syscalls);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        logMessage(LOG_FATAL, __func__,
+                   "io_uring_enter() failed: %s", strerror(errno));
+        return -1;
+    }
+    ring->sq_pending -= ret;
+
+    return 0;
+}
+
+static struct io_uring_sqe* uring_get_sqe(struct uring *ring)
+{
+    unsigned tail = *ring->sq_tail;
+
+    // queue full: submit, and use the entries the kernel is done with
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >
+           ring->sq_mask) {
+        if (uring_submit(ring, 0) < 0)
+            exit(1);
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+
+    return sqe;
+}
+
+static void uring_prep_accept(struct uring *ring)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ring->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void uring_prep_recv(struct uring *ring, struct conn *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (unsigned long)conn | OP_RECV;
+}
+
+static void uring_prep_send(struct uring *ring, struct send_req *req)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = req->conn->fd;
+    sqe->addr = (unsigned long)(req->buf + req->off);
+    sqe->len = req->len - req->off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)req | OP_SEND;
+}
+
+static void uring_prep_wakeup(struct uring *ring)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ring->wakeup_fd;
+    sqe->addr = (unsigned long)&ring->wakeup_val;
+    sqe->len = sizeof(ring->wakeup_val);
+    sqe->user_data = OP_WAKEUP;
+}
+
+/* queue a reply (called by the workers) */
+static void uring_send(struct send_req *req)
+{
+    struct uring *ring = loop.uring;
+    uint64_t one = 1;
+    int sleeping;
+
+    req->next = NULL;
+
+    pthread_mutex_lock(&ring->send_mtx);
+    if (ring->send_tail)
+        ring->send_tail->next = req;
+    else
+        ring->send_head = req;
+    ring->send_tail = req;
+    sleeping = ring->sleeping;
+    ring->sleeping = 0;
+    pthread_mutex_unlock(&ring->send_mtx);
+
+    // a busy ring thread picks the reply up on its next round
+    if (sleeping) {
+        if (write(ring->wakeup_fd, &one, sizeof(one)) < 0)
+            logMessage(LOG_ERR, __func__, "eventfd write failed.");
+        COUNT(syscalls);
+    }
+}
+
+/* start sending the replies queued by the workers; a connection has one
+ * send in flight at a time, so replies can't interleave */
+static void uring_start_sends(struct uring *ring)
+{
+    struct send_req *req, *next;
+
+    pthread_mutex_lock(&ring->send_mtx);
+    req = ring->send_head;
+    ring->send_head = ring->send_tail = NULL;
+    pthread_mutex_unlock(&ring->send_mtx);
+
+    for (; req != NULL; req = next) {
+        struct conn *conn = req->conn;
+        next = req->next;
+        req->next = NULL;
+
+        if (conn->send_tail) {
+            conn->send_tail->next = req;
+            conn->send_tail = req;
+        }
+        else {
+            conn->send_head = conn->send_tail = req;
+            uring_prep_send(ring, req);
+        }
+    }
+}
+
+static void uring_send_done(struct uring *ring, struct send_req *req, int res)
+{
+    struct conn *conn = req->conn;
+
+    if (res > 0 && req->off + res < req->len) {
+        req->off += res;
+        uring_prep_send(ring, req);
+        return;
+    }
+
+    // the receive sees the shutdown, and lets the connection go
+    if (res < 0)
+        shutdown(conn->fd, SHUT_RDWR);
+
+    conn->send_head = req->next;
+    if (conn->send_head)
+        uring_prep_send(ring, conn->send_head);
+    else
+        conn->send_tail = NULL;
+
+    free(req);
+    put_conn(conn);
+}
+
+static void uring_recv_done(struct uring *ring, struct conn *conn,
+                            int res, unsigned flags)
+{
+    struct request *head = NULL, *tail = NULL;
+    int eof = 0;
+
+    if (res > 0) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (add_input(conn, ring->bufs + (size_t)bid*URING_BUF_SIZE, res,
+                      &head, &tail) < 0) {
+            logMessage(LOG_ERR, __func__,
+                       "call too large, closing connection.");
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+        uring_add_buf(ring, bid);
+    }
+
+    // a multishot receive stops at the end of the connection, on errors,
+    // and when it runs out of buffers
+    if (!(flags & IORING_CQE_F_MORE)) {
+        if (res > 0 || res == -ENOBUFS)
+            uring_prep_recv(ring, conn);
+        else
+            eof = 1;
+    }
+
+    deliver_requests(conn, head, tail, eof);
+}
+
+static void uring_accept_done(struct uring *ring, int res, unsigned flags)
+{
+    if (res >= 0) {
+        uring_prep_recv(ring, new_conn(res));
+        LOG_MSG(LOG_DEBUG, "connection accept()ed.");
+    }
+    else
+        logMessage(LOG_ERR, __func__, "err_accept()ing: %s", strerror(-res));
+
+    if (!(flags & IORING_CQE_F_MORE))
+        uring_prep_accept(ring);
+}
+
+/* The ring is created by the thread that submits to it, which tells 
+ * event_loop_start() whether that worked (it falls back to epoll if not). */
+struct uring_start {
+    int listen_fd;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int done;
+    struct uring *ring;
+};
+
+static void* uring_thread(void *arg)
+{
+    struct uring_start *start = (struct uring_start *)arg;
+    struct uring *ring;
+    unsigned head, tail;
+    int i;
+
+    ring = uring_create(start->listen_fd);
+    loop.uring = ring;
+    pthread_mutex_lock(&start->mtx);
+    start->ring = ring;
+    start->done = 1;
+    pthread_cond_signal(&start->cond);
+    pthread_mutex_unlock(&start->mtx);
+    if (ring == NULL)
+        return NULL;
+
+    for (i = 0; i < URING_NUM_BUFS; i++)
+        uring_add_buf(ring, i);
+    uring_prep_accept(ring);
+    uring_prep_wakeup(ring);
+
+    while (1) {
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        // wait in the kernel only if there is nothing else to do
+        int wait = 0;
+        if (head == tail) {
+            pthread_mutex_lock(&ring->send_mtx);
+            if (ring->send_head == NULL)
+                wait = ring->sleeping = 1;
+            pthread_mutex_unlock(&ring->send_mtx);
+        }
+
+        if (wait || ring->sq_pending > 0) {
+            if (uring_submit(ring, wait) < 0)
+                break;
+            if (wait) {
+                pthread_mutex_lock(&ring->send_mtx);
+                ring->sleeping = 0;
+                pthread_mutex_unlock(&ring->send_mtx);
+            }
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            void *ptr = (void *)(unsigned long)(cqe->user_data & ~OP_MASK);
+
+            switch (cqe->user_data & OP_MASK) {
+                case OP_RECV:
+                    uring_recv_done(ring, ptr, cqe->res, cqe->flags);
+                    break;
+                case OP_SEND:
+                    uring_send_done(ring, ptr, cqe->res);
+                    break;
+                case OP_ACCEPT:
+                    uring_accept_done(ring, cqe->res, cqe->flags);
+                    break;
+                case OP_WAKEUP:
+                    uring_prep_wakeup(ring);
+                    break;
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        uring_start_sends(ring);
+    }
+
+    return NULL;
+}
+
+#endif /* HAVE_IO_URING */
+
+void event_loop_set_frame_handler(event_loop_frame_t handler)
+{
+    loop.frame_handler = handler;
+}
+
+int event_loop_start(int listen_fd, int num_workers, transport_t transport,
+                     u_long prog, u_long vers, event_loop_dispatch_t dispatch,
+                     pthread_t *loop_tid)
+{
+    void *(*loop_thread)(void *) = event_loop_thread;
+    struct epoll_event ev;
+    pthread_t tid;
+    int i;
+
+    loop.listen_fd = listen_fd;
+    loop.prog = prog;
+    loop.vers = vers;
+    loop.dispatch = dispatch;
+    pthread_mutex_init(&loop.mtx, NULL);
+    pthread_cond_init(&loop.cond, NULL);
+
+    if (transport == TRANSPORT_IO_URING) {
+#ifdef HAVE_IO_URING
+        struct uring_start start;
+
+        memset(&start, 0, sizeof(start));
+        start.listen_fd = listen_fd;
+        pthread_mutex_init(&start.mtx, NULL);
+        pthread_cond_init(&start.cond, NULL);
+        if (pthread_create(loop_tid, NULL, uring_thread, &start) == 0) {
+            pthread_mutex_lock(&start.mtx);
+            while (!start.done)
+                pthread_cond_wait(&start.cond, &start.mtx);
+            pthread_mutex_unlock(&start.mtx);
+            if (start.ring != NULL)
+                loop_thread = NULL;     // already running
+            else
+                pthread_join(*loop_tid, NULL);
+        }
+        pthread_mutex_destroy(&start.mtx);
+        pthread_cond_destroy(&start.cond);
+#endif
+        if (loop_thread == event_loop_thread)
+            logMessage(LOG_WARN, __func__, "no io_uring, using epoll.");
+    }
+
+    if (loop_thread == event_loop_thread) {
+        if ((loop.epoll_fd = epoll_create1(0)) < 0) {
+            logMessage(LOG_FATAL, __func__,
+                       "epoll_create1() failed: %s", strerror(errno));
+            return -errno;
+        }
+
+        // the listening socket is the (only) event without a connection
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+            logMessage(LOG_FATAL, __func__,
+                       "epoll_ctl(ADD) failed: %s", strerror(errno));
+            return -errno;
+        }
+    }
+
+    if (num_workers < 1)
+        num_workers = 1;
+    for (i = 0; i < num_workers; i++) {
+        if (pthread_create(&tid, NULL, worker_thread, NULL) != 0) {
+            logMessage(LOG_FATAL, __func__, "ERROR: during pthread_create().");
+            return -EAGAIN;
+        }
+        pthread_detach(tid);
+    }
+
+    if ((loop_thread != NULL) &&
+        (pthread_create(loop_tid, NULL, loop_thread, NULL) != 0)) {
+        logMessage(LOG_FATAL, __func__, "ERROR: during pthread_create().");
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+void event_loop_get_stats(struct event_loop_stats *stats)
+{
+    stats->calls = __sync_fetch_and_add(&loop.stats.calls, 0);
+    stats->syscalls = __sync_fetch_and_add(&loop.stats.syscalls, 0);
+}
+
+#ifdef EVENT_LOOP_BENCH
+
+// Compares the epoll and io_uring transports with the previous server model
+// (a thread per client connection, each in its own select(); kept below,
+// with poll(), as a reference): a forked server answers NULLPROC calls
+// while "num_conns" client connections, spread over BENCH_CLIENT_THREADS
+// threads, each make BENCH_CALLS_PER_CONN calls in turn. Reports throughput,
+// the latency of the calls, the system calls the transport made per call,
+// and the threads and memory used by the server.
+//
+// Build (from server/):
+//   gcc -O2 -DEVENT_LOOP_BENCH -iquote .. -o event_loop_bench
+//       event_loop.c ../common/debugging.c -lpthread
+//   ./event_loop_bench [num_conns]
+//
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_PROG              0x20000099
+#define BENCH_VERS              1
+#define BENCH_WORKERS           32
+#define BENCH_CLIENT_THREADS    16
+#define BENCH_CALLS_PER_CONN    100
+#define BENCH_STATS_PROC        1       /* replies with the loop's stats */
+
+enum bench_model {
+    MODEL_THREADS,
+    MODEL_EPOLL,
+    MODEL_IO_URING
+};
+
+extern SVCXPRT *svcfd_create (int __sock, u_int __sendsize, u_int __recvsize);
+
+static bool_t xdr_bench_stats(XDR *xdrs, struct event_loop_stats *stats)
+{
+    return xdr_uint64_t(xdrs, &stats->calls) &&
+           xdr_uint64_t(xdrs, &stats->syscalls);
+}
+
+static void bench_prog_1(struct svc_req *rqstp, SVCXPRT *transp)
+{
+    struct event_loop_stats stats;
+
+    if (rqstp->rq_proc == BENCH_STATS_PROC) {
+        event_loop_get_stats(&stats);
+        svc_sendreply(transp, (xdrproc_t)xdr_bench_stats, (char *)&stats);
+    }
+    else
+        svc_sendreply(transp, (xdrproc_t)xdr_void, NULL);
+}
+
+static void* legacy_handler_thread(void *arg)
+{
+    int fd = (int)(long)arg;
+    SVCXPRT *svc = svcfd_create(fd, 0, 0);
+
+    if (!svc_register(svc, BENCH_PROG, BENCH_VERS, bench_prog_1, 0)) {
+        svc_destroy(svc);
+        return NULL;
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    while (poll(&pfd, 1, -1) > 0 && !(pfd.revents & POLLNVAL))
+        svc_getreq_common(fd);      // destroys the transport at EOF
+
+    return NULL;
+}
+
+static void* legacy_accept_loop(void *arg)
+{
+    int listen_fd = (int)(long)arg;
+    pthread_t tid;
+
+    while (1) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        poll(&pfd, 1, -1);
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        if (pthread_create(&tid, NULL, legacy_handler_thread, 
+                           (void *)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    return NULL;
+}
+
+/* fork a server; returns its pid, and its port in "port" */
+static pid_t bench_server(enum bench_model model, int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 4096) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        close(listen_fd);
+        return pid;
+    }
+
+    pthread_t tid;
+    if (model == MODEL_THREADS)
+        pthread_create(&tid, NULL, legacy_accept_loop, (void *)(long)listen_fd);
+    else {
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+        if (event_loop_start(listen_fd, BENCH_WORKERS,
+                             model == MODEL_IO_URING ? TRANSPORT_IO_URING
+                                                     : TRANSPORT_EPOLL,
+                             BENCH_PROG, BENCH_VERS, bench_prog_1, &tid) < 0)
+            exit(1);
+    }
+    pthread_join(tid, NULL);
+    exit(0);
+}
+
+static long server_status(pid_t pid, const char *field)
+{
+    char path[64], line[256];
+    long value = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            value = atol(line + strlen(field) + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+struct bench_client {
+    pthread_t tid;
+    CLIENT **clnts;
+    int num_clnts;
+    double *latencies;      // of each call, in usecs
+    int errors;
+};
+
+static double now_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e6 + ts.tv_nsec/1e3;
+}
+
+static void* bench_client_thread(void *arg)
+{
+    struct bench_client *c = (struct bench_client *)arg;
+    struct timeval to = { 60, 0 };
+    double *latency = c->latencies;
+    int i, j;
+
+    for (i = 0; i < BENCH_CALLS_PER_CONN; i++) {
+        for (j = 0; j < c->num_clnts; j++) {
+            double start = now_usecs();
+            if (clnt_call(c->clnts[j], NULLPROC, (xdrproc_t)xdr_void, NULL,
+                          (xdrproc_t)xdr_void, NULL, to) != RPC_SUCCESS)
+                c->errors++;
+            *latency++ = now_usecs() - start;
+        }
+    }
+
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void get_stats(CLIENT *clnt, struct event_loop_stats *stats)
+{
+    struct timeval to = { 60, 0 };
+
+    memset(stats, 0, sizeof(*stats));
+    if (clnt_call(clnt, BENCH_STATS_PROC, (xdrproc_t)xdr_void, NULL,
+                  (xdrproc_t)xdr_bench_stats, (char *)stats, to)
+        != RPC_SUCCESS)
+        clnt_perror(clnt, "stats");
+}
+
+static void bench_model(const char *name, enum bench_model model,
+                        pid_t pid, int port, int num_conns)
+{
+    struct event_loop_stats before, after;
+    struct bench_client clients[BENCH_CLIENT_THREADS];
+    struct sockaddr_in addr;
+    struct timeval start, end;
+    int i, errors = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    CLIENT **clnts = alloc_or_die(malloc(num_conns*sizeof(CLIENT *)));
+    for (i = 0; i < num_conns; i++) {
+        int sock = RPC_ANYSOCK;
+        clnts[i] = clnttcp_create(&addr, BENCH_PROG, BENCH_VERS, &sock, 0, 0);
+        if (clnts[i] == NULL) {
+            clnt_pcreateerror("clnttcp_create");
+            kill(pid, SIGKILL);
+            exit(1);
+        }
+    }
+
+    long calls = (long)num_conns*BENCH_CALLS_PER_CONN;
+    double *latencies = alloc_or_die(malloc(calls*sizeof(double)));
+
+    if (model != MODEL_THREADS)
+        get_stats(clnts[0], &before);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_CLIENT_THREADS; i++) {
+        int first = i*num_conns/BENCH_CLIENT_THREADS;
+        clients[i].clnts = clnts + first;
+        clients[i].num_clnts = (i+1)*num_conns/BENCH_CLIENT_THREADS - first;
+        clients[i].latencies = latencies + (long)first*BENCH_CALLS_PER_CONN;
+        clients[i].errors = 0;
+        pthread_create(&clients[i].tid, NULL, bench_client_thread, &clients[i]);
+    }
+    for (i = 0; i < BENCH_CLIENT_THREADS; i++) {
+        pthread_join(clients[i].tid, NULL);
+        errors += clients[i].errors;
+    }
+    gettimeofday(&end, NULL);
+
+    double secs = (end.tv_sec - start.tv_sec) + 
+                  (end.tv_usec - start.tv_usec)/1e6;
+
+    // the transport's system calls (not counted for threads)
+    char syscalls[16] = "-";
+    if (model != MODEL_THREADS) {
+        get_stats(clnts[0], &after);
+        snprintf(syscalls, sizeof(syscalls), "%.2f",
+                 (double)(after.syscalls - before.syscalls) /
+                 (after.calls - before.calls));
+    }
+
+    qsort(latencies, calls, sizeof(double), cmp_double);
+    printf("%-22s %5d conns: %8.0f calls/sec, latency p50 %6.0f us, "
+           "p99 %6.0f us, %5s syscalls/call, "
+           "server: %5ld threads, %6ld kB RSS (%d errors)\n",
+           name, num_conns, calls/secs,
+           latencies[calls/2], latencies[calls*99/100], syscalls,
+           server_status(pid, "Threads:"), server_status(pid, "VmRSS:"),
+           errors);
+    free(latencies);
+
+    for (i = 0; i < num_conns; i++)
+        clnt_destroy(clnts[i]);
+    free(clnts);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv)
+{
+    int num_conns = (argc > 1) ? atoi(argv[1]) : 1024;
+    struct rlimit rl;
+
+    log_fp = stderr;
+    sys_log_level = LOG_ERR;
+
+    // clients and the server each have a socket per connection
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    // fork the servers before the clients use any memory
+    int legacy_port, epoll_port, uring_port;
+    pid_t legacy_pid = bench_server(MODEL_THREADS, &legacy_port);
+    pid_t epoll_pid = bench_server(MODEL_EPOLL, &epoll_port);
+    pid_t uring_pid = bench_server(MODEL_IO_URING, &uring_port);
+
+    bench_model("thread per connection", MODEL_THREADS,
+                legacy_pid, legacy_port, num_conns);
+    bench_model("epoll + worker pool", MODEL_EPOLL,
+                epoll_pid, epoll_port, num_conns);
+    bench_model("io_uring + worker pool", MODEL_IO_URING,
+                uring_pid, uring_port, num_conns);
+
+    return 0;
+}
+
+#endif /* EVENT_LOOP_BENCH */
@@ -0,0 +1,47 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <stdint.h>
+
+#include "common/options.h"
+
+/* RPC dispatcher generated by rpcgen (e.g., giga_rpc_prog_4) */
+typedef void (*event_loop_dispatch_t)(struct svc_req *rqstp, SVCXPRT *transp);
+
+/* Handler of the binary frames (see common/rpc_frame.h) that clients may
+ * send besides the Sun RPC calls: it gets the body of a frame (after its 
+ * mark and xid), which it may decode in place, and the "xprt" to get the 
+ * body of the reply from, with event_loop_frame_reply(). Returns 0, or -1 
+ * if the frame is not valid (the connection is then closed).
+ */
+typedef int (*event_loop_frame_t)(void *xprt, char *frame, size_t len);
+
+struct event_loop_stats {
+    uint64_t calls;         // calls run
+    uint64_t syscalls;      // made to read calls and send replies
+};
+
+/* Serve RPC program "prog" (version "vers") on the connections accepted from
+ * "listen_fd": one thread accepts connections and reads the calls from all
+ * of them (with epoll, or io_uring if "transport" asks for it and the kernel
+ * has it), and "num_workers" threads run "dispatch" for them.
+ * Calls of one connection run one at a time, in the order they were sent.
+ * Returns 0 and the id of the loop thread in "loop_tid", or -errno.
+ */
+int event_loop_start(int listen_fd, int num_workers, transport_t transport,
+                     u_long prog, u_long vers, event_loop_dispatch_t dispatch,
+                     pthread_t *loop_tid);
+
+/* Serve binary frames with "handler" too (call before event_loop_start());
+ * without a handler, a client sending a frame is disconnected.
+ */
+void event_loop_set_frame_handler(event_loop_frame_t handler);
+
+/* the buffer for the "len" bytes of the body of the reply to a frame */
+char* event_loop_frame_reply(void *xprt, size_t len);
+
+void event_loop_get_stats(struct event_loop_stats *stats);
+
+#endif /* EVENT_LOOP_H */
@@ -9,11 +9,15 @@
 
 #include "backends/operations.h"
 
+#include "event_loop.h"
+#include "split.h"
+
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
 #include <rpc/clnt.h>
@@ -25,7 +29,6 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/resource.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -35,114 +38,173 @@
 
 static pthread_t listen_tid;
 
-extern SVCXPRT *svcfd_create (int __sock, u_int __sendsize, u_int __recvsize);
-// FIXME: rpcgen should put this in giga_rpc.h, but it doesn't. Why?
-extern void giga_rpc_prog_1(struct svc_req *rqstp, register SVCXPRT *transp);
+// Object ids are handed out from a range that is stored (as the "object_id"
+// metadata of the root directory, next to its split state) before any id of
+// it is used; a restarted server goes on after the stored range. The range
+// counts this server's ids: the n-th one is (n * num_servers + serverID), so
+// that no two servers hand out the same id.
+//
+#define OBJECT_ID_META      "object_id"
+#define OBJECT_ID_RESERVE   4096
 
-// Methods to handle requests from client connections
-static void * handler_thread(void *arg);
+int object_id;
+static volatile int object_id_limit;    // ids up to this are reserved
+static pthread_mutex_t object_id_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// FIXME: rpcgen should put this in giga_rpc.h, but it doesn't. Why?
+extern void giga_rpc_prog_4(struct svc_req *rqstp, register SVCXPRT *transp);
 
 // Methods to setup server's socket connections
 static void server_socket();
 static void setup_listener(int listen_fd);
-static void * main_select_loop(void * listen_fd);
 
-static 
-void sig_handler(const int sig)
+// Print the non-empty buckets of a log2 histogram ("<2^i:count ...").
+//
+static
+void format_histogram(char *buf, size_t size, const unsigned long *hist)
 {
-    (void)sig;
-    printf("SIGINT handled.\n");
-    exit(1);
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; (i < LDB_HIST_BUCKETS) && (len < size); i++) {
+        if (hist[i] == 0)
+            continue;
+        if (i == LDB_HIST_BUCKETS-1)
+            len += snprintf(buf+len, size-len, " >=%lu:%lu", 1UL << (i-1), 
+                            hist[i]);
+        else
+            len += snprintf(buf+len, size-len, " <%lu:%lu", 1UL << i, 
+                            hist[i]);
+    }
 }
 
+// SIGINT is blocked in all threads, and taken by this one with sigwait(): 
+// the stats are then dumped from normal (not signal handler) context.
+//
 static 
-void * handler_thread(void *arg)
+void* sig_thread(void *arg)
 {
-    int fd = (int) (long) arg;
-    SVCXPRT *svc = svcfd_create(fd, 0, 0);
-    
-    if(!svc_register(svc, GIGA_RPC_PROG, GIGA_RPC_VERSION, giga_rpc_prog_1, 0)) {
-        fprintf(stdout, "ERROR: svc_register() error.\n");
-        svc_destroy(svc);
-        goto leave;
+    sigset_t *set = (sigset_t*)arg;
+    struct cache_stats stats;
+    struct ldb_commit_stats commit_stats;
+    char latency[MAX_LEN], group_size[MAX_LEN];
+    int i, sig;
+
+    while (sigwait(set, &sig) != 0)
+        ;
+
+    cache_get_stats(&stats);
+    logMessage(LOG_DEBUG, __func__, 
+               "dircache: %lu hits, %lu misses (%lu loaded), %lu evictions, "
+               "%lu dirs in %lu bytes", stats.hits, stats.misses, stats.loads, 
+               stats.evictions, stats.dirs, stats.bytes);
+
+    for (i = 0; i < ldb_num_shards; i++) {
+        leveldb_get_commit_stats(ldb_shards[i], &commit_stats);
+        format_histogram(latency, sizeof(latency), commit_stats.latency);
+        format_histogram(group_size, sizeof(group_size), 
+                         commit_stats.group_size);
+        logMessage(LOG_DEBUG, __func__, 
+                   "leveldb shard %d: %lu commits in %lu group writes; "
+                   "latency (usecs):%s; group size (entries):%s", i,
+                   commit_stats.commits, commit_stats.writes, 
+                   latency, group_size);
     }
-    
-    while (1) {
-        fd_set readfds, exceptfds;
-        FD_ZERO(&readfds);
-        FD_SET(fd, &readfds);
 
-        FD_ZERO(&exceptfds);
-        FD_SET(fd, &exceptfds);
-
-        if (select(fd + 1, &readfds, NULL, &exceptfds, NULL) < 0) {
-            logMessage(LOG_DEBUG, __func__, 
-                      "select()ing error on a socket. %s", strerror(errno));
-            break;
-        }
+    printf("SIGINT handled.\n");
+    exit(1);
+}
 
-        if (FD_ISSET(fd, &exceptfds)) {
-            logMessage(LOG_DEBUG, __func__, 
-                       "Leave RPC select(), descripter registered an exception.\n");
-            break;
-        }
+static
+int store_object_id_limit(int limit)
+{
+    char val[sizeof(int)];
+    XDR xdrs;
+    int ret;
+
+    xdrmem_create(&xdrs, val, sizeof(val), XDR_ENCODE);
+    if (!xdr_int(&xdrs, &limit))
+        ret = -EIO;
+    else
+        ret = leveldb_put_dir_meta(*leveldb_shard(ROOT_DIR_ID, 
+                                                  DIR_META_PARTITION), 
+                                   ROOT_DIR_ID, OBJECT_ID_META, 
+                                   val, xdr_getpos(&xdrs));
+    xdr_destroy(&xdrs);
+
+    return ret;
+}
 
-        if (FD_ISSET(fd, &readfds)){
-            svc_getreqset(&readfds);
-        }
+static
+void load_object_id()
+{
+    char *val;
+    size_t val_len;
+    XDR xdrs;
+    int ret;
+
+    object_id = 0;
+    if ((ret = leveldb_get_dir_meta(*leveldb_shard(ROOT_DIR_ID, 
+                                                   DIR_META_PARTITION),
+                                    ROOT_DIR_ID, OBJECT_ID_META,
+                                    &val, &val_len)) == 0) {
+        xdrmem_create(&xdrs, val, val_len, XDR_DECODE);
+        if (!xdr_int(&xdrs, &object_id) || (object_id < 0))
+            ret = -EIO;
+        xdr_destroy(&xdrs);
+        free(val);
     }
+    if ((ret < 0) && (ret != -ENOENT)) {
+        logMessage(LOG_FATAL, __func__, "bad object id in leveldb.");
+        exit(1);
+    }
+    object_id_limit = object_id;
 
-leave:
-    close(fd);
-
-    logMessage(LOG_DEBUG, __func__, "Connection closed.");
-
-    return 0;
+    logMessage(LOG_DEBUG, __func__, "object id sequence starts after %d.", 
+               object_id);
 }
 
-static void* 
-main_select_loop(void * listen_fd_arg)
+int new_object_id()
 {
-    int conn_fd;
-    long listen_fd = (long) listen_fd_arg;
-    
-    while (1) {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(listen_fd, &fds);
-
-        int i = select(listen_fd+1, &fds, 0, 0, 0);
-        if (i <= 0) {
-            logMessage(LOG_DEBUG, __func__, "select()ing error.");
-            continue;
-        }
+    int n = __sync_add_and_fetch(&object_id, 1);
+    int num_servers = giga_options_t.num_servers;
 
-        struct sockaddr_in remote_addr;
-        socklen_t len = sizeof(remote_addr);
-        conn_fd = accept(listen_fd, (struct sockaddr *) &remote_addr, &len);
-        if (conn_fd < 0) {
-            logMessage(LOG_DEBUG, __func__, "err_accept()ing: %s", strerror(errno));
-            continue;
-        }
-        logMessage(LOG_DEBUG, __func__, "connection accept()ed from {%s:%d}.", 
-                   inet_ntoa(remote_addr.sin_addr),ntohs(remote_addr.sin_port));
-        
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, 
-                           handler_thread, (void *)(unsigned long)conn_fd) < 0) {
-            logMessage(LOG_DEBUG, __func__, "ERROR: during pthread_create().");
-            close(conn_fd);
-            continue;
-        } 
+    if (n > (INT_MAX - giga_options_t.serverID) / num_servers) {
+        logMessage(LOG_ERR, __func__, "out of object ids.");
+        return -ENOSPC;
+    }
 
-        if (pthread_detach(tid) < 0){
-            logMessage(LOG_DEBUG, __func__, "ERROR: unable to detach thread().");
+    if (n > object_id_limit) {
+        pthread_mutex_lock(&object_id_mtx);
+        if (n > object_id_limit) {
+            int limit = n + OBJECT_ID_RESERVE;
+            if (store_object_id_limit(limit) == 0)
+                object_id_limit = limit;
+            else
+                n = -EIO;
         }
+        pthread_mutex_unlock(&object_id_mtx);
     }
-    
-    logMessage(LOG_DEBUG, __func__,  "WARNING: Exiting select(). WHY??? HOW???");
 
-    return NULL;
+    return (n < 0) ? n : n * num_servers + giga_options_t.serverID;
+}
+
+static
+void setup_sig_thread()
+{
+    static sigset_t set;
+    pthread_t tid;
+
+    // block SIGINT before any other thread starts (they inherit the mask)
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    if ((pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) ||
+        (pthread_create(&tid, NULL, sig_thread, &set) != 0)) {
+        logMessage(LOG_FATAL, __func__, "ERROR: SIGINT thread setup failed.");
+        exit(1);
+    }
+    pthread_detach(tid);
 }
 
 static 
@@ -170,7 +232,16 @@ void setup_listener(int listen_fd)
         exit(1);
     }
 
-    pthread_create(&listen_tid, NULL, main_select_loop, (void*)(long)listen_fd);
+    // requests of all client connections are served by a fixed set of 
+    // threads (see event_loop.h), in Sun RPC or binary frames
+    event_loop_set_frame_handler(giga_frame_dispatch);
+    if (event_loop_start(listen_fd, giga_options_t.num_workers,
+                         giga_options_t.transport, GIGA_RPC_PROG,
+                         GIGA_RPC_VERSION, giga_rpc_prog_4, &listen_tid) < 0) {
+        close(listen_fd);
+        logMessage(LOG_FATAL, __func__, "ERROR: event loop setup failed.");
+        exit(1);
+    }
     
     logMessage(LOG_DEBUG, __func__, "Listener setup (port %d of %s). Success.",
                ntohs(serv_addr.sin_port), inet_ntoa(serv_addr.sin_addr));
@@ -224,6 +295,25 @@ void set_sockopt_server(int sock_fd)
     return;
 }
 
+/** Allow as many open files as the hard limit: the server has a socket for
+ * each client.
+ */
+static 
+void raise_fd_limit()
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
+    
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        logMessage(LOG_DEBUG, __func__, "ERROR: setrlimit(RLIMIT_NOFILE).");
+    }
+
+    return;
+}
+
 static 
 void server_socket()
 {
@@ -268,19 +358,35 @@ void init_root_partition()
     // initialize backend based on the type of backend.
     //
     char ldb_name[MAX_LEN] = {0};
+    int ret;
     switch (giga_options_t.backend_type) {
         case BACKEND_LOCAL_LEVELDB:
-            //TODO: leveldb setup and initialization
-            snprintf(ldb_name, strlen(ldb_name), 
+        case BACKEND_RPC_LEVELDB:
+            if ((mkdir(DEFAULT_LEVELDB_DIR, DEFAULT_MODE) < 0) && 
+                (errno != EEXIST)) {
+                logMessage(LOG_FATAL, __func__, 
+                           "leveldb dir creation error: %s", strerror(errno));
+                exit(1);
+            }
+            snprintf(ldb_name, sizeof(ldb_name), 
                      "%s/%d-%s", 
                      DEFAULT_LEVELDB_DIR, giga_options_t.serverID,
                      DEFAULT_LEVELDB_PREFIX);
-            leveldb_init(ldb_mds, ldb_name);
-            object_id = 0;
-            if (leveldb_create(ldb_mds, 
-                               ROOT_DIR_ID, 0,
-                               OBJ_DIR, 
-                               object_id, "/", giga_options_t.mountpoint) < 0) {
+            if (leveldb_init_shards(ldb_name, giga_options_t.ldb_shards) < 0) {
+                logMessage(LOG_FATAL, __func__, "leveldb init error.");
+                exit(1);
+            }
+            static const struct cache_store split_store = {
+                .load = split_load_state,
+                .store = split_store_state,
+            };
+            cache_set_store(&split_store);
+            load_object_id();
+            ret = leveldb_create(*leveldb_shard(ROOT_DIR_ID, 0), 
+                                 ROOT_DIR_ID, 0,
+                                 OBJ_DIR, 
+                                 0, "/", DEFAULT_MODE, NULL);
+            if ((ret < 0) && (ret != -EEXIST)) {     // kept from a restart
                 logMessage(LOG_FATAL, __func__, "root entry creation error.");
                 exit(1);
             }
@@ -346,9 +452,8 @@ int main(int argc, char **argv)
     }
     */
 
-    signal(SIGINT, sig_handler);    // handling SIGINT
-    
     logOpen(DEFAULT_LOG_FILE_LOCATIONs, LOG_TRACE);     // init logging.
+    setup_sig_thread();             // handling SIGINT
     initGIGAsetting(GIGA_SERVER, DEFAULT_CONF_FILE);    // init GIGA+ options.
 
     if (giga_options_t.serverID == -1){
@@ -362,6 +467,7 @@ int main(int argc, char **argv)
     init_root_partition();  // init root partition on each server.
     init_giga_mapping();    // init GIGA+ mapping structure.
 
+    raise_fd_limit();
     server_socket();        // start server socket(s). 
 
     // FIXME: we sleep 15 seconds here to let the other servers startup.  This
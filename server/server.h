@@ -10,7 +10,17 @@
 
 #define SPLIT_THRESHOLD 4000
 
-static int object_id;
+extern int object_id;   /* object ids handed out so far (see server.c) */
+
+/* Hand out a new object id, unique among all servers, or return -EIO if its
+ * reservation could not be stored (-ENOSPC if there are no ids left).
+ */
+int new_object_id();
+
+/* Frame handler of the event loop: runs the calls sent in binary frames
+ * (see RPC_handlers.c).
+ */
+int giga_frame_dispatch(void *xprt, char *frame, size_t len);
 
 struct giga_directory giga_dir_t;
 
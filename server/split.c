@@ -0,0 +1,1052 @@
+
+#include "common/cache.h"
+#include "common/connection.h"
+#include "common/debugging.h"
+#include "common/giga_index.h"
+#include "common/options.h"
+#include "common/rpc_giga.h"
+
+#include "backends/operations.h"
+
+#include "server.h"
+#include "split.h"
+
+#include "common/utlist.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Migrations into this server, from their MIGRATE_BEGIN until MIGRATE_END
+// has added the partition (or failed).
+//
+struct migration {
+    DIR_handle_t dir_id;
+    index_t index;
+    unsigned int id;            // chosen by the sender
+    int ending;                 // MIGRATE_END is adding the partition
+    int errnum;                 // first error while ingesting chunks
+    int num_entries;            // entries ingested so far
+    int counted;                // entries added to the partition's size
+    struct migration *next;
+};
+
+static struct migration *migrations = NULL;
+static pthread_mutex_t migrations_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static int persist_partitions(struct giga_directory *dir, 
+                              struct giga_mapping_t *mapping,
+                              struct giga_mapping_t *before);
+
+static 
+void grow_partition_size(struct giga_directory *dir, index_t index)
+{
+    int len;
+    int *size;
+
+    if (index < dir->partition_size_len)
+        return;
+
+    len = dir->partition_size_len * 2;
+    if (len <= index)
+        len = index + 1;
+
+    if ((size = realloc(dir->partition_size, len*sizeof(int))) == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    memset(&size[dir->partition_size_len], 0, 
+           (len - dir->partition_size_len)*sizeof(int));
+
+    dir->partition_size = size;
+    dir->partition_size_len = len;
+}
+
+int split_add_entries(struct giga_directory *dir, index_t index, int delta)
+{
+    grow_partition_size(dir, index);
+    dir->partition_size[index] += delta;
+    dir->dirty = 1;
+
+    return ((dir->partition_size[index] >= SPLIT_THRESHOLD) &&
+            (dir->split_index == -1) && !dir->split_queued &&
+            giga_is_splittable(&dir->mapping, index));
+}
+
+// Move the entries that go to "new_index" to the front of "entries", and
+// return how many there are.
+//
+static 
+int select_moving_entries(struct giga_mapping_t *mapping, index_t new_index,
+                          struct ldb_entry *entries, int num_entries)
+{
+    int i, num_moving = 0;
+
+    for (i = 0; i < num_entries; i++) {
+        if (giga_file_migration_status(mapping, entries[i].name, new_index)) {
+            struct ldb_entry tmp = entries[num_moving];
+            entries[num_moving] = entries[i];
+            entries[i] = tmp;
+            num_moving++;
+        }
+    }
+
+    return num_moving;
+}
+
+// Entries are packed back to back in a chunk: the length of the name 
+// (including its '\0') and of the value, as 32-bit integers in network
+// order, followed by the name and the value.
+//
+#define PACKED_HDR_SIZE     (2*sizeof(uint32_t))
+
+static
+int packed_size(struct ldb_entry *entry)
+{
+    return PACKED_HDR_SIZE + strlen(entry->name) + 1 + entry->val_len;
+}
+
+static
+int pack_entry(char *buf, struct ldb_entry *entry)
+{
+    uint32_t name_len = strlen(entry->name) + 1;
+    uint32_t val_len = entry->val_len;
+    uint32_t hdr[2];
+
+    hdr[0] = htonl(name_len);
+    hdr[1] = htonl(val_len);
+    memcpy(buf, hdr, PACKED_HDR_SIZE);
+    memcpy(buf + PACKED_HDR_SIZE, entry->name, name_len);
+    memcpy(buf + PACKED_HDR_SIZE + name_len, entry->val, val_len);
+
+    return PACKED_HDR_SIZE + name_len + val_len;
+}
+
+// Unpack a chunk into "entries", which point into the chunk; returns the 
+// number of entries, or -1 if the chunk is malformed.
+//
+static
+int unpack_entries(char *chunk, int chunk_len, struct ldb_entry **entries)
+{
+    struct ldb_entry *e = NULL;
+    int n = 0, len = 0;
+    int off = 0;
+
+    while (off < chunk_len) {
+        uint32_t hdr[2];
+
+        if (chunk_len - off < (int)PACKED_HDR_SIZE)
+            goto malformed;
+        memcpy(hdr, chunk + off, PACKED_HDR_SIZE);
+        uint32_t name_len = ntohl(hdr[0]);
+        uint32_t val_len = ntohl(hdr[1]);
+        off += PACKED_HDR_SIZE;
+
+        if ((name_len == 0) || (name_len > (uint32_t)(chunk_len - off)) ||
+            (val_len > (uint32_t)(chunk_len - off) - name_len) ||
+            (chunk[off + name_len - 1] != '\0'))
+            goto malformed;
+
+        if (n == len) {
+            len = (len > 0) ? len*2 : 256;
+            if ((e = realloc(e, len*sizeof(struct ldb_entry))) == NULL) {
+                logMessage(LOG_FATAL, __func__, 
+                           "malloc_err: %s", strerror(errno));
+                exit(1);
+            }
+        }
+        e[n].name = chunk + off;
+        e[n].val = chunk + off + name_len;
+        e[n].val_len = val_len;
+        n++;
+
+        off += name_len + val_len;
+    }
+
+    *entries = e;
+    return n;
+
+malformed:
+    free(e);
+    return -1;
+}
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+// Send chunk number "seq": the last chunk of every window of "credits" 
+// chunks waits for the receiver's reply, the others are batched calls (no
+// reply; Sun RPC sends them when its buffer fills or with the next call).
+//
+static
+int send_chunk(CLIENT *rpc_clnt, DIR_handle_t dir_id, index_t index, 
+               int seq, int credits, char *chunk, int chunk_len)
+{
+    giga_migrate_reply_t rpc_reply;
+    giga_migrate_chunk data;
+    int ret;
+
+    data.giga_migrate_chunk_len = chunk_len;
+    data.giga_migrate_chunk_val = chunk;
+
+    if (((seq + 1) % credits) != 0) {
+        struct timeval no_wait = {0, 0};
+        giga_rpc_migrate_chunk_4_argument arg;
+
+        arg.arg1 = dir_id;
+        arg.arg2 = index;
+        arg.arg3 = seq;
+        arg.arg4 = data;
+        if (clnt_call(rpc_clnt, GIGA_RPC_MIGRATE_CHUNK,
+                      (xdrproc_t)xdr_giga_rpc_migrate_chunk_4_argument, 
+                      (caddr_t)&arg, (xdrproc_t)NULL, NULL, 
+                      no_wait) != RPC_SUCCESS) {
+            logMessage(LOG_ERR, __func__, "RPC_error: migrate_chunk failed.");
+            clnt_perror(rpc_clnt, "(migrate_chunk failed)");
+            return -EIO;
+        }
+        return 0;
+    }
+
+    memset(&rpc_reply, 0, sizeof(rpc_reply));
+    if (giga_rpc_migrate_chunk_4(dir_id, index, seq, data, 
+                                 &rpc_reply, rpc_clnt) != RPC_SUCCESS) {
+        logMessage(LOG_ERR, __func__, "RPC_error: migrate_chunk failed.");
+        clnt_perror(rpc_clnt, "(migrate_chunk failed)");
+        return -EIO;
+    }
+    ret = rpc_reply.errnum;
+    xdr_free((xdrproc_t)xdr_giga_migrate_reply_t, (char *)&rpc_reply);
+
+    return ret;
+}
+
+// Ids of the migrations of this server: a sequence number, starting from
+// the time the server started, so that the ids of a restarted server do not
+// repeat the ones its peers may still remember.
+//
+static unsigned int migration_seq = 0;
+
+static 
+unsigned int new_migration_id(void)
+{
+    static unsigned int start = 0;
+
+    if (start == 0)
+        __sync_bool_compare_and_swap(&start, 0, (unsigned int)time(NULL) << 12);
+
+    return start + __sync_add_and_fetch(&migration_seq, 1);
+}
+
+// The reply to MIGRATE_END of migration "id" was lost (the receiver may or
+// may not have added the partition): ask the receiver how the migration 
+// stands, and end it again while it is still open. Returns 0 if the 
+// receiver has the partition, and an error if it will never have it (or
+// could not be reached in MIGRATE_RETRIES tries).
+//
+static
+int finish_migration(DIR_handle_t dir_id, index_t index, unsigned int id,
+                     struct giga_mapping_t *mapping, int server, 
+                     int num_entries)
+{
+    giga_migrate_reply_t status_reply;
+    giga_result_t end_reply;
+    CLIENT *rpc_clnt;
+    int ret = -EINPROGRESS;
+    int i;
+
+    for (i = 0; (i < MIGRATE_RETRIES) && (ret == -EINPROGRESS); i++) {
+        usleep(MIGRATE_RETRY_DELAY << i);
+
+        if ((rpc_clnt = getConnection(server)) == NULL)
+            continue;
+
+        memset(&status_reply, 0, sizeof(status_reply));
+        if (giga_rpc_migrate_status_4(dir_id, index, id, 
+                                      &status_reply, rpc_clnt) != RPC_SUCCESS) {
+            clnt_perror(rpc_clnt, "(migrate_status failed)");
+            discardConnection(server, rpc_clnt);
+            continue;
+        }
+        ret = status_reply.errnum;
+        xdr_free((xdrproc_t)xdr_giga_migrate_reply_t, (char *)&status_reply);
+
+        if (ret == -EINPROGRESS) {
+            memset(&end_reply, 0, sizeof(end_reply));
+            if (giga_rpc_migrate_end_4(dir_id, index, id, *mapping, 
+                                       num_entries, &end_reply, 
+                                       rpc_clnt) != RPC_SUCCESS) {
+                clnt_perror(rpc_clnt, "(migrate_end failed)");
+                discardConnection(server, rpc_clnt);
+                continue;
+            }
+            ret = end_reply.errnum;
+            xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&end_reply);
+        }
+        putConnection(server, rpc_clnt);
+    }
+
+    if (ret == -EINPROGRESS) {
+        logMessage(LOG_ERR, __func__, "dir(%d) p%d: server-%d did not tell "
+                   "how migration %u ended", dir_id, index, server, id);
+        ret = -EIO;
+    }
+
+    return ret;
+}
+
+// Stream the entries of the new partition to the server that owns it, and
+// tell it that the partition is complete.
+//
+static 
+int migrate_entries(DIR_handle_t dir_id, index_t new_index, 
+                    struct giga_mapping_t *mapping, int server,
+                    struct ldb_entry *entries, int num_entries)
+{
+    int ret = 0;
+    int i, credits;
+    int seq = 0, chunk_len = 0;
+    char *chunk = NULL;
+    giga_migrate_reply_t begin_reply;
+    giga_result_t end_reply;
+    unsigned int id = new_migration_id();
+    double start = now_sec();
+
+    // the whole stream uses one connection (the batched chunks are sent on
+    // it with the calls that follow them)
+    CLIENT *rpc_clnt = getConnection(server);
+    if (rpc_clnt == NULL)
+        return -EIO;
+
+    memset(&begin_reply, 0, sizeof(begin_reply));
+    if (giga_rpc_migrate_begin_4(dir_id, new_index, id,
+                                 &begin_reply, rpc_clnt) != RPC_SUCCESS) {
+        logMessage(LOG_ERR, __func__, "RPC_error: migrate_begin failed.");
+        clnt_perror(rpc_clnt, "(migrate_begin failed)");
+        ret = -EIO;
+        goto rpc_error;
+    }
+    ret = begin_reply.errnum;
+    credits = (begin_reply.credits > 0) ? begin_reply.credits : 1;
+    xdr_free((xdrproc_t)xdr_giga_migrate_reply_t, (char *)&begin_reply);
+    if (ret < 0)
+        goto leave;
+
+    if ((chunk = malloc(MIGRATE_CHUNK_SIZE)) == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0; (i < num_entries) && (ret == 0); i++) {
+        assert(packed_size(&entries[i]) <= MIGRATE_CHUNK_SIZE);
+        if (chunk_len + packed_size(&entries[i]) > MIGRATE_CHUNK_SIZE) {
+            ret = send_chunk(rpc_clnt, dir_id, new_index, seq++, credits, 
+                             chunk, chunk_len);
+            chunk_len = 0;
+        }
+        chunk_len += pack_entry(chunk + chunk_len, &entries[i]);
+    }
+    if ((ret == 0) && (chunk_len > 0))
+        ret = send_chunk(rpc_clnt, dir_id, new_index, seq++, credits, 
+                         chunk, chunk_len);
+    if (ret < 0)
+        goto rpc_error;     // the stream is cut short, with calls in flight
+
+    // the reply to MIGRATE_END also covers all the batched chunks before it
+    memset(&end_reply, 0, sizeof(end_reply));
+    if (giga_rpc_migrate_end_4(dir_id, new_index, id, *mapping, num_entries,
+                               &end_reply, rpc_clnt) != RPC_SUCCESS) {
+        logMessage(LOG_ERR, __func__, "RPC_error: migrate_end failed.");
+        clnt_perror(rpc_clnt, "(migrate_end failed)");
+        discardConnection(server, rpc_clnt);
+        free(chunk);
+        return finish_migration(dir_id, new_index, id, mapping, server, 
+                                num_entries);
+    }
+    ret = end_reply.errnum;
+    xdr_free((xdrproc_t)xdr_giga_result_t, (char *)&end_reply);
+
+    double elapsed = now_sec() - start;
+    LOG_MSG(LOG_DEBUG, "dir(%d) p%d: migrated %d entries in %d chunks to "
+            "server-%d in %.3f sec (%.0f entries/sec)", 
+            dir_id, new_index, num_entries, seq, server, elapsed, 
+            (elapsed > 0) ? num_entries/elapsed : 0.0);
+
+leave:
+    putConnection(server, rpc_clnt);
+    free(chunk);
+
+    return ret;
+
+rpc_error:
+    discardConnection(server, rpc_clnt);
+    free(chunk);
+
+    return ret;
+}
+
+// Find the migration into partition "index" of "dir_id"; the caller holds
+// migrations_mtx.
+//
+static
+struct migration* find_migration(DIR_handle_t dir_id, index_t index)
+{
+    struct migration *m;
+
+    LL_FOREACH(migrations, m) {
+        if ((m->dir_id == dir_id) && (m->index == index))
+            return m;
+    }
+
+    return NULL;
+}
+
+// Take back the entries that an unfinished migration added to the size of
+// its partition (they get counted again when they are sent again).
+//
+static
+void uncount_migration(DIR_handle_t dir_id, index_t index, int counted)
+{
+    struct giga_directory *dir;
+
+    if ((counted == 0) || ((dir = cache_fetch(&dir_id)) == NULL))
+        return;
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    split_add_entries(dir, index, -counted);
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    cache_return(dir);
+}
+
+// Return 1 if partition "index" of "dir_id" is in our mapping.
+//
+static
+int have_partition(DIR_handle_t dir_id, index_t index)
+{
+    struct giga_directory *dir;
+    int ret;
+
+    if ((dir = cache_fetch(&dir_id)) == NULL)
+        return 0;
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    ret = ((unsigned int)(index / BITS_PER_MAP) < dir->mapping.bitmap_len) &&
+          ((dir->mapping.bitmap[index / BITS_PER_MAP] >> 
+            (index % BITS_PER_MAP)) & 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    cache_return(dir);
+
+    return ret;
+}
+
+int split_migrate_begin(DIR_handle_t dir_id, index_t index, unsigned int id)
+{
+    struct migration *m;
+    int counted = 0;
+
+    pthread_mutex_lock(&migrations_mtx);
+    if ((m = find_migration(dir_id, index)) != NULL && m->ending) {
+        pthread_mutex_unlock(&migrations_mtx);
+        return -EBUSY;
+    }
+    if (m == NULL) {
+        if ((m = malloc(sizeof(struct migration))) == NULL) {
+            logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+            exit(1);
+        }
+        m->dir_id = dir_id;
+        m->index = index;
+        m->counted = 0;
+        LL_PREPEND(migrations, m);
+    }
+    // a migration that was not finished (by its sender) starts over
+    m->id = id;
+    m->ending = 0;
+    m->errnum = 0;
+    m->num_entries = 0;
+    counted = m->counted;
+    m->counted = 0;
+    pthread_mutex_unlock(&migrations_mtx);
+
+    uncount_migration(dir_id, index, counted);
+
+    LOG_MSG(LOG_TRACE, "dir(%d) p%d: migration %u begins", 
+            dir_id, index, id);
+
+    return 0;
+}
+
+// Ingest a chunk with one LevelDB write batch. The partition is not in our
+// mapping until MIGRATE_END, so nobody else uses it meanwhile.
+//
+int split_migrate_chunk(DIR_handle_t dir_id, index_t index, 
+                        char *chunk, int chunk_len)
+{
+    struct ldb_entry *entries = NULL;
+    struct giga_directory *dir;
+    struct migration *m;
+    int n, counted = 0, ret = 0;
+
+    if ((n = unpack_entries(chunk, chunk_len, &entries)) < 0)
+        ret = -EINVAL;
+    else if ((dir = cache_fetch(&dir_id)) == NULL)
+        ret = -EIO;
+    else {
+        ret = leveldb_insert_entries(*leveldb_shard(dir_id, index), 
+                                     dir_id, index, entries, n);
+        if (ret == 0) {
+            pthread_mutex_lock(&dir->partition_mtx);
+            split_add_entries(dir, index, n);
+            pthread_mutex_unlock(&dir->partition_mtx);
+            counted = n;
+        }
+        cache_return(dir);
+    }
+    free(entries);
+
+    pthread_mutex_lock(&migrations_mtx);
+    if ((m = find_migration(dir_id, index)) == NULL)
+        ret = -EINVAL;
+    else {
+        m->counted += counted;
+        counted = 0;
+        if (m->errnum < 0)
+            ret = m->errnum;
+        else if (ret < 0)
+            m->errnum = ret;
+        else
+            m->num_entries += n;
+    }
+    pthread_mutex_unlock(&migrations_mtx);
+
+    // a chunk of no (known) migration
+    uncount_migration(dir_id, index, counted);
+
+    return ret;
+}
+
+// Remove migration "m" (that has ended) from the list.
+//
+static
+void drop_migration(struct migration *m)
+{
+    pthread_mutex_lock(&migrations_mtx);
+    LL_DELETE(migrations, m);
+    pthread_mutex_unlock(&migrations_mtx);
+
+    free(m);
+}
+
+int split_migrate_status(DIR_handle_t dir_id, index_t index, unsigned int id)
+{
+    struct migration *m;
+    int ret;
+
+    // a migration stays in the list until its partition is in our mapping
+    pthread_mutex_lock(&migrations_mtx);
+    if ((m = find_migration(dir_id, index)) == NULL)
+        ret = 1;
+    else if (m->id != id)
+        ret = -ENOENT;
+    else
+        ret = (m->errnum < 0) ? m->errnum : -EINPROGRESS;
+    pthread_mutex_unlock(&migrations_mtx);
+
+    if (ret == 1)
+        ret = have_partition(dir_id, index) ? 0 : -ENOENT;
+
+    return ret;
+}
+
+int split_migrate_end(DIR_handle_t dir_id, index_t index, unsigned int id,
+                      struct giga_mapping_t *mapping, int num_entries)
+{
+    struct giga_directory *dir;
+    struct migration *m;
+    int ret = 0;
+
+    pthread_mutex_lock(&migrations_mtx);
+    if ((m = find_migration(dir_id, index)) == NULL) {
+        pthread_mutex_unlock(&migrations_mtx);
+        // sent again after the partition was added (the reply was lost)
+        return have_partition(dir_id, index) ? 0 : -ENOENT;
+    }
+    if ((m->id != id) || m->ending) {
+        pthread_mutex_unlock(&migrations_mtx);
+        return (m->id != id) ? -ENOENT : -EINPROGRESS;
+    }
+    m->ending = 1;
+    pthread_mutex_unlock(&migrations_mtx);
+
+    if (m->errnum < 0)
+        ret = m->errnum;
+    else if (m->num_entries != num_entries)
+        ret = -EIO;
+
+    if (ret < 0) {
+        logMessage(LOG_ERR, __func__, "dir(%d) p%d: migration failed: %s",
+                   dir_id, index, strerror(-ret));
+        uncount_migration(dir_id, index, m->counted);
+        drop_migration(m);
+        return ret;
+    }
+
+    if ((dir = cache_fetch(&dir_id)) == NULL) {
+        uncount_migration(dir_id, index, m->counted);
+        drop_migration(m);
+        return -EIO;
+    }
+
+    // we now own the new partition: learn the splitting server's view of the
+    // directory, and add the new partition to it (and then store the new
+    // partitions, without the lock).
+    struct giga_mapping_t before, after;
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+    pthread_mutex_lock(&dir->partition_mtx);
+    giga_copy_mapping(&before, &dir->mapping, 1);
+    giga_update_cache(&dir->mapping, mapping);
+    giga_update_mapping(&dir->mapping, index);
+    cache_publish_mapping(dir);
+    giga_copy_mapping(&after, &dir->mapping, 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    persist_partitions(dir, &after, &before);
+
+    giga_free_mapping(&before);
+    giga_free_mapping(&after);
+
+    cache_return(dir);
+
+    // only now, so that a MIGRATE_END (or MIGRATE_STATUS) sent again finds 
+    // the partition in our mapping
+    drop_migration(m);
+
+    LOG_MSG(LOG_TRACE, "dir(%d) p%d: migration of %d entries done", 
+            dir_id, index, num_entries);
+
+    return 0;
+}
+
+// Splitting a partition:
+// (1) mark the partition as splitting (mkdirs for it get -EAGAIN, and are
+//     retried by their clients), find the index of the new partition, and 
+//     wait for the mkdirs that were already writing their entries (they may
+//     be in this partition);
+// (2) read the partition, and pick the entries that hash to the new one;
+// (3) store them in the new partition: locally, or on its server followed 
+//     by a SPLIT_DONE that adds the partition to that server's mapping;
+// (4) store the new partition, and add it to our mapping under the lock 
+//     (lookups see the entries in the old partition or in the new one);
+// (5) drop the moved entries from the old partition: their names map to 
+//     the new partition now, so no lookup or create reaches these copies.
+// Only (1) and the mapping update of (4) hold dir->partition_mtx, the 
+// LevelDB reads and writes run without it.
+//
+void split_bucket(struct giga_directory *dir, index_t index)
+{
+    struct giga_mapping_t mapping;
+    struct ldb_entry *entries = NULL;
+    int num_entries = 0, num_moving = 0;
+    index_t new_index;
+    int new_server;
+    int ret;
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    dir->split_queued = 0;
+    if ((dir->split_index != -1) || 
+        (index >= dir->partition_size_len) ||
+        (dir->partition_size[index] < SPLIT_THRESHOLD) ||
+        !giga_is_splittable(&dir->mapping, index)) {
+        pthread_mutex_unlock(&dir->partition_mtx);
+        return;
+    }
+    new_index = giga_index_for_splitting(&dir->mapping, index);
+    dir->split_index = index;
+    // mkdirs from now on count in the other epoch
+    int epoch = dir->create_epoch;
+    dir->create_epoch ^= 1;
+    while (dir->creates[epoch] > 0)
+        pthread_cond_wait(&dir->split_cond, &dir->partition_mtx);
+    memset(&mapping, 0, sizeof(mapping));
+    giga_copy_mapping(&mapping, &dir->mapping, 1);
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    new_server = giga_get_server_for_index(&mapping, new_index);
+
+    LOG_MSG(LOG_DEBUG, "split dir(%d): p%d --> p%d on server-%d", 
+            dir->handle, index, new_index, new_server);
+
+    ret = leveldb_get_partition(*leveldb_shard(dir->handle, index), 
+                                dir->handle, index, &entries, &num_entries);
+    if (ret < 0)
+        goto abort;
+
+    num_moving = select_moving_entries(&mapping, new_index, 
+                                       entries, num_entries);
+
+    if (new_server == giga_options_t.serverID)
+        ret = leveldb_insert_entries(*leveldb_shard(dir->handle, new_index),
+                                     dir->handle, new_index, 
+                                     entries, num_moving);
+    else
+        ret = migrate_entries(dir->handle, new_index, &mapping, new_server,
+                              entries, num_moving);
+    if (ret < 0)
+        goto abort;
+
+    struct giga_mapping_t after;
+    memset(&after, 0, sizeof(after));
+    giga_copy_mapping(&after, &mapping, 1);
+    giga_update_mapping(&after, new_index);
+    persist_partitions(dir, &after, &mapping);
+    giga_free_mapping(&after);
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    giga_update_mapping(&dir->mapping, new_index);
+    cache_publish_mapping(dir);
+    split_add_entries(dir, index, -num_moving);
+    if (new_server == giga_options_t.serverID)
+        split_add_entries(dir, new_index, num_moving);
+    dir->split_index = -1;
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    if (leveldb_remove_entries(*leveldb_shard(dir->handle, index), 
+                               dir->handle, index, entries, num_moving) < 0)
+        logMessage(LOG_ERR, __func__, "stale copies of moved entries "
+                   "left in dir(%d) p%d", dir->handle, index);
+
+    LOG_MSG(LOG_DEBUG, "split dir(%d): p%d --> p%d done (%d of %d entries).",
+            dir->handle, index, new_index, num_moving, num_entries);
+
+    leveldb_free_entries(entries, num_entries);
+    giga_free_mapping(&mapping);
+    return;
+
+abort:
+    logMessage(LOG_ERR, __func__, "split dir(%d): p%d --> p%d failed: %s",
+               dir->handle, index, new_index, strerror(-ret));
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    dir->split_index = -1;
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    leveldb_free_entries(entries, num_entries);
+    giga_free_mapping(&mapping);
+}
+
+// Splits queued for the split threads (SPLIT_THREADS of them, so a long
+// migration does not hold up the splits of other directories; a directory
+// splits one partition at a time, see split_bucket()).
+//
+struct split_req {
+    struct giga_directory *dir;     // referenced until the split is done
+    index_t index;
+    struct split_req *next;
+};
+
+static struct split_req *split_queue = NULL;
+static pthread_mutex_t split_queue_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t split_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t split_threads_once = PTHREAD_ONCE_INIT;
+
+static 
+void* split_thread(void *arg)
+{
+    (void)arg;
+    struct split_req *req;
+
+    while (1) {
+        pthread_mutex_lock(&split_queue_mtx);
+        while (split_queue == NULL)
+            pthread_cond_wait(&split_queue_cond, &split_queue_mtx);
+        req = split_queue;
+        LL_DELETE(split_queue, req);
+        pthread_mutex_unlock(&split_queue_mtx);
+
+        split_bucket(req->dir, req->index);
+
+        cache_return(req->dir);
+        free(req);
+    }
+
+    return NULL;
+}
+
+static 
+void start_split_threads(void)
+{
+    pthread_t tid;
+    int i;
+
+    for (i = 0; i < SPLIT_THREADS; i++) {
+        if (pthread_create(&tid, NULL, split_thread, NULL) != 0) {
+            logMessage(LOG_FATAL, __func__, "ERROR: during pthread_create().");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+}
+
+void split_schedule(struct giga_directory *dir, index_t index)
+{
+    struct split_req *req;
+    DIR_handle_t handle = dir->handle;
+
+    pthread_mutex_lock(&dir->partition_mtx);
+    if (dir->split_queued) {
+        pthread_mutex_unlock(&dir->partition_mtx);
+        return;
+    }
+    dir->split_queued = 1;
+    pthread_mutex_unlock(&dir->partition_mtx);
+
+    pthread_once(&split_threads_once, start_split_threads);
+
+    if ((req = malloc(sizeof(struct split_req))) == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+    req->dir = cache_fetch(&handle);    // the caller's reference keeps it
+    req->index = index;
+
+    pthread_mutex_lock(&split_queue_mtx);
+    LL_APPEND(split_queue, req);
+    pthread_cond_signal(&split_queue_cond);
+    pthread_mutex_unlock(&split_queue_mtx);
+
+    LOG_MSG(LOG_DEBUG, "split dir(%d): p%d queued", handle, index);
+}
+
+// The split state of a directory is kept in its metadata partition:
+// - "mapping": the parameters of its mapping (servers, hash, split policy);
+// - "p<index>": an empty key for each partition, added as the partition is
+//   created, so a split only writes its new partition;
+// - "sizes": the number of entries in each partition, written when the 
+//   directory is evicted (after a crash, partitions count from zero again).
+// Directories that never split have nothing stored, and start over. All of
+// it is in the shard of the metadata partition, so it is read in one scan,
+// and the new partitions are stored with the parameters in one write.
+//
+#define STATE_MAPPING       "mapping"
+#define STATE_SIZES         "sizes"
+#define STATE_PARTITION     'p'
+
+#define MAPPING_PARAMS_SIZE 32      // bytes of XDR for the parameters
+#define MAX_PARTITION_NAME  16      // "p<index>"
+
+static struct LevelDB* meta_shard(struct giga_directory *dir)
+{
+    return leveldb_shard(dir->handle, DIR_META_PARTITION);
+}
+
+static 
+bool_t xdr_mapping_params(XDR *xdrs, struct giga_mapping_t *mapping)
+{
+    if (!xdr_u_int(xdrs, &mapping->zeroth_server))
+        return FALSE;
+    if (!xdr_u_int(xdrs, &mapping->server_count))
+        return FALSE;
+    if (!xdr_u_int(xdrs, &mapping->hash_type))
+        return FALSE;
+    if (!xdr_u_int(xdrs, &mapping->split_type))
+        return FALSE;
+    if (!xdr_u_int(xdrs, &mapping->split_bound))
+        return FALSE;
+    if ((xdrs->x_op == XDR_DECODE) && 
+        (!giga_hash_supported(mapping->hash_type) ||
+         !giga_split_supported(mapping->split_type, mapping->split_bound)))
+        return FALSE;
+
+    return TRUE;
+}
+
+static
+bool_t xdr_partition_sizes(XDR *xdrs, struct giga_directory *dir)
+{
+    u_int len = dir->partition_size_len;
+
+    if (!xdr_array(xdrs, (char **)&dir->partition_size, &len, 1<<MAX_RADIX, 
+                   sizeof(int), (xdrproc_t)xdr_int))
+        return FALSE;
+    dir->partition_size_len = len;
+
+    return TRUE;
+}
+
+// Store the partitions of "mapping" (a copy of the mapping of "dir") that
+// are not in "before", with the parameters of the mapping, in one write; 
+// the caller does not hold dir->partition_mtx.
+//
+static 
+int persist_partitions(struct giga_directory *dir, 
+                       struct giga_mapping_t *mapping,
+                       struct giga_mapping_t *before)
+{
+    char params[MAPPING_PARAMS_SIZE];
+    struct ldb_entry *entries;
+    char *names;
+    unsigned int w;
+    int n = 0, num_new = 0;
+    XDR xdrs;
+
+    for (w = 0; w < mapping->bitmap_len; w++) {
+        bitmap_t old = (w < before->bitmap_len) ? before->bitmap[w] : 0;
+        num_new += __builtin_popcountll(mapping->bitmap[w] & ~old);
+    }
+    if (num_new == 0)
+        return 0;
+
+    entries = malloc((num_new+1)*sizeof(struct ldb_entry));
+    names = malloc(num_new*MAX_PARTITION_NAME);
+    if ((entries == NULL) || (names == NULL)) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    xdrmem_create(&xdrs, params, sizeof(params), XDR_ENCODE);
+    if (!xdr_mapping_params(&xdrs, mapping))
+        assert(0);
+    entries[n].name = STATE_MAPPING;
+    entries[n].val = params;
+    entries[n].val_len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    n++;
+
+    for (w = 0; w < mapping->bitmap_len; w++) {
+        bitmap_t old = (w < before->bitmap_len) ? before->bitmap[w] : 0;
+        bitmap_t added = mapping->bitmap[w] & ~old;
+        while (added != 0) {
+            index_t index = w*BITS_PER_MAP + __builtin_ctzll(added);
+            entries[n].name = &names[(n-1)*MAX_PARTITION_NAME];
+            snprintf(entries[n].name, MAX_PARTITION_NAME, 
+                     "%c%d", STATE_PARTITION, index);
+            entries[n].val = "";
+            entries[n].val_len = 0;
+            n++;
+            added &= added - 1;
+        }
+    }
+
+    int ret = leveldb_insert_entries(*meta_shard(dir), 
+                                     dir->handle, DIR_META_PARTITION,
+                                     entries, n);
+    if (ret < 0)
+        logMessage(LOG_ERR, __func__, "dir(%d): storing %d new partitions "
+                   "failed: %s", dir->handle, num_new, strerror(-ret));
+
+    free(names);
+    free(entries);
+
+    return ret;
+}
+
+int split_load_state(struct giga_directory *dir)
+{
+    struct giga_mapping_t *mapping = &dir->mapping;
+    struct giga_mapping_t params;
+    struct ldb_entry *entries;
+    int num_entries = 0;
+    int i, ret, have_params = 0;
+    XDR xdrs;
+
+    if ((ret = leveldb_get_partition(*meta_shard(dir), 
+                                     dir->handle, DIR_META_PARTITION,
+                                     &entries, &num_entries)) < 0)
+        return ret;
+
+    for (i = 0; (i < num_entries) && (ret == 0); i++) {
+        if (strcmp(entries[i].name, STATE_MAPPING) != 0)
+            continue;
+        xdrmem_create(&xdrs, entries[i].val, entries[i].val_len, XDR_DECODE);
+        if (xdr_mapping_params(&xdrs, &params)) {
+            // rebuild the mapping with its own parameters (which also 
+            // re-creates the partitions of a NO_SPLITTING_EVER policy)
+            giga_free_mapping(mapping);
+            giga_init_mapping(mapping, -1, 
+                              params.zeroth_server, params.server_count);
+            mapping->hash_type = params.hash_type;
+            if (giga_set_split_policy(mapping, params.split_type, 
+                                      params.split_bound) < 0)
+                ret = -EIO;
+            have_params = 1;
+        }
+        else
+            ret = -EIO;
+        xdr_destroy(&xdrs);
+    }
+
+    for (i = 0; (i < num_entries) && (ret == 0); i++) {
+        char *end;
+        if (entries[i].name[0] == STATE_PARTITION) {
+            long index = strtol(entries[i].name+1, &end, 10);
+            if (!have_params || (*end != '\0') || 
+                (index < 0) || (index >= (1<<MAX_RADIX)))
+                ret = -EIO;
+            else
+                giga_update_mapping(mapping, index);
+        }
+        else if (strcmp(entries[i].name, STATE_SIZES) == 0) {
+            free(dir->partition_size);
+            dir->partition_size = NULL;
+            dir->partition_size_len = 0;
+            xdrmem_create(&xdrs, entries[i].val, entries[i].val_len, 
+                          XDR_DECODE);
+            if (!xdr_partition_sizes(&xdrs, dir))
+                ret = -EIO;
+            xdr_destroy(&xdrs);
+        }
+    }
+
+    leveldb_free_entries(entries, num_entries);
+
+    if (ret < 0)
+        logMessage(LOG_ERR, __func__, 
+                   "dir(%d): bad split state in leveldb", dir->handle);
+    else if (num_entries == 0)
+        ret = -ENOENT;
+
+    return ret;
+}
+
+int split_store_state(struct giga_directory *dir)
+{
+    u_int len = xdr_sizeof((xdrproc_t)xdr_partition_sizes, dir);
+    char *val;
+    XDR xdrs;
+    int ret;
+
+    // the partitions are stored as they are created, only the sizes change
+    if ((val = malloc(len)) == NULL) {
+        logMessage(LOG_FATAL, __func__, "malloc_err: %s", strerror(errno));
+        exit(1);
+    }
+
+    xdrmem_create(&xdrs, val, len, XDR_ENCODE);
+    if (!xdr_partition_sizes(&xdrs, dir))
+        ret = -EIO;
+    else
+        ret = leveldb_put_dir_meta(*meta_shard(dir), dir->handle, 
+                                   STATE_SIZES, val, xdr_getpos(&xdrs));
+    xdr_destroy(&xdrs);
+    free(val);
+
+    if (ret == 0)
+        dir->dirty = 0;
+
+    return ret;
+}
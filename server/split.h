@@ -0,0 +1,50 @@
+#ifndef SPLIT_H
+#define SPLIT_H   
+
+#include "common/cache.h"
+#include "common/giga_index.h"
+
+/* Account for "delta" entries added to (or removed from) partition "index"
+ * of "dir"; the caller holds dir->partition_mtx. Returns 1 if the partition
+ * has reached SPLIT_THRESHOLD and can be split.
+ */
+int split_add_entries(struct giga_directory *dir, index_t index, int delta);
+
+/* Split partition "index" of "dir": move the entries that belong to the new
+ * partition to the server that owns it, and then add the new partition to 
+ * the mapping (which clients get with their next -EAGAIN reply). Called 
+ * without dir->partition_mtx held; does nothing if the directory already
+ * has a split in progress.
+ */
+void split_bucket(struct giga_directory *dir, index_t index);
+
+/* Have one of the split threads (started on first use) run split_bucket() 
+ * for partition "index" of "dir", so that the request that filled the 
+ * partition does not wait for the migration. Called without 
+ * dir->partition_mtx held; a directory has at most one split queued.
+ */
+void split_schedule(struct giga_directory *dir, index_t index);
+
+/* Receiving side of a partition migration (GIGA_RPC_MIGRATE_*): chunks of
+ * packed entries are written to partition "index" of "dir_id" as they come,
+ * and MIGRATE_END adds the partition to the directory's mapping if all 
+ * "num_entries" entries arrived. All return 0 or a negative errno; errors
+ * of unacknowledged chunks are reported at the end. MIGRATE_END of the 
+ * migration "id" may be repeated, and split_migrate_status() tells how the
+ * migration stands (see GIGA_RPC_MIGRATE_STATUS).
+ */
+int split_migrate_begin(DIR_handle_t dir_id, index_t index, unsigned int id);
+int split_migrate_chunk(DIR_handle_t dir_id, index_t index, 
+                        char *chunk, int chunk_len);
+int split_migrate_end(DIR_handle_t dir_id, index_t index, unsigned int id,
+                      struct giga_mapping_t *mapping, int num_entries);
+int split_migrate_status(DIR_handle_t dir_id, index_t index, 
+                         unsigned int id);
+
+/* Split state (mapping and partition sizes) of directories, kept in LevelDB
+ * when they are evicted from the directory cache (see struct cache_store).
+ */
+int split_load_state(struct giga_directory *dir);
+int split_store_state(struct giga_directory *dir);
+
+#endif /* SPLIT_H */